@@ -0,0 +1,613 @@
+/* Copyright (C) Basemap, Inc DBA Automaton  All Rights Reserved
+ * Unauthorized copying of this file, via any medium is strictly prohibited
+ * Proprietary and confidential
+ * Written by Asa Hammond <asa@automaton.is>, 2022
+ */
+
+/*
+ * imsym op benchmarks, with sym::Values copy and mutate as the baseline where it has an equivalent
+ *
+ * every benchmark runs over {1k, 100k, 1M} keys x {Pose3, Vector3, scalar, a mix of the three},
+ * the second argument is the mix_t. Edits and lookups work on a batch of kBatch keys per iteration.
+ *
+ *   bazel run -c opt //imsym/bench -- --benchmark_filter=at/
+ *
+ * prints json by default, --benchmark_out=<file> keeps a copy to diff across releases.
+ *
+ * churn_default_heap and churn_pool_heap compare the memory policies on a logging style workload,
+ * see memory.hh, they take a number of frames instead of keys.
+ *
+ * rebind_copies and to_local_round_trip check that moving values between memory policies copies the
+ * data once, every allocation on the benchmark thread is counted for them.
+ */
+
+#include "imsym/imsym.hh"
+#include "imsym/opt/values_ext_ops.hh"
+//
+#include <benchmark/benchmark.h>
+#include <cereal/archives/binary.hpp>
+#include <sym/pose3.h>
+#include <sym/rot3.h>
+#include <symforce/opt/key.h>
+#include <symforce/opt/values.h>
+
+#include <algorithm>
+#include <atomic>
+#include <cstdint>
+#include <cstdlib>
+#include <deque>
+#include <memory>
+#include <new>
+#include <random>
+#include <sstream>
+#include <string>
+#include <tuple>
+#include <variant>
+#include <vector>
+
+// bytes through the global operator new on this thread
+static thread_local size_t global_allocated_bytes = 0;
+
+auto operator new(const size_t size) -> void* {
+    global_allocated_bytes += size;
+    if (auto* p = std::malloc(size)) {
+        return p;
+    }
+    throw std::bad_alloc{};
+}
+
+void operator delete(void* p) noexcept {
+    std::free(p);
+}
+
+void operator delete(void* p, size_t) noexcept {
+    std::free(p);
+}
+
+namespace {
+
+using imsym::key::key_t;
+using imsym::values::valuesd_t;
+using value_t = std::variant<double, sym::Vector3d, sym::Pose3d>;
+
+enum class mix_t : int64_t { POSE3 = 0, VECTOR3 = 1, SCALAR = 2, MIXED = 3 };
+
+constexpr int64_t kBatch = 1000;
+
+auto make_value(const mix_t mix, const int64_t i, std::mt19937& gen) -> value_t {
+    const auto kind = mix == mix_t::MIXED ? static_cast<mix_t>(i % 3) : mix;
+    const auto x = static_cast<double>(i);
+    switch (kind) {
+        case mix_t::POSE3:
+            return sym::Pose3d(sym::Rot3d::Random(gen), sym::Vector3d::Constant(x));
+        case mix_t::VECTOR3:
+            return sym::Vector3d(x, x + 1, x + 2);
+        default:
+            return x;
+    }
+}
+
+auto make_key(const char letter, const int64_t i) -> key_t {
+    return key_t{.letter = letter, .sub = i};
+}
+
+/*
+ * the same values as imsym and sym::Values, plus the batches the edits work on
+ */
+struct fixture_t {
+    valuesd_t values;
+    sym::Valuesd sym_values;
+    immer::vector<key_t> keys;
+    std::vector<sym::Key> sym_keys;
+
+    // the first kBatch keys, a window of consecutive entries, and new values for them
+    immer::vector<key_t> batch;
+    std::vector<value_t> batch_values;
+    imsym::values::index_t batch_index;
+    sym::index_t sym_batch_index;
+
+    // values whose batch keys hold batch_values, same layout as values
+    valuesd_t updated;
+    sym::Valuesd sym_updated;
+
+    // kBatch keys which aren't in values
+    valuesd_t extra;
+    sym::Valuesd sym_extra;
+    sym::index_t sym_extra_index;
+
+    std::string serialized;
+};
+
+auto build(const int64_t n, const mix_t mix) -> std::unique_ptr<fixture_t> {
+    std::mt19937 gen(20);
+    auto f = std::make_unique<fixture_t>();
+
+    auto builder = imsym::values::values_builder_t<double>{};
+    auto keys = immer::vector<key_t>{}.transient();
+    for (int64_t i = 0; i < n; i++) {
+        const auto key = make_key('v', i);
+        const auto sym_key = imsym::key::to(key);
+        std::visit(
+            [&](const auto& value) {
+                builder.set(key, value);
+                f->sym_values.Set(sym_key, value);
+            },
+            make_value(mix, i, gen));
+        keys.push_back(key);
+        f->sym_keys.push_back(sym_key);
+    }
+    f->values = std::move(builder).finalize();
+    f->keys = std::move(keys).persistent();
+
+    const auto batch_size = std::min(kBatch, n);
+    f->batch = f->keys.take(batch_size);
+    for (int64_t i = 0; i < batch_size; i++) {
+        f->batch_values.push_back(make_value(mix, i, gen));
+    }
+    f->batch_index = imsym::values::create_index(f->values, f->batch);
+    f->sym_batch_index = f->sym_values.CreateIndex(imsym::key::to(f->batch));
+
+    auto updated = imsym::values::values_builder_t<double>{f->values};
+    f->sym_updated = f->sym_values;
+    auto extra = imsym::values::values_builder_t<double>{};
+    for (int64_t i = 0; i < batch_size; i++) {
+        std::visit(
+            [&](const auto& value) {
+                updated.set(f->batch[i], value);
+                f->sym_updated.Set(imsym::key::to(f->batch[i]), value);
+                extra.set(make_key('x', i), value);
+                f->sym_extra.Set(imsym::key::to(make_key('x', i)), value);
+            },
+            f->batch_values[i]);
+    }
+    f->updated = std::move(updated).finalize();
+    f->extra = std::move(extra).finalize();
+    f->sym_extra_index = f->sym_extra.CreateIndex(f->sym_extra.Keys());
+
+    auto out = std::ostringstream{};
+    {
+        auto archive = cereal::BinaryOutputArchive(out);
+        archive(f->values);
+    }
+    f->serialized = out.str();
+    return f;
+}
+
+// fixtures are big at 1M keys, only the last one is kept around
+auto fixture(const benchmark::State& state) -> const fixture_t& {
+    static auto last = std::tuple<int64_t, int64_t>{-1, -1};
+    static auto cached = std::unique_ptr<fixture_t>{};
+    const auto args = std::tuple{state.range(0), state.range(1)};
+    if (args != last) {
+        cached.reset();
+        cached = build(state.range(0), static_cast<mix_t>(state.range(1)));
+        last = args;
+    }
+    return *cached;
+}
+
+auto batch_size(const fixture_t& f) -> int64_t {
+    return static_cast<int64_t>(f.batch.size());
+}
+
+/*
+ * set: by value edits of the batch keys
+ */
+void set(benchmark::State& state) {
+    const auto& f = fixture(state);
+    for (auto _ : state) {
+        auto values = f.values;
+        for (size_t i = 0; i < f.batch.size(); i++) {
+            std::visit(
+                [&](const auto& value) {
+                    values = imsym::values::set(std::move(values), f.batch[i], value);
+                },
+                f.batch_values[i]);
+        }
+        benchmark::DoNotOptimize(values);
+    }
+    state.SetItemsProcessed(state.iterations() * batch_size(f));
+}
+
+void sym_set(benchmark::State& state) {
+    const auto& f = fixture(state);
+    for (auto _ : state) {
+        auto values = f.sym_values;
+        for (size_t i = 0; i < f.batch.size(); i++) {
+            std::visit(
+                [&](const auto& value) {
+                    values.Set(f.sym_keys[i], value);
+                },
+                f.batch_values[i]);
+        }
+        benchmark::DoNotOptimize(values);
+    }
+    state.SetItemsProcessed(state.iterations() * batch_size(f));
+}
+
+/*
+ * at: typed reads of the batch keys
+ */
+void at(benchmark::State& state) {
+    const auto& f = fixture(state);
+    for (auto _ : state) {
+        for (size_t i = 0; i < f.batch.size(); i++) {
+            std::visit(
+                [&]<typename T>(const T&) {
+                    benchmark::DoNotOptimize(imsym::values::at<double, T>(f.values, f.batch[i]));
+                },
+                f.batch_values[i]);
+        }
+    }
+    state.SetItemsProcessed(state.iterations() * batch_size(f));
+}
+
+void sym_at(benchmark::State& state) {
+    const auto& f = fixture(state);
+    for (auto _ : state) {
+        for (size_t i = 0; i < f.batch.size(); i++) {
+            std::visit(
+                [&]<typename T>(const T&) {
+                    benchmark::DoNotOptimize(f.sym_values.At<T>(f.sym_keys[i]));
+                },
+                f.batch_values[i]);
+        }
+    }
+    state.SetItemsProcessed(state.iterations() * batch_size(f));
+}
+
+/*
+ * merge: kBatch new keys into the values
+ */
+void merge(benchmark::State& state) {
+    const auto& f = fixture(state);
+    for (auto _ : state) {
+        benchmark::DoNotOptimize(imsym::values::merge(f.values, f.extra));
+    }
+    state.SetItemsProcessed(state.iterations() * batch_size(f));
+}
+
+void sym_merge(benchmark::State& state) {
+    const auto& f = fixture(state);
+    for (auto _ : state) {
+        auto values = f.sym_values;
+        values.UpdateOrSet(f.sym_extra_index, f.sym_extra);
+        benchmark::DoNotOptimize(values);
+    }
+    state.SetItemsProcessed(state.iterations() * batch_size(f));
+}
+
+/*
+ * extract: the batch window into new values
+ */
+void extract(benchmark::State& state) {
+    const auto& f = fixture(state);
+    for (auto _ : state) {
+        benchmark::DoNotOptimize(imsym::values::extract(f.values, f.batch_index));
+    }
+    state.SetItemsProcessed(state.iterations() * batch_size(f));
+}
+
+void sym_extract(benchmark::State& state) {
+    const auto& f = fixture(state);
+    for (auto _ : state) {
+        auto values = sym::Valuesd{};
+        values.UpdateOrSet(f.sym_batch_index, f.sym_values);
+        benchmark::DoNotOptimize(values);
+    }
+    state.SetItemsProcessed(state.iterations() * batch_size(f));
+}
+
+/*
+ * update: the batch keys from values of the same layout, through an index
+ */
+void update(benchmark::State& state) {
+    const auto& f = fixture(state);
+    for (auto _ : state) {
+        benchmark::DoNotOptimize(
+            imsym::values::update(f.batch_index, f.batch_index, f.values, f.updated));
+    }
+    state.SetItemsProcessed(state.iterations() * batch_size(f));
+}
+
+void sym_update(benchmark::State& state) {
+    const auto& f = fixture(state);
+    for (auto _ : state) {
+        auto values = f.sym_values;
+        values.Update(f.sym_batch_index, f.sym_batch_index, f.sym_updated);
+        benchmark::DoNotOptimize(values);
+    }
+    state.SetItemsProcessed(state.iterations() * batch_size(f));
+}
+
+/*
+ * cleanup: remove the batch keys and repack
+ */
+void cleanup(benchmark::State& state) {
+    const auto& f = fixture(state);
+    for (auto _ : state) {
+        const auto dropped = imsym::values::drop_keys(f.values, f.batch);
+        benchmark::DoNotOptimize(imsym::values::cleanup(dropped));
+    }
+    state.SetItemsProcessed(state.iterations() * state.range(0));
+}
+
+void sym_cleanup(benchmark::State& state) {
+    const auto& f = fixture(state);
+    for (auto _ : state) {
+        auto values = f.sym_values;
+        for (size_t i = 0; i < f.batch.size(); i++) {
+            values.Remove(f.sym_keys[i]);
+        }
+        benchmark::DoNotOptimize(values.Cleanup());
+    }
+    state.SetItemsProcessed(state.iterations() * state.range(0));
+}
+
+/*
+ * create_index: over every key
+ */
+void create_index(benchmark::State& state) {
+    const auto& f = fixture(state);
+    for (auto _ : state) {
+        benchmark::DoNotOptimize(imsym::values::create_index(f.values, f.keys));
+    }
+    state.SetItemsProcessed(state.iterations() * state.range(0));
+}
+
+void sym_create_index(benchmark::State& state) {
+    const auto& f = fixture(state);
+    for (auto _ : state) {
+        benchmark::DoNotOptimize(f.sym_values.CreateIndex(f.sym_keys));
+    }
+    state.SetItemsProcessed(state.iterations() * state.range(0));
+}
+
+/*
+ * keys: in offset order
+ */
+void keys(benchmark::State& state) {
+    const auto& f = fixture(state);
+    for (auto _ : state) {
+        benchmark::DoNotOptimize(imsym::values::keys(f.values));
+    }
+    state.SetItemsProcessed(state.iterations() * state.range(0));
+}
+
+void sym_keys(benchmark::State& state) {
+    const auto& f = fixture(state);
+    for (auto _ : state) {
+        benchmark::DoNotOptimize(f.sym_values.Keys());
+    }
+    state.SetItemsProcessed(state.iterations() * state.range(0));
+}
+
+/*
+ * clone in both directions
+ */
+void clone_from_sym(benchmark::State& state) {
+    const auto& f = fixture(state);
+    for (auto _ : state) {
+        benchmark::DoNotOptimize(imsym::values::clone(f.sym_values));
+    }
+    state.SetItemsProcessed(state.iterations() * state.range(0));
+}
+
+void clone_to_sym(benchmark::State& state) {
+    const auto& f = fixture(state);
+    for (auto _ : state) {
+        benchmark::DoNotOptimize(imsym::values::clone(f.values));
+    }
+    state.SetItemsProcessed(state.iterations() * state.range(0));
+}
+
+/*
+ * cereal binary round trip
+ */
+void serialize(benchmark::State& state) {
+    const auto& f = fixture(state);
+    for (auto _ : state) {
+        auto out = std::ostringstream{};
+        auto archive = cereal::BinaryOutputArchive(out);
+        archive(f.values);
+        benchmark::DoNotOptimize(out);
+    }
+    state.SetItemsProcessed(state.iterations() * state.range(0));
+    state.SetBytesProcessed(state.iterations() * static_cast<int64_t>(f.serialized.size()));
+}
+
+void deserialize(benchmark::State& state) {
+    const auto& f = fixture(state);
+    for (auto _ : state) {
+        auto in = std::istringstream{f.serialized};
+        auto archive = cereal::BinaryInputArchive(in);
+        auto values = valuesd_t{};
+        archive(values);
+        benchmark::DoNotOptimize(values);
+    }
+    state.SetItemsProcessed(state.iterations() * state.range(0));
+    state.SetBytesProcessed(state.iterations() * static_cast<int64_t>(f.serialized.size()));
+}
+
+/*
+ * logging style churn on immer's default heap and on the pool, a sliding window of poses with the
+ * last few snapshots kept alive. The counters are what reached the system allocator per iteration.
+ */
+
+// immer's default heap, with the allocations it passes on to the system counted
+struct counted_heap_t {
+    static inline std::atomic<size_t> allocations{0};
+    static inline std::atomic<size_t> bytes{0};
+
+    template<typename... Tags>
+    static auto allocate(const size_t size, Tags...) -> void* {
+        allocations++;
+        bytes += size;
+        return ::operator new(size);
+    }
+
+    template<typename... Tags>
+    static auto deallocate(const size_t, void* data, Tags...) -> void {
+        ::operator delete(data);
+    }
+};
+
+using counted_memory_policy = immer::memory_policy<immer::free_list_heap_policy<counted_heap_t>,
+                                                   immer::default_refcount_policy,
+                                                   immer::default_lock_policy>;
+
+auto churn_poses() -> const std::vector<sym::Pose3d>& {
+    static const auto poses = [] {
+        std::mt19937 gen(18);
+        auto out = std::vector<sym::Pose3d>{};
+        for (int i = 0; i < 1000; i++) {
+            out.emplace_back(sym::Rot3d::Random(gen), sym::Vector3d::Constant(i));
+        }
+        return out;
+    }();
+    return poses;
+}
+
+template<typename MemoryPolicy>
+auto churn(const std::vector<sym::Pose3d>& poses, const int64_t frames) -> size_t {
+    constexpr int64_t kPerFrame = 100;
+    constexpr size_t kWindow = 10;
+    using values_t = imsym::values::values_t<double, MemoryPolicy>;
+    auto values = values_t{};
+    auto history = std::deque<values_t>{};
+    for (int64_t frame = 0; frame < frames; frame++) {
+        auto builder = imsym::values::values_builder_t<double, MemoryPolicy>{std::move(values)};
+        for (int64_t i = 0; i < kPerFrame; i++) {
+            const auto sub = frame * kPerFrame + i;
+            builder.set(make_key('P', sub), poses[sub % poses.size()]);
+            builder.remove(make_key('P', sub - static_cast<int64_t>(kWindow) * kPerFrame));
+        }
+        values = imsym::values::compact_if_needed(std::move(builder).finalize(),
+                                                  imsym::values::compaction_policy_t{});
+        history.push_back(values);
+        if (history.size() > kWindow) {
+            history.pop_front();
+        }
+    }
+    return values.num_entries();
+}
+
+void churn_default_heap(benchmark::State& state) {
+    const auto& poses = churn_poses();
+    counted_heap_t::allocations = 0;
+    for (auto _ : state) {
+        benchmark::DoNotOptimize(churn<counted_memory_policy>(poses, state.range(0)));
+    }
+    state.counters["system_allocations"] =
+        benchmark::Counter(static_cast<double>(counted_heap_t::allocations.load()),
+                           benchmark::Counter::kAvgIterations);
+    state.SetItemsProcessed(state.iterations() * state.range(0));
+}
+
+void churn_pool_heap(benchmark::State& state) {
+    const auto& poses = churn_poses();
+    const auto before = imsym::pool_heap_t::stats();
+    for (auto _ : state) {
+        benchmark::DoNotOptimize(churn<imsym::pool_memory_policy>(poses, state.range(0)));
+    }
+    const auto after = imsym::pool_heap_t::stats();
+    state.counters["slabs"] = benchmark::Counter(static_cast<double>(after.slabs - before.slabs),
+                                                 benchmark::Counter::kAvgIterations);
+    state.counters["large_allocations"] =
+        benchmark::Counter(static_cast<double>(after.large_allocations - before.large_allocations),
+                           benchmark::Counter::kAvgIterations);
+    state.SetItemsProcessed(state.iterations() * state.range(0));
+}
+
+/*
+ * rebind onto a policy which allocates every node from the counted heap, no free list. Whatever
+ * else reaches the global operator new during the copy is scratch, a second copy of the data would
+ * show up there.
+ */
+using counted_no_free_list_policy = immer::memory_policy<immer::heap_policy<counted_heap_t>,
+                                                         immer::default_refcount_policy,
+                                                         immer::default_lock_policy>;
+
+void rebind_copies(benchmark::State& state) {
+    const auto& f = fixture(state);
+    const auto data_bytes = f.values.data.size() * sizeof(double);
+    size_t scratch = 0;
+    size_t copied = 0;
+    for (auto _ : state) {
+        const auto global_before = global_allocated_bytes;
+        const auto heap_before = counted_heap_t::bytes.load();
+        auto copy = imsym::values::rebind<counted_no_free_list_policy>(f.values);
+        const auto heap = counted_heap_t::bytes.load() - heap_before;
+        scratch = std::max(scratch, global_allocated_bytes - global_before - heap);
+        copied = heap;
+        benchmark::DoNotOptimize(copy);
+    }
+    if (scratch >= data_bytes / 2) {
+        state.SkipWithError("rebind made a scratch copy of the data");
+    }
+    state.counters["scratch_bytes"] = static_cast<double>(scratch);
+    state.counters["copied_per_data_byte"] =
+        static_cast<double>(copied) / static_cast<double>(std::max<size_t>(data_bytes, 1));
+    state.SetBytesProcessed(state.iterations() * static_cast<int64_t>(data_bytes));
+}
+
+// to_local and back, both go through rebind so about two copies' worth of nodes per iteration
+void to_local_round_trip(benchmark::State& state) {
+    const auto& f = fixture(state);
+    const auto data_bytes = f.values.data.size() * sizeof(double);
+    const auto before = global_allocated_bytes;
+    for (auto _ : state) {
+        auto local = imsym::values::to_local(f.values);
+        benchmark::DoNotOptimize(imsym::values::to_shared(local));
+    }
+    state.counters["allocated_per_data_byte"] = benchmark::Counter(
+        static_cast<double>(global_allocated_bytes - before) /
+            static_cast<double>(std::max<size_t>(data_bytes, 1)),
+        benchmark::Counter::kAvgIterations);
+    state.SetBytesProcessed(state.iterations() * static_cast<int64_t>(data_bytes));
+}
+
+auto frames(benchmark::internal::Benchmark* b) -> void {
+    b->ArgNames({"frames"});
+    b->Arg(1'000);
+    b->Unit(benchmark::kMillisecond);
+}
+
+auto sizes(benchmark::internal::Benchmark* b) -> void {
+    b->ArgNames({"keys", "mix"});
+    b->ArgsProduct({{1'000, 100'000, 1'000'000},
+                    {static_cast<int64_t>(mix_t::POSE3),
+                     static_cast<int64_t>(mix_t::VECTOR3),
+                     static_cast<int64_t>(mix_t::SCALAR),
+                     static_cast<int64_t>(mix_t::MIXED)}});
+    b->Unit(benchmark::kMicrosecond);
+}
+
+}   // namespace
+
+BENCHMARK(set)->Apply(sizes);
+BENCHMARK(sym_set)->Apply(sizes);
+BENCHMARK(at)->Apply(sizes);
+BENCHMARK(sym_at)->Apply(sizes);
+BENCHMARK(merge)->Apply(sizes);
+BENCHMARK(sym_merge)->Apply(sizes);
+BENCHMARK(extract)->Apply(sizes);
+BENCHMARK(sym_extract)->Apply(sizes);
+BENCHMARK(update)->Apply(sizes);
+BENCHMARK(sym_update)->Apply(sizes);
+BENCHMARK(cleanup)->Apply(sizes);
+BENCHMARK(sym_cleanup)->Apply(sizes);
+BENCHMARK(create_index)->Apply(sizes);
+BENCHMARK(sym_create_index)->Apply(sizes);
+BENCHMARK(keys)->Apply(sizes);
+BENCHMARK(sym_keys)->Apply(sizes);
+BENCHMARK(clone_from_sym)->Apply(sizes);
+BENCHMARK(clone_to_sym)->Apply(sizes);
+BENCHMARK(serialize)->Apply(sizes);
+BENCHMARK(deserialize)->Apply(sizes);
+BENCHMARK(churn_default_heap)->Apply(frames);
+BENCHMARK(churn_pool_heap)->Apply(frames);
+BENCHMARK(rebind_copies)->Apply(sizes);
+BENCHMARK(to_local_round_trip)->Apply(sizes);
+
+BENCHMARK_MAIN();
@@ -5,13 +5,26 @@
  */
 
 #pragma once
+#include "imsym/opt/covariance.hh"
+#include "imsym/opt/dense.hh"
+#include "imsym/opt/hasher.hh"
 #include "imsym/opt/key.hh"
+#include "imsym/opt/memory.hh"
+#include "imsym/opt/sparse.hh"
+#include "imsym/opt/type_dispatch.hh"
 #include "imsym/opt/types.hh"
 #include "imsym/opt/values.hh"
+#include "imsym/opt/values_archive.hh"
+#include "imsym/opt/values_builder.hh"
+#include "imsym/opt/values_diff.hh"
 #include "imsym/opt/values_ops.hh"
+#include "imsym/opt/values_tangent.hh"
+#include "imsym/opt/values_view.hh"
+#include "imsym/opt/worker_pool.hh"
 
 // don't pull these in unless interop with symforce is needed
 // #include "imsym/opt/values_ext_ops.hh"
 // #include "imsym/opt/formatters.hh"
 // #include "imsym/opt/interop.hh"
+// #include "imsym/opt/lazy_stats.hh"
 
@@ -0,0 +1,383 @@
+/* Copyright (C) Basemap, Inc DBA Automaton  All Rights Reserved
+ * Unauthorized copying of this file, via any medium is strictly prohibited
+ * Proprietary and confidential
+ * Written by Asa Hammond <asa@automaton.is>, 2021
+ */
+
+#pragma once
+#include <immer/algorithm.hpp>
+#include <immer/flex_vector.hpp>
+#include <immer/vector.hpp>
+
+#include <algorithm>
+#include <cmath>
+#include <cstddef>
+#include <cstring>
+#include <type_traits>
+#include <utility>
+
+/*
+ * chunk level helpers over the immer vectors backing values_t data
+ *
+ * immer hands out the leaves of a vector as contiguous [first, last) chunks. Two versions of a
+ * vector that share a leaf hand out the same pointer for it, which lets comparisons skip shared
+ * leaves without looking at the scalars.
+ */
+
+namespace imsym::values {
+
+// span comparisons used by the chunk walkers
+// bitwise identical spans are equal, otherwise elements are compared with ==
+struct exact_equal_t {
+    template<typename T>
+    auto operator()(const T* a, const T* b, const size_t count) const -> bool {
+        if constexpr (std::is_trivially_copyable_v<T>) {
+            if (std::memcmp(a, b, count * sizeof(T)) == 0) {
+                return true;
+            }
+        }
+        return std::equal(a, a + count, b);
+    }
+};
+
+template<typename T>
+struct within_t {
+    static constexpr size_t kBlock = 16;
+
+    T tolerance;
+
+    // branch free within a block so the compare vectorizes, early out between blocks
+    auto operator()(const T* a, const T* b, const size_t count) const -> bool {
+        size_t i = 0;
+        for (; i + kBlock <= count; i += kBlock) {
+            bool outside = false;
+            for (size_t j = i; j < i + kBlock; j++) {
+                outside |= not(std::abs(a[j] - b[j]) <= tolerance);
+            }
+            if (outside) {
+                return false;
+            }
+        }
+        bool outside = false;
+        for (; i < count; i++) {
+            outside |= not(std::abs(a[i] - b[i]) <= tolerance);
+        }
+        return not outside;
+    }
+};
+
+/*
+ * compare data[offset, offset + count) against the contiguous span other
+ */
+template<typename Data, typename Eq>
+inline auto range_equal(const Data& data,
+                        const size_t offset,
+                        const typename Data::value_type* other,
+                        const size_t count,
+                        Eq&& eq) -> bool {
+    using Scalar = typename Data::value_type;
+    const auto first = data.begin() + offset;
+    const auto compare = [&](const Scalar* begin, const Scalar* end) {
+        const auto n = static_cast<size_t>(end - begin);
+        if (begin != other and not eq(begin, other, n)) {
+            return false;
+        }
+        other += n;
+        return true;
+    };
+    return immer::for_each_chunk_p(first, first + count, compare);
+}
+
+/*
+ * compare a[offset_a, offset_a + count) against b[offset_b, offset_b + count)
+ */
+template<typename Data, typename Eq>
+inline auto ranges_equal(const Data& a,
+                         const size_t offset_a,
+                         const Data& b,
+                         const size_t offset_b,
+                         const size_t count,
+                         Eq&& eq) -> bool {
+    using Scalar = typename Data::value_type;
+    size_t pos = 0;
+    const auto first = a.begin() + offset_a;
+    const auto compare = [&](const Scalar* begin, const Scalar* end) {
+        const auto n = static_cast<size_t>(end - begin);
+        if (not range_equal(b, offset_b + pos, begin, n, eq)) {
+            return false;
+        }
+        pos += n;
+        return true;
+    };
+    return immer::for_each_chunk_p(first, first + count, compare);
+}
+
+namespace detail {
+
+// the branching of the rrb tree behind an immer vector, from its template arguments
+template<typename Data>
+struct tree_bits;
+
+template<typename T, typename MemoryPolicy, auto B, auto BL>
+struct tree_bits<immer::vector<T, MemoryPolicy, B, BL>> {
+    static constexpr unsigned inner = B;
+    static constexpr unsigned leaf = BL;
+};
+
+template<typename T, typename MemoryPolicy, auto B, auto BL>
+struct tree_bits<immer::flex_vector<T, MemoryPolicy, B, BL>> {
+    static constexpr unsigned inner = B;
+    static constexpr unsigned leaf = BL;
+};
+
+/*
+ * true when the nodes of Data can be walked directly, see tree_walk_t
+ * anything else falls back to comparing leaf by leaf
+ */
+template<typename Data>
+constexpr bool kTreeWalk = requires(const Data& data) {
+    tree_bits<Data>::inner;
+    data.impl().tail_offset();
+    data.impl().shift;
+    data.impl().tail->leaf();
+    data.impl().root->inner()[0];
+    data.impl().root->relaxed()->d.count;
+    data.impl().root->relaxed()->d.sizes[0];
+};
+
+/*
+ * b's chunks over [begin, end), those that aren't the same leaf at the same position in a go to fn
+ * every chunk costs a probe into a
+ */
+template<typename Data, typename Fn>
+inline auto for_each_unshared_chunk_in(
+    const Data& a, const Data& b, const size_t begin, const size_t end, Fn&& fn) -> void {
+    using Scalar = typename Data::value_type;
+    size_t offset = begin;
+    const auto visit = [&](const Scalar* first, const Scalar* last) {
+        const auto count = static_cast<size_t>(last - first);
+        // shared when a's first chunk over the same range is the very same span
+        bool shared = false;
+        const auto a_first = a.begin() + offset;
+        const auto check_first = [&](const Scalar* chunk_begin, const Scalar* chunk_end) {
+            shared = chunk_begin == first and static_cast<size_t>(chunk_end - chunk_begin) == count;
+            return false;
+        };
+        immer::for_each_chunk_p(a_first, a_first + count, check_first);
+        if (not shared) {
+            fn(offset, first, last);
+        }
+        offset += count;
+    };
+    immer::for_each_chunk(b.begin() + begin, b.begin() + end, visit);
+}
+
+/*
+ * descends a and b together, node by node
+ * a node shared by both is skipped without looking under it, so the walk costs
+ * O(changed leaves * depth). Where the two trees stop lining up, eg. after a concat or an insert
+ * in the middle, the rest of that subtree goes leaf by leaf.
+ * Inner nodes at shift s have children covering 1 << s elements each unless they are relaxed, in
+ * which case their sizes say where each child ends. The children of nodes at the leaf shift are
+ * leaves.
+ */
+template<typename Data>
+struct tree_walk_t {
+    using node_t = std::remove_pointer_t<decltype(std::declval<const Data&>().impl().root)>;
+    static constexpr auto kInnerBits = tree_bits<Data>::inner;
+    static constexpr auto kLeafBits = tree_bits<Data>::leaf;
+
+    const Data& a;
+    const Data& b;
+
+    static auto count(node_t* node, const unsigned shift, const size_t extent) -> size_t {
+        if (const auto* relaxed = node->relaxed()) {
+            return relaxed->d.count;
+        }
+        return extent == 0 ? 0 : ((extent - 1) >> shift) + 1;
+    }
+
+    // where child i ends, relative to the start of node
+    static auto child_end(node_t* node, const unsigned shift, const size_t extent, const size_t i)
+        -> size_t {
+        if (const auto* relaxed = node->relaxed()) {
+            return relaxed->d.sizes[i];
+        }
+        return std::min((i + 1) << shift, extent);
+    }
+
+    /*
+     * na and nb sit at offset at the same shift, and cover extent_a and extent_b elements
+     * walks b over [offset, offset + common), common is at most extent_b
+     * where a's children stop lining up with b's the rest is walked leaf by leaf, from the start of
+     * one of b's children so the chunks handed out are whole leaves either way
+     */
+    template<typename Fn>
+    auto walk(node_t* na,
+              node_t* nb,
+              const unsigned shift,
+              const size_t extent_a,
+              const size_t extent_b,
+              const size_t offset,
+              const size_t common,
+              Fn& fn) const -> void {
+        if (na == nb) {
+            return;
+        }
+        const auto count_a = count(na, shift, extent_a);
+        const auto count_b = count(nb, shift, extent_b);
+        size_t start = 0;
+        for (size_t i = 0; i < count_b and start < common; i++) {
+            if (i >= count_a) {
+                for_each_unshared_chunk_in(a, b, offset + start, offset + common, fn);
+                return;
+            }
+            const auto end_a = child_end(na, shift, extent_a, i);
+            const auto end_b = child_end(nb, shift, extent_b, i);
+            const auto end = std::min(end_b, common);
+            auto* child_a = na->inner()[i];
+            auto* child_b = nb->inner()[i];
+            if (shift == kLeafBits) {
+                if (child_a != child_b) {
+                    const auto* first = child_b->leaf();
+                    fn(offset + start, first, first + (end - start));
+                }
+            } else {
+                walk(child_a,
+                     child_b,
+                     shift - kInnerBits,
+                     end_a - start,
+                     end_b - start,
+                     offset + start,
+                     end - start,
+                     fn);
+            }
+            if (end_a != end_b) {
+                // a's next child starts somewhere else
+                for_each_unshared_chunk_in(a, b, offset + end, offset + common, fn);
+                return;
+            }
+            start = end;
+        }
+    }
+
+    // descend from the root along the first child until node sits at shift
+    static auto lower(node_t*& node, unsigned& from, const unsigned shift, size_t& extent) -> void {
+        for (; from > shift and extent > 0; from -= kInnerBits) {
+            extent = child_end(node, from, extent, 0);
+            node = node->inner()[0];
+        }
+    }
+
+    // walks b over [0, size)
+    template<typename Fn>
+    auto run(const size_t size, Fn& fn) const -> void {
+        const auto& ta = a.impl();
+        const auto& tb = b.impl();
+        node_t* root_a = ta.root;
+        node_t* root_b = tb.root;
+        unsigned shift_a = ta.shift;
+        unsigned shift_b = tb.shift;
+        size_t extent_a = ta.tail_offset();
+        size_t extent_b = tb.tail_offset();
+
+        // a tree one level taller than the other has the shorter one's nodes under its first child
+        lower(root_a, shift_a, shift_b, extent_a);
+        lower(root_b, shift_b, shift_a, extent_b);
+        const auto tree = std::min(extent_b, size);
+        if (tree > 0 and extent_a > 0 and shift_a == shift_b) {
+            walk(root_a, root_b, shift_b, extent_a, extent_b, 0, tree, fn);
+        } else if (tree > 0) {
+            for_each_unshared_chunk_in(a, b, 0, tree, fn);
+        }
+
+        // whatever of b's tree wasn't under the lowered root, then b's tail
+        const auto tail = std::min<size_t>(tb.tail_offset(), size);
+        if (tree < tail) {
+            for_each_unshared_chunk_in(a, b, tree, tail, fn);
+        }
+        if (tail < size and ta.tail_offset() == tb.tail_offset()) {
+            if (ta.tail != tb.tail) {
+                const auto* first = tb.tail->leaf();
+                fn(tail, first, first + (size - tail));
+            }
+        } else if (tail < size) {
+            for_each_unshared_chunk_in(a, b, tail, size, fn);
+        }
+    }
+};
+
+}   // namespace detail
+
+/*
+ * walk the chunks of b over the prefix it has in common with a, calling
+ * fn(offset, first, last) for every chunk that isn't the same leaf at the same position in a
+ * shared leaves cost a pointer compare, their scalars are never read, and subtrees shared by both
+ * are skipped whole. The cost follows the number of leaves that changed, not the size of b.
+ */
+template<typename Data, typename Fn>
+inline auto for_each_unshared_chunk(const Data& a, const Data& b, Fn&& fn) -> void {
+    const auto size = std::min(a.size(), b.size());
+    if (size == 0 or (a.size() == b.size() and a.identity() == b.identity())) {
+        return;
+    }
+    if constexpr (detail::kTreeWalk<Data>) {
+        detail::tree_walk_t<Data>{a, b}.run(size, fn);
+    } else {
+        detail::for_each_unshared_chunk_in(a, b, 0, size, fn);
+    }
+}
+
+/*
+ * a == b over the whole of both, chunk by chunk
+ * identical vectors are a pointer compare, leaves shared by both are skipped, the rest go to eq
+ */
+template<typename Data, typename Eq>
+inline auto data_equal(const Data& a, const Data& b, Eq&& eq) -> bool {
+    using Scalar = typename Data::value_type;
+    if (a.size() != b.size()) {
+        return false;
+    }
+    if (a.identity() == b.identity()) {
+        return true;
+    }
+    size_t offset = 0;
+    const auto compare = [&](const Scalar* first, const Scalar* last) {
+        const auto count = static_cast<size_t>(last - first);
+        if (not range_equal(a, offset, first, count, eq)) {
+            return false;
+        }
+        offset += count;
+        return true;
+    };
+    return immer::for_each_chunk_p(b.begin(), b.end(), compare);
+}
+
+/*
+ * the elements of data when they all live in one leaf, otherwise nullptr
+ * empty data has no storage and gives nullptr as well
+ */
+template<typename Data>
+inline auto single_chunk(const Data& data) -> const typename Data::value_type* {
+    using T = typename Data::value_type;
+    const T* found = nullptr;
+    size_t chunks = 0;
+    immer::for_each_chunk_p(data, [&](const T* first, const T*) {
+        found = first;
+        return ++chunks < 2;
+    });
+    return chunks == 1 ? found : nullptr;
+}
+
+// copy the whole of data to out a chunk at a time, returns the end of what was written
+template<typename Data>
+inline auto copy_chunks(const Data& data, typename Data::value_type* out)
+    -> typename Data::value_type* {
+    using T = typename Data::value_type;
+    immer::for_each_chunk(data, [&out](const T* first, const T* last) {
+        out = std::copy(first, last, out);
+    });
+    return out;
+}
+
+}   // namespace imsym::values
@@ -0,0 +1,456 @@
+/* Copyright (C) Basemap, Inc DBA Automaton  All Rights Reserved
+ * Unauthorized copying of this file, via any medium is strictly prohibited
+ * Proprietary and confidential
+ * Written by Asa Hammond <asa@automaton.is>, 2022
+ */
+#pragma once
+#include "imsym/opt/chunks.hh"
+#include "imsym/opt/dense.hh"
+#include "imsym/opt/types.hh"
+#include "imsym/opt/values.hh"
+//
+#include <immer/algorithm.hpp>
+
+#include <Eigen/Core>
+#include <algorithm>
+#include <cmath>
+#include <limits>
+#include <stdexcept>
+#include <string>
+#include <type_traits>
+#include <utility>
+#include <vector>
+
+/*
+ * ops on a symmetric matrix stored as its packed lower triangle, ie. full_covariance_t
+ *
+ * The packing is the one dense_lt_matrix uses: column major, each column from the diagonal down,
+ * n (n + 1) / 2 scalars for an n x n matrix.
+ *  - selfadjoint_product is A x read straight off the leaves
+ *  - llt and ldlt copy the triangle out once and factor it in place, packed: a Cholesky as LAPACK's
+ *    pptrf, and an LDL^T with Bunch-Kaufman pivoting as sptrf
+ *  - the triangular solves run on the packed factor, or on any dense_lt_matrix as L
+ *  - marginal reads only the columns of the block it returns
+ * Nothing here builds the n x n matrix. Eigen has no packed storage, so for its SelfAdjointView use
+ * to_eigen(m).template selfadjointView<Eigen::Lower>().
+ */
+
+namespace imsym {
+
+namespace detail {
+
+// the offset of (col, col) in the packed lower triangle of an n x n matrix
+inline auto column_start(const long n, const long col) -> long {
+    return col * n - col * (col - 1) / 2;
+}
+
+template<typename Scalar, typename MemoryPolicy>
+inline auto check_square(const dense_lt_matrix<Scalar, MemoryPolicy>& m, const char* what)
+    -> long {
+    const auto n = m.size.row;
+    if (m.size.col != n or m.data.size() != static_cast<size_t>(n * (n + 1) / 2)) {
+        throw std::runtime_error(std::string(what) + ": expected a packed square matrix.");
+    }
+    return n;
+}
+
+template<typename Scalar, typename MemoryPolicy>
+inline auto packed(const dense_lt_matrix<Scalar, MemoryPolicy>& m) -> std::vector<Scalar> {
+    auto out = std::vector<Scalar>(m.data.size());
+    values::copy_chunks(m.data, out.data());
+    return out;
+}
+
+// L x = b in place, a column at a time, for each column of x
+template<typename Scalar>
+inline auto solve_lower_in_place(const Scalar* l,
+                                 const long n,
+                                 const bool unit,
+                                 Eigen::MatrixX<Scalar>& x) -> void {
+    for (Eigen::Index k = 0; k < x.cols(); k++) {
+        Scalar* const b = x.col(k).data();
+        for (long j = 0; j < n; j++) {
+            const Scalar* const column = l + column_start(n, j);
+            if (not unit) {
+                b[j] /= column[0];
+            }
+            const Scalar bj = b[j];
+            for (long i = j + 1; i < n; i++) {
+                b[i] -= column[i - j] * bj;
+            }
+        }
+    }
+}
+
+// L^T x = b in place, each unknown is a dot with one packed column
+template<typename Scalar>
+inline auto solve_lower_transpose_in_place(const Scalar* l,
+                                           const long n,
+                                           const bool unit,
+                                           Eigen::MatrixX<Scalar>& x) -> void {
+    for (Eigen::Index k = 0; k < x.cols(); k++) {
+        Scalar* const b = x.col(k).data();
+        for (long j = n - 1; j >= 0; j--) {
+            const Scalar* const column = l + column_start(n, j);
+            Scalar sum = b[j];
+            for (long i = j + 1; i < n; i++) {
+                sum -= column[i - j] * b[i];
+            }
+            b[j] = unit ? sum : sum / column[0];
+        }
+    }
+}
+
+template<typename Scalar, typename MemoryPolicy>
+inline auto check_rhs(const dense_lt_matrix<Scalar, MemoryPolicy>& l,
+                      const Eigen::MatrixX<Scalar>& b) -> long {
+    const auto n = check_square(l, "solve");
+    if (b.rows() != n) {
+        throw std::runtime_error("solve: the right hand side doesn't match the matrix size.");
+    }
+    return n;
+}
+
+}   // namespace detail
+
+// the packed lower triangle of a symmetric matrix, the strictly upper part of m isn't read
+template<typename Scalar>
+inline auto to_full_covariance(const Eigen::MatrixX<Scalar>& m) -> dense_lt_matrix<Scalar> {
+    if (m.rows() != m.cols()) {
+        throw std::runtime_error("to_full_covariance: the matrix isn't square.");
+    }
+    return to_imsym_lt(m);
+}
+
+// (row, col) of the symmetric matrix, either triangle
+template<typename Scalar, typename MemoryPolicy>
+inline auto coeff(const dense_lt_matrix<Scalar, MemoryPolicy>& m, long row, long col) -> Scalar {
+    if (row < col) {
+        std::swap(row, col);
+    }
+    return m.data[detail::column_start(m.size.row, col) + row - col];
+}
+
+// A x, with A the symmetric matrix m packs
+template<typename Scalar, typename MemoryPolicy>
+inline auto selfadjoint_product(const dense_lt_matrix<Scalar, MemoryPolicy>& m,
+                                const std::type_identity_t<Eigen::MatrixX<Scalar>>& x)
+    -> Eigen::MatrixX<Scalar> {
+    const auto n = detail::check_square(m, "selfadjoint_product");
+    if (x.rows() != n) {
+        throw std::runtime_error("selfadjoint_product: x doesn't match the matrix size.");
+    }
+    auto out = Eigen::MatrixX<Scalar>::Zero(n, x.cols()).eval();
+    const auto product = [&](const auto col, const auto row, const Scalar* begin, const auto* end) {
+        const auto count = static_cast<Eigen::Index>(end - begin);
+        const auto column = Eigen::Map<const Eigen::VectorX<Scalar>>(begin, count);
+        // the lower part of the column, and its mirror in the upper part of the row
+        out.middleRows(row, count).noalias() += column * x.row(col);
+        out.row(col).noalias() += column.transpose() * x.middleRows(row, count);
+        if (row == col) {
+            out.row(col) -= begin[0] * x.row(col);
+        }
+    };
+    for_each_lt_run(m, product);
+    return out;
+}
+
+/*
+ * a factorization of a packed symmetric matrix, kept packed
+ * llt: A = L L^T. ldlt: P^T L D L^T P = A with L unit lower triangular, D block diagonal with 1x1
+ * and 2x2 blocks and P Bunch-Kaufman's symmetric pivoting, so indefinite matrices factor too
+ */
+template<typename Scalar>
+struct packed_factor_t {
+    long size = 0;
+    // packed as dense_lt_matrix, for an ldlt the stored diagonal is all ones
+    std::vector<Scalar> lower;
+    // D of an ldlt, empty for an llt. subdiagonal[k] is non zero where a 2x2 block starts at k
+    std::vector<Scalar> diagonal;
+    std::vector<Scalar> subdiagonal;
+    // P of an ldlt as Eigen's transpositions, row i swapped with row transpositions[i] in order
+    std::vector<long> transpositions;
+    bool unit = false;
+    Eigen::ComputationInfo info = Eigen::Success;
+};
+
+/*
+ * Cholesky in place on a packed copy, as LAPACK's pptrf does for the lower triangle
+ * each column is scaled by its pivot, then a packed rank one update of the trailing columns
+ */
+template<typename Scalar, typename MemoryPolicy>
+inline auto llt(const dense_lt_matrix<Scalar, MemoryPolicy>& m) -> packed_factor_t<Scalar> {
+    using column_t = Eigen::Map<Eigen::VectorX<Scalar>>;
+    const auto n = detail::check_square(m, "llt");
+    auto out = packed_factor_t<Scalar>{.size = n, .lower = detail::packed(m)};
+    Scalar* const a = out.lower.data();
+    for (long j = 0; j < n; j++) {
+        Scalar* const cj = a + detail::column_start(n, j);
+        if (not(cj[0] > 0) or not std::isfinite(cj[0])) {
+            out.info = Eigen::NumericalIssue;
+            return out;
+        }
+        cj[0] = std::sqrt(cj[0]);
+        auto l = column_t(cj + 1, n - j - 1);
+        l /= cj[0];
+        for (long k = j + 1; k < n; k++) {
+            column_t(a + detail::column_start(n, k), n - k) -= l.tail(n - k) * l(k - j - 1);
+        }
+    }
+    return out;
+}
+
+/*
+ * LDL^T in place on a packed copy with Bunch-Kaufman pivoting, as LAPACK's sptrf
+ * The interchanges are also applied to the columns of L already computed, so P is a plain sequence
+ * of transpositions and the solve is permute, L, D, L^T, permute back.
+ */
+template<typename Scalar, typename MemoryPolicy>
+inline auto ldlt(const dense_lt_matrix<Scalar, MemoryPolicy>& m) -> packed_factor_t<Scalar> {
+    using column_t = Eigen::Map<Eigen::VectorX<Scalar>>;
+    const auto n = detail::check_square(m, "ldlt");
+    auto out = packed_factor_t<Scalar>{.size = n, .lower = detail::packed(m), .unit = true};
+    out.diagonal.resize(n);
+    out.subdiagonal.assign(n, 0);
+    out.transpositions.resize(n);
+    Scalar* const a = out.lower.data();
+    const auto at = [a, n](const long row, const long col) -> Scalar& {
+        return a[detail::column_start(n, col) + row - col];
+    };
+    // bounds the element growth of both pivot sizes
+    const Scalar alpha = (1 + std::sqrt(Scalar(17))) / 8;
+
+    for (long k = 0; k < n;) {
+        const Scalar absakk = std::abs(at(k, k));
+        long imax = k;
+        Scalar colmax = 0;
+        for (long i = k + 1; i < n; i++) {
+            if (std::abs(at(i, k)) > colmax) {
+                colmax = std::abs(at(i, k));
+                imax = i;
+            }
+        }
+        if (not std::isfinite(absakk) or not std::isfinite(colmax)) {
+            out.info = Eigen::NumericalIssue;
+            return out;
+        }
+
+        // a zero column is a zero 1x1 pivot, solve skips it
+        long step = 1;
+        long kp = k;
+        if (absakk < alpha * colmax) {
+            // the largest off diagonal of row imax in the trailing block, at least colmax
+            Scalar rowmax = 0;
+            for (long j = k; j < n; j++) {
+                if (j != imax) {
+                    rowmax = std::max(rowmax, std::abs(j < imax ? at(imax, j) : at(j, imax)));
+                }
+            }
+            if (absakk >= alpha * colmax * (colmax / rowmax)) {
+                kp = k;
+            } else if (std::abs(at(imax, imax)) >= alpha * rowmax) {
+                kp = imax;
+            } else {
+                kp = imax;
+                step = 2;
+            }
+        }
+
+        // swap rows and columns kk and kp of the trailing block, and rows kk and kp of L
+        const long kk = k + step - 1;
+        if (kp != kk) {
+            for (long c = 0; c < kk; c++) {
+                std::swap(at(kk, c), at(kp, c));
+            }
+            for (long j = kk + 1; j < kp; j++) {
+                std::swap(at(j, kk), at(kp, j));
+            }
+            for (long i = kp + 1; i < n; i++) {
+                std::swap(at(i, kk), at(i, kp));
+            }
+            std::swap(at(kk, kk), at(kp, kp));
+        }
+        out.transpositions[k] = k;
+        out.transpositions[kk] = kp;
+
+        if (step == 1) {
+            const Scalar d = at(k, k);
+            out.diagonal[k] = d;
+            at(k, k) = 1;
+            if (d != 0) {
+                // A -= w w^T / d with the unscaled column, then L = w / d
+                auto l = column_t(&at(k, k) + 1, n - k - 1);
+                for (long j = k + 1; j < n; j++) {
+                    column_t(&at(j, j), n - j) -= l.tail(n - j) * (l(j - k - 1) / d);
+                }
+                l /= d;
+            }
+        } else {
+            const Scalar d11 = at(k, k);
+            const Scalar d21 = at(k + 1, k);
+            const Scalar d22 = at(k + 1, k + 1);
+            const Scalar det = d11 * d22 - d21 * d21;
+            auto w1 = column_t(&at(k, k) + 2, n - k - 2);
+            auto w2 = column_t(&at(k + 1, k + 1) + 1, n - k - 2);
+            // the rows of L are the rows of [w1 w2] D^-1
+            const Eigen::VectorX<Scalar> l1 = (d22 * w1 - d21 * w2) / det;
+            const Eigen::VectorX<Scalar> l2 = (d11 * w2 - d21 * w1) / det;
+            for (long j = k + 2; j < n; j++) {
+                const auto i = j - k - 2;
+                column_t(&at(j, j), n - j) -= l1.tail(n - j) * w1(i) + l2.tail(n - j) * w2(i);
+            }
+            w1 = l1;
+            w2 = l2;
+            out.diagonal[k] = d11;
+            out.diagonal[k + 1] = d22;
+            out.subdiagonal[k] = d21;
+            at(k, k) = 1;
+            at(k + 1, k) = 0;
+            at(k + 1, k + 1) = 1;
+        }
+        k += step;
+    }
+    return out;
+}
+
+// L of the factor as a dense_lt_matrix
+template<typename Scalar>
+inline auto matrix_l(const packed_factor_t<Scalar>& f) -> dense_lt_matrix<Scalar> {
+    return {.size = {.row = f.size, .col = f.size},
+            .data = immer::vector<Scalar>(f.lower.begin(), f.lower.end())};
+}
+
+namespace detail {
+
+// a failed factorization keeps no factor to solve with
+template<typename Scalar>
+inline auto check_factor(const packed_factor_t<Scalar>& f, const Eigen::MatrixX<Scalar>& b)
+    -> void {
+    if (f.info != Eigen::Success) {
+        throw std::runtime_error("solve: the factorization failed.");
+    }
+    if (b.rows() != f.size) {
+        throw std::runtime_error("solve: the right hand side doesn't match the matrix size.");
+    }
+}
+
+}   // namespace detail
+
+// L x = b
+template<typename Scalar>
+inline auto solve_lower(const packed_factor_t<Scalar>& f,
+                        std::type_identity_t<Eigen::MatrixX<Scalar>> b) -> Eigen::MatrixX<Scalar> {
+    detail::check_factor(f, b);
+    detail::solve_lower_in_place(f.lower.data(), f.size, f.unit, b);
+    return b;
+}
+
+// L^T x = b
+template<typename Scalar>
+inline auto solve_lower_transpose(const packed_factor_t<Scalar>& f,
+                                  std::type_identity_t<Eigen::MatrixX<Scalar>> b)
+    -> Eigen::MatrixX<Scalar> {
+    detail::check_factor(f, b);
+    detail::solve_lower_transpose_in_place(f.lower.data(), f.size, f.unit, b);
+    return b;
+}
+
+// A x = b through the factor
+template<typename Scalar>
+inline auto solve(const packed_factor_t<Scalar>& f, std::type_identity_t<Eigen::MatrixX<Scalar>> b)
+    -> Eigen::MatrixX<Scalar> {
+    detail::check_factor(f, b);
+    for (long i = 0; i < static_cast<long>(f.transpositions.size()); i++) {
+        b.row(i).swap(b.row(f.transpositions[i]));
+    }
+    detail::solve_lower_in_place(f.lower.data(), f.size, f.unit, b);
+    if (f.unit) {
+        // a zero pivot of a singular matrix is skipped, Eigen's LDLT solves it the same way
+        for (long i = 0; i < f.size; i++) {
+            if (f.subdiagonal[i] != 0) {
+                const Scalar d11 = f.diagonal[i];
+                const Scalar d21 = f.subdiagonal[i];
+                const Scalar d22 = f.diagonal[i + 1];
+                const Scalar det = d11 * d22 - d21 * d21;
+                const Eigen::RowVectorX<Scalar> b1 = b.row(i);
+                const Eigen::RowVectorX<Scalar> b2 = b.row(i + 1);
+                b.row(i) = (d22 * b1 - d21 * b2) / det;
+                b.row(i + 1) = (d11 * b2 - d21 * b1) / det;
+                i++;
+            } else if (std::abs(f.diagonal[i]) > std::numeric_limits<Scalar>::min()) {
+                b.row(i) /= f.diagonal[i];
+            } else {
+                b.row(i).setZero();
+            }
+        }
+    }
+    detail::solve_lower_transpose_in_place(f.lower.data(), f.size, f.unit, b);
+    for (long i = static_cast<long>(f.transpositions.size()); i-- > 0;) {
+        b.row(i).swap(b.row(f.transpositions[i]));
+    }
+    return b;
+}
+
+// L x = b and L^T x = b with the lower triangle of m as L
+template<typename Scalar, typename MemoryPolicy>
+inline auto solve_lower(const dense_lt_matrix<Scalar, MemoryPolicy>& l,
+                        std::type_identity_t<Eigen::MatrixX<Scalar>> b) -> Eigen::MatrixX<Scalar> {
+    const auto n = detail::check_rhs(l, b);
+    detail::solve_lower_in_place(detail::packed(l).data(), n, false, b);
+    return b;
+}
+
+template<typename Scalar, typename MemoryPolicy>
+inline auto solve_lower_transpose(const dense_lt_matrix<Scalar, MemoryPolicy>& l,
+                                  std::type_identity_t<Eigen::MatrixX<Scalar>> b)
+    -> Eigen::MatrixX<Scalar> {
+    const auto n = detail::check_rhs(l, b);
+    detail::solve_lower_transpose_in_place(detail::packed(l).data(), n, false, b);
+    return b;
+}
+
+/*
+ * the dim x dim diagonal block starting at offset, as a full symmetric matrix
+ * only the columns of the block are read, from the diagonal down to the end of the block
+ */
+template<typename Scalar, typename MemoryPolicy>
+inline auto marginal(const dense_lt_matrix<Scalar, MemoryPolicy>& cov,
+                     const long offset,
+                     const long dim) -> dense_matrix<Scalar> {
+    const auto n = detail::check_square(cov, "marginal");
+    if (offset < 0 or dim < 0 or offset + dim > n) {
+        throw std::runtime_error("marginal: the block is outside the matrix.");
+    }
+    auto block = Eigen::MatrixX<Scalar>(dim, dim);
+    for (long c = 0; c < dim; c++) {
+        const auto first = cov.data.begin() + detail::column_start(n, offset + c);
+        Scalar* out = block.data() + c * dim + c;
+        immer::for_each_chunk(first, first + (dim - c), [&out](const Scalar* f, const Scalar* l) {
+            out = std::copy(f, l, out);
+        });
+        for (long r = c + 1; r < dim; r++) {
+            block(c, r) = block(r, c);
+        }
+    }
+    return from_column_major(dim, dim, block.data());
+}
+
+/*
+ * the marginal covariance of key
+ * cov is over the tangent space of index, laid out in index order as the optimizer does
+ */
+template<typename Scalar, typename MemoryPolicy>
+inline auto marginal(const dense_lt_matrix<Scalar, MemoryPolicy>& cov,
+                     const values::index_t& index,
+                     const key::key_t& key) -> dense_matrix<Scalar> {
+    long offset = 0;
+    for (const auto& entry : index.entries) {
+        if (entry.key == key) {
+            return marginal(cov, offset, entry.tangent_dim);
+        }
+        offset += entry.tangent_dim;
+    }
+    throw std::runtime_error("marginal: the key isn't in the index.");
+}
+
+}   // namespace imsym
@@ -0,0 +1,195 @@
+/* Copyright (C) Basemap, Inc DBA Automaton  All Rights Reserved
+ * Unauthorized copying of this file, via any medium is strictly prohibited
+ * Proprietary and confidential
+ * Written by Asa Hammond <asa@automaton.is>, 2022
+ */
+#pragma once
+#include "imsym/opt/chunks.hh"
+#include "imsym/opt/types.hh"
+//
+#include <immer/algorithm.hpp>
+#include <immer/vector.hpp>
+
+#include <Eigen/Core>
+#include <algorithm>
+#include <memory>
+#include <stdexcept>
+#include <utility>
+#include <vector>
+
+/*
+ * conversions between the dense matrices and Eigen
+ *
+ * Both ways go a contiguous run at a time: into imsym through immer's range constructor, which
+ * fills each leaf in place before pushing it, and out of imsym a leaf at a time. eigen_view only
+ * avoids the copy for matrices small enough to fit in one immer leaf, any bigger matrix is split
+ * across leaves and the view copies it. Scalar is float or double throughout.
+ */
+
+namespace imsym {
+
+// from a contiguous column major buffer of rows * cols
+template<typename Scalar>
+inline auto from_column_major(const long rows, const long cols, const Scalar* data)
+    -> dense_matrix<Scalar> {
+    auto out = dense_matrix<Scalar>{};
+    out.size = {.row = rows, .col = cols};
+    out.data = immer::vector<Scalar>(data, data + rows * cols);
+    return out;
+}
+
+template<typename Scalar>
+inline auto to_imsym(const Eigen::MatrixX<Scalar>& m) -> dense_matrix<Scalar> {
+    return from_column_major(m.rows(), m.cols(), m.data());
+};
+
+template<typename Scalar>
+inline auto to_imsym_matrix(const Eigen::MatrixX<Scalar>& m) -> dense_matrix<Scalar> {
+    return from_column_major(m.rows(), m.cols(), m.data());
+};
+
+template<typename Scalar>
+inline auto to_imsym_matrix(const Eigen::Map<const Eigen::MatrixX<Scalar>>& m)
+    -> dense_matrix<Scalar> {
+    return from_column_major(m.rows(), m.cols(), m.data());
+};
+
+namespace detail {
+
+// the lower triangle of m, column by column, each column's part of it is contiguous in m
+template<typename Scalar>
+inline auto pack_lower(const Eigen::MatrixX<Scalar>& m) -> std::vector<Scalar> {
+    const auto cols = std::min(m.rows(), m.cols());
+    auto packed = std::vector<Scalar>{};
+    packed.reserve(static_cast<size_t>(cols * m.rows() - cols * (cols - 1) / 2));
+    for (Eigen::Index col = 0; col < cols; col++) {
+        const Scalar* first = m.data() + col * m.rows() + col;
+        const Scalar* last = m.data() + (col + 1) * m.rows();
+        packed.insert(packed.end(), first, last);
+    }
+    return packed;
+}
+
+}   // namespace detail
+
+// the lower triangle, packed with a copy per column and handed to the range constructor
+template<typename Scalar>
+inline auto to_imsym_lt(const Eigen::MatrixX<Scalar>& m) -> dense_lt_matrix<Scalar> {
+    auto out = dense_lt_matrix<Scalar>{};
+    out.size = {.row = m.rows(), .col = m.cols()};
+    const auto packed = detail::pack_lower(m);
+    out.data = immer::vector<Scalar>(packed.begin(), packed.end());
+    return out;
+};
+
+template<typename Scalar, typename MemoryPolicy>
+inline auto to_eigen(const immer::vector<Scalar, MemoryPolicy>& v) -> Eigen::VectorX<Scalar> {
+    auto out = Eigen::VectorX<Scalar>(static_cast<Eigen::Index>(v.size()));
+    values::copy_chunks(v, out.data());
+    return out;
+}
+
+template<typename Scalar, typename MemoryPolicy>
+inline auto to_eigen(const dense_matrix<Scalar, MemoryPolicy>& m) -> Eigen::MatrixX<Scalar> {
+    if (m.data.size() != static_cast<size_t>(m.size.row * m.size.col)) {
+        throw std::runtime_error("to_eigen: the data doesn't match the matrix size.");
+    }
+    auto out = Eigen::MatrixX<Scalar>(m.size.row, m.size.col);
+    values::copy_chunks(m.data, out.data());
+    return out;
+};
+
+/*
+ * walk the packed lower triangle a contiguous run at a time, calling
+ * fn(col, row, first, last) for the elements [row, row + (last - first)) of column col
+ * leaves are split where they cross the end of a column
+ * throws if the data isn't the length of the lower triangle, n * (n + 1) / 2 when square
+ */
+template<typename Scalar, typename MemoryPolicy, typename Fn>
+inline auto for_each_lt_run(const dense_lt_matrix<Scalar, MemoryPolicy>& m, Fn&& fn) -> void {
+    const auto rows = static_cast<Eigen::Index>(m.size.row);
+    const auto diagonal = std::min<Eigen::Index>(rows, m.size.col);
+    if (diagonal < 0 or
+        m.data.size() != static_cast<size_t>(diagonal * rows - diagonal * (diagonal - 1) / 2)) {
+        throw std::runtime_error("for_each_lt_run: the data doesn't match the matrix size.");
+    }
+    Eigen::Index col = 0;
+    Eigen::Index row = 0;
+    immer::for_each_chunk(m.data, [&](const Scalar* first, const Scalar* last) {
+        while (first != last) {
+            const auto count = std::min<Eigen::Index>(last - first, rows - row);
+            if (count <= 0) {
+                throw std::runtime_error("for_each_lt_run: ran past the last column.");
+            }
+            fn(col, row, first, first + count);
+            first += count;
+            row += count;
+            if (row == rows) {
+                col++;
+                row = col;
+            }
+        }
+    });
+}
+
+// column major, the strictly upper part is zero
+template<typename Scalar, typename MemoryPolicy>
+inline auto to_eigen(const dense_lt_matrix<Scalar, MemoryPolicy>& m) -> Eigen::MatrixX<Scalar> {
+    auto out = Eigen::MatrixX<Scalar>::Zero(m.size.row, m.size.col).eval();
+    const auto rows = out.rows();
+    const auto copy = [&](const auto col, const auto row, const Scalar* first, const Scalar* last) {
+        std::copy(first, last, out.data() + col * rows + row);
+    };
+    for_each_lt_run(m, copy);
+    return out;
+};
+
+/*
+ * a read only Eigen view of a dense_matrix
+ * This copies the matrix unless all of its data sits in one immer leaf, which only holds for
+ * small matrices. In that case map points straight into the leaf, otherwise into a copy owned by
+ * the view, check zero_copy(). It holds on to the data it maps, and stays valid when copied or
+ * moved.
+ */
+template<typename Scalar, typename MemoryPolicy = immer::default_memory_policy>
+struct dense_eigen_view_t {
+    using map_t = Eigen::Map<const Eigen::MatrixX<Scalar>>;
+
+    dense_matrix<Scalar, MemoryPolicy> source;
+    std::shared_ptr<const Eigen::MatrixX<Scalar>> copy;
+    map_t map;
+
+    // true if map reads the immer leaf in place
+    auto zero_copy() const -> bool {
+        return copy == nullptr;
+    }
+};
+
+template<typename Scalar, typename MemoryPolicy>
+inline auto eigen_view(const dense_matrix<Scalar, MemoryPolicy>& m)
+    -> dense_eigen_view_t<Scalar, MemoryPolicy> {
+    using view_t = dense_eigen_view_t<Scalar, MemoryPolicy>;
+    const auto rows = m.size.row;
+    const auto cols = m.size.col;
+
+    const auto* data = values::single_chunk(m.data);
+    if (data != nullptr or m.data.empty()) {
+        if (m.data.size() != static_cast<size_t>(rows * cols)) {
+            throw std::runtime_error("eigen_view: the data doesn't match the matrix size.");
+        }
+        return view_t{
+            .source = m,
+            .copy = nullptr,
+            .map = typename view_t::map_t(data, rows, cols),
+        };
+    }
+
+    auto copy = std::make_shared<const Eigen::MatrixX<Scalar>>(to_eigen(m));
+    return view_t{
+        .source = m,
+        .copy = copy,
+        .map = typename view_t::map_t(copy->data(), rows, cols),
+    };
+}
+
+}   // namespace imsym
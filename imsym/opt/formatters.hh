@@ -2,12 +2,15 @@
 
 #include "common/formatter/std.hh"
 #include "imsym/opt/key.hh"
+#include "imsym/opt/type_dispatch.hh"
 #include "imsym/opt/types.hh"
 #include "imsym/opt/values.hh"
 #include "imsym/opt/values_ops.hh"
 #include "types.hh"
 
 #include <fmt/core.h>
+
+#include <sstream>
 template<>
 struct fmt::formatter<imsym::coords_t> {
     static constexpr auto parse(format_parse_context& ctx) {
@@ -264,6 +267,14 @@ struct fmt::formatter<imsym::key::key_t> {
     }
 };
 
+template<>
+struct fmt::formatter<imsym::key::packed_key_t> : fmt::formatter<imsym::key::key_t> {
+    template<typename FormatContext>
+    auto format(const imsym::key::packed_key_t& k, FormatContext& ctx) {
+        return fmt::formatter<imsym::key::key_t>::format(imsym::key::unpack(k), ctx);
+    }
+};
+
 //
 template<>
 struct fmt::formatter<imsym::values::index_entry_t> {
@@ -312,11 +323,19 @@ struct fmt::formatter<imsym::values::valuesd_t> {
         const auto full_index =
             create_index(vals, imsym::values::keys<double>(vals.map, true));   // sort by offset
                                                                                //
+        const auto print = [&](const auto& entry, const auto& value) {
+            auto os = std::ostringstream{};
+            os << value;
+            fmt::format_to(ctx.out(), "\n\t{} {}", entry, os.str());
+        };
         for (const auto& entry : full_index.entries) {
-            fmt::format_to(ctx.out(),
-                           "\n\t{} {}",
-                           entry,
-                           vals.data.drop(entry.offset).take(entry.storage_dim));
+            // types the dispatch table doesn't know are printed as their raw storage
+            if (not imsym::values::try_visit_entry(vals, entry, print)) {
+                fmt::format_to(ctx.out(),
+                               "\n\t{} {}",
+                               entry,
+                               vals.data.drop(entry.offset).take(entry.storage_dim));
+            }
         }
 
         return ctx.out();
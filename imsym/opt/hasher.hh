@@ -0,0 +1,448 @@
+/* Copyright (C) Basemap, Inc DBA Automaton  All Rights Reserved
+ * Unauthorized copying of this file, via any medium is strictly prohibited
+ * Proprietary and confidential
+ * Written by Asa Hammond <asa@automaton.is>, 2022
+ */
+#pragma once
+#include "imsym/opt/chunks.hh"
+#include "imsym/opt/types.hh"
+#include "imsym/opt/values.hh"
+//
+#include <immer/algorithm.hpp>
+#include <immer/flex_vector.hpp>
+#include <immer/map.hpp>
+#include <immer/vector.hpp>
+
+#include <algorithm>
+#include <any>
+#include <cstdint>
+#include <cstring>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <optional>
+#include <type_traits>
+#include <typeindex>
+#include <unordered_map>
+#include <utility>
+#include <variant>
+#include <vector>
+
+/*
+ * memoized content hashing of the immer backed imsym types
+ *
+ * COMMON_STRUCT_HASH walks every element on every call. hasher_t instead remembers the hash of
+ * every node and map it has seen, keyed by node address, so hashing a new version of something
+ * it hashed before only pays for what changed:
+ *  - sequences (values data, residuals, dense and sparse matrices) hash as a polynomial over the
+ *    elements, combined per leaf and per inner node, so a subtree shared with something hashed
+ *    before costs a lookup, O(changed leaves x depth), and the result doesn't depend on how the
+ *    nodes are laid out
+ *  - maps (the values index) hash as a sum over their entries, a new version is hashed by
+ *    immer::diff against the last version of that map type, O(changes x log n)
+ *
+ * Equal contents give equal hashes, the values are not the same as std::hash of the type.
+ * The hasher keeps what it hashed alive so the addresses in its caches stay valid. Retention is
+ * by generation: every max_retained / kGenerations things hashed start a new one, and once there
+ * are more than kGenerations the oldest is let go together with every cache entry last used in
+ * it. Not thread safe.
+ */
+
+namespace imsym {
+
+class hasher_t {
+   public:
+    static constexpr uint64_t kBase = 0x100000001b3ull;
+    static constexpr size_t kGenerations = 4;
+
+    // keeps at most about max_retained of the things it hashed alive
+    explicit hasher_t(const size_t max_retained = 1024)
+        : generation_size_(std::max<size_t>(1, max_retained / kGenerations)) {}
+
+    static constexpr auto mix(uint64_t x) -> uint64_t {
+        x ^= x >> 33;
+        x *= 0xff51afd7ed558ccdull;
+        x ^= x >> 33;
+        x *= 0xc4ceb9fe1a85ec53ull;
+        x ^= x >> 33;
+        return x;
+    }
+
+    static constexpr auto combine(const uint64_t seed, const uint64_t h) -> uint64_t {
+        return mix(seed ^ (h + 0x9e3779b97f4a7c15ull + (seed << 6) + (seed >> 2)));
+    }
+
+    // kBase^n mod 2^64
+    static constexpr auto power(uint64_t n) -> uint64_t {
+        uint64_t result = 1;
+        uint64_t base = kBase;
+        while (n > 0) {
+            if (n & 1) {
+                result *= base;
+            }
+            base *= base;
+            n >>= 1;
+        }
+        return result;
+    }
+
+    template<typename T>
+    static auto element(const T& value) -> uint64_t {
+        if constexpr (std::is_floating_point_v<T>) {
+            // +0 and -0 compare equal, keep them hashing equal
+            if (value == T{0}) {
+                return mix(1);
+            }
+            uint64_t bits = 0;
+            std::memcpy(&bits, &value, sizeof(T));
+            return mix(bits + 1);
+        } else {
+            return mix(std::hash<T>{}(value) + 1);
+        }
+    }
+
+    /*
+     * sum of element(x_i) * kBase^i over the sequence
+     * cached per node, sequences already hashed as a whole are a single lookup
+     */
+    template<typename Container>
+    auto sequence(const Container& container) -> uint64_t {
+        using T = typename Container::value_type;
+        if (container.size() == 0) {
+            return mix(0);
+        }
+        const auto id = container.identity();
+        if (const auto found = lookup(sequences_, id, container.size())) {
+            retain(container);
+            return *found;
+        }
+
+        uint64_t hash = 0;
+        if constexpr (values::detail::kTreeWalk<Container>) {
+            hash = tree(container);
+        } else {
+            uint64_t offset = 0;
+            immer::for_each_chunk(container, [&](const T* first, const T* last) {
+                const auto count = static_cast<size_t>(last - first);
+                hash += power(offset) * leaf(first, count);
+                offset += count;
+            });
+        }
+        hash = combine(mix(container.size()), hash);
+
+        sequences_.insert_or_assign(id, cached_t{container.size(), hash, generation_});
+        retain(container);
+        return hash;
+    }
+
+    /*
+     * sum over the entries of entry(key, value)
+     * a map that isn't cached is hashed relative to the last map of the same type
+     */
+    template<typename Map, typename EntryHash>
+    auto map(const Map& m, EntryHash&& entry) -> uint64_t {
+        const void* id = m.impl().root;
+        if (const auto found = lookup(maps_, id, m.size())) {
+            retain(m);
+            return *found;
+        }
+
+        auto& previous = previous_maps_[std::type_index(typeid(Map))];
+        uint64_t sum = 0;
+        if (const auto* last = std::any_cast<std::pair<Map, uint64_t>>(&previous)) {
+            sum = last->second;
+            immer::diff(
+                last->first,
+                m,
+                [&](const auto& kv) {
+                    sum += entry(kv.first, kv.second);
+                },
+                [&](const auto& kv) {
+                    sum -= entry(kv.first, kv.second);
+                },
+                [&](const auto& a, const auto& b) {
+                    sum += entry(b.first, b.second) - entry(a.first, a.second);
+                });
+        } else {
+            for (const auto& [k, v] : m) {
+                sum += entry(k, v);
+            }
+        }
+        previous = std::pair<Map, uint64_t>{m, sum};
+
+        const auto hash = combine(mix(m.size()), sum);
+        maps_.insert_or_assign(id, cached_t{m.size(), hash, generation_});
+        retain(m);
+        return hash;
+    }
+
+    auto clear() -> void {
+        leaves_.clear();
+        nodes_.clear();
+        sequences_.clear();
+        maps_.clear();
+        previous_maps_.clear();
+        retained_.clear();
+        generation_ = 0;
+        retained_in_generation_ = 0;
+    }
+
+    // the number of things currently kept alive
+    auto retained() const -> size_t {
+        return retained_.size();
+    }
+
+   private:
+    struct cached_t {
+        size_t size;
+        uint64_t hash;
+        // the last generation it was used in, see retain
+        uint64_t generation;
+    };
+
+    struct retained_t {
+        uint64_t generation;
+        std::shared_ptr<const void> container;
+    };
+
+    // a hit moves the entry to the current generation
+    template<typename Cache, typename Id>
+    auto lookup(Cache& cache, const Id& id, const size_t size) -> std::optional<uint64_t> {
+        const auto found = cache.find(id);
+        if (found == cache.end() or found->second.size != size) {
+            return {};
+        }
+        found->second.generation = generation_;
+        return found->second.hash;
+    }
+
+    struct pair_hash_t {
+        auto operator()(const std::pair<void*, void*>& p) const -> size_t {
+            return combine(reinterpret_cast<uintptr_t>(p.first),
+                           reinterpret_cast<uintptr_t>(p.second));
+        }
+    };
+
+    template<typename T>
+    auto leaf(const T* first, const size_t count) -> uint64_t {
+        if (const auto found = lookup(leaves_, first, count)) {
+            return *found;
+        }
+        uint64_t hash = 0;
+        uint64_t scale = 1;
+        for (size_t i = 0; i < count; i++) {
+            hash += scale * element(first[i]);
+            scale *= kBase;
+        }
+        leaves_.insert_or_assign(first, cached_t{count, hash, generation_});
+        return hash;
+    }
+
+    // the polynomial over the rrb tree behind container, a node at a time
+    template<typename Container>
+    auto tree(const Container& container) -> uint64_t {
+        using walk_t = values::detail::tree_walk_t<Container>;
+        const auto& impl = container.impl();
+        const size_t extent = impl.tail_offset();
+        uint64_t hash = extent > 0 ? node<walk_t>(impl.root, impl.shift, extent) : 0;
+        if (container.size() > extent) {
+            hash += power(extent) * leaf(impl.tail->leaf(), container.size() - extent);
+        }
+        return hash;
+    }
+
+    // the children's hashes shifted to where each child starts
+    template<typename Walk>
+    auto node(typename Walk::node_t* n, const unsigned shift, const size_t extent) -> uint64_t {
+        if (const auto found = lookup(nodes_, n, extent)) {
+            return *found;
+        }
+        uint64_t hash = 0;
+        size_t start = 0;
+        const auto count = Walk::count(n, shift, extent);
+        for (size_t i = 0; i < count; i++) {
+            const auto end = Walk::child_end(n, shift, extent, i);
+            auto* child = n->inner()[i];
+            const auto child_hash = shift == Walk::kLeafBits
+                                        ? leaf(child->leaf(), end - start)
+                                        : node<Walk>(child, shift - Walk::kInnerBits, end - start);
+            hash += power(start) * child_hash;
+            start = end;
+        }
+        nodes_.insert_or_assign(n, cached_t{extent, hash, generation_});
+        return hash;
+    }
+
+    /*
+     * keep container alive in the current generation
+     * a cache entry is only used while hashing something that holds its node, and that is retained
+     * in the generation the entry was last used in. Dropping a generation's containers together
+     * with the entries last used in it never leaves an entry for a node that may have been freed.
+     */
+    template<typename T>
+    auto retain(const T& container) -> void {
+        retained_.push_back({generation_, std::make_shared<const T>(container)});
+        if (++retained_in_generation_ < generation_size_) {
+            return;
+        }
+        retained_in_generation_ = 0;
+        generation_++;
+        if (generation_ < kGenerations) {
+            return;
+        }
+        const auto oldest = generation_ - kGenerations;
+        while (not retained_.empty() and retained_.front().generation <= oldest) {
+            retained_.pop_front();
+        }
+        evict(leaves_, oldest);
+        evict(nodes_, oldest);
+        evict(sequences_, oldest);
+        evict(maps_, oldest);
+    }
+
+    template<typename Cache>
+    static auto evict(Cache& cache, const uint64_t oldest) -> void {
+        for (auto it = cache.begin(); it != cache.end();) {
+            it = it->second.generation <= oldest ? cache.erase(it) : std::next(it);
+        }
+    }
+
+    size_t generation_size_;
+    uint64_t generation_ = 0;
+    size_t retained_in_generation_ = 0;
+
+    std::unordered_map<const void*, cached_t> leaves_;
+    std::unordered_map<const void*, cached_t> nodes_;
+    std::unordered_map<std::pair<void*, void*>, cached_t, pair_hash_t> sequences_;
+    std::unordered_map<const void*, cached_t> maps_;
+    std::unordered_map<std::type_index, std::any> previous_maps_;
+    std::deque<retained_t> retained_;
+};
+
+/*
+ * hash overloads for the imsym types, all of them memoized through hasher
+ */
+
+template<typename T>
+inline auto hash(hasher_t&, const T& value)
+    -> std::enable_if_t<std::is_arithmetic_v<T>, uint64_t> {
+    return hasher_t::element(value);
+}
+
+template<typename T, typename MemoryPolicy, uint32_t B, uint32_t BL>
+inline auto hash(hasher_t& hasher, const immer::vector<T, MemoryPolicy, B, BL>& v) -> uint64_t {
+    return hasher.sequence(v);
+}
+
+template<typename T, typename MemoryPolicy, uint32_t B, uint32_t BL>
+inline auto hash(hasher_t& hasher, const immer::flex_vector<T, MemoryPolicy, B, BL>& v)
+    -> uint64_t {
+    return hasher.sequence(v);
+}
+
+inline auto hash(hasher_t&, const coords_t& c) -> uint64_t {
+    return hasher_t::combine(hasher_t::element(c.row), hasher_t::element(c.col));
+}
+
+inline auto hash(hasher_t&, const imsym::key::key_t& k) -> uint64_t {
+    return hasher_t::mix(imsym::key::hash_t{}(k));
+}
+
+inline auto hash(hasher_t& hasher, const values::index_entry_t& e) -> uint64_t {
+    auto h = hash(hasher, e.key);
+    h = hasher_t::combine(h, hasher_t::element(static_cast<int32_t>(e.type.value)));
+    h = hasher_t::combine(h, hasher_t::element(e.offset));
+    h = hasher_t::combine(h, hasher_t::element(e.storage_dim));
+    return hasher_t::combine(h, hasher_t::element(e.tangent_dim));
+}
+
+template<typename Scalar, typename MemoryPolicy>
+inline auto hash(hasher_t& hasher, const values::values_t<Scalar, MemoryPolicy>& values)
+    -> uint64_t {
+    const auto index = hasher.map(values.map, [&](const auto&, const auto& entry) {
+        return hash(hasher, entry);
+    });
+    return hasher_t::combine(index, hasher.sequence(values.data));
+}
+
+template<typename Scalar, typename MemoryPolicy>
+inline auto hash(hasher_t& hasher, const sparse_matrix<Scalar, MemoryPolicy>& m) -> uint64_t {
+    auto h = hasher_t::combine(hash(hasher, m.size), hasher.sequence(m.column_pointers));
+    h = hasher_t::combine(h, hasher.sequence(m.row_indices));
+    return hasher_t::combine(h, hasher.sequence(m.values));
+}
+
+template<typename MemoryPolicy>
+inline auto hash(hasher_t& hasher, const sparse_matrix_structure<MemoryPolicy>& m) -> uint64_t {
+    auto h = hasher_t::combine(hash(hasher, m.size), hasher.sequence(m.column_pointers));
+    return hasher_t::combine(h, hasher.sequence(m.row_indices));
+}
+
+template<typename Scalar, typename MemoryPolicy>
+inline auto hash(hasher_t& hasher, const dense_matrix<Scalar, MemoryPolicy>& m) -> uint64_t {
+    return hasher_t::combine(hash(hasher, m.size), hasher.sequence(m.data));
+}
+
+template<typename Scalar, typename MemoryPolicy>
+inline auto hash(hasher_t& hasher, const dense_lt_matrix<Scalar, MemoryPolicy>& m) -> uint64_t {
+    return hasher_t::combine(hash(hasher, m.size), hasher.sequence(m.data));
+}
+
+template<typename... Ts>
+inline auto hash(hasher_t& hasher, const std::variant<Ts...>& v) -> uint64_t {
+    const auto h = std::visit(
+        [&](const auto& alternative) {
+            return hash(hasher, alternative);
+        },
+        v);
+    return hasher_t::combine(hasher_t::element(v.index()), h);
+}
+
+template<typename T>
+inline auto hash(hasher_t& hasher, const std::optional<T>& o) -> uint64_t {
+    return o ? hasher_t::combine(1, hash(hasher, *o)) : hasher_t::mix(0);
+}
+
+inline auto hash(hasher_t& hasher, const sparse_linearization_t& l) -> uint64_t {
+    auto h = hash(hasher, l.residual);
+    h = hasher_t::combine(h, hash(hasher, l.hessian_lower));
+    h = hasher_t::combine(h, hash(hasher, l.jacobian));
+    return hasher_t::combine(h, hash(hasher, l.rhs));
+}
+
+inline auto hash(hasher_t& hasher, const dense_linearization_t& l) -> uint64_t {
+    auto h = hash(hasher, l.residual);
+    h = hasher_t::combine(h, hash(hasher, l.hessian_lower));
+    h = hasher_t::combine(h, hash(hasher, l.jacobian));
+    return hasher_t::combine(h, hash(hasher, l.rhs));
+}
+
+inline auto hash(hasher_t& hasher, const optimization_iteration_t& it) -> uint64_t {
+    auto h = hash(hasher, it.iteration);
+    h = hasher_t::combine(h, hash(hasher, it.current_lambda));
+    h = hasher_t::combine(h, hash(hasher, it.new_error_linear));
+    h = hasher_t::combine(h, hash(hasher, it.new_error));
+    h = hasher_t::combine(h, hash(hasher, it.relative_reduction));
+    h = hasher_t::combine(h, hash(hasher, it.update_accepted));
+    h = hasher_t::combine(h, hash(hasher, it.update_angle_change));
+    h = hasher_t::combine(h, hash(hasher, it.update));
+    h = hasher_t::combine(h, hash(hasher, it.values));
+    h = hasher_t::combine(h, hash(hasher, it.residuals));
+    return hasher_t::combine(h, hash(hasher, it.jacobian_values));
+}
+
+inline auto hash(hasher_t& hasher, const optimization_stats_t& stats) -> uint64_t {
+    auto h = hasher_t::mix(stats.iterations.size());
+    for (const auto& iteration : stats.iterations) {
+        h = hasher_t::combine(h, hash(hasher, iteration));
+    }
+    h = hasher_t::combine(h, hash(hasher, stats.best_index));
+    h = hasher_t::combine(h, hash(hasher, static_cast<int32_t>(stats.status)));
+    h = hasher_t::combine(h, hash(hasher, stats.failure_reason));
+    h = hasher_t::combine(h, hash(hasher, stats.best_linearization));
+    h = hasher_t::combine(h, hash(hasher, stats.jacobian_sparsity));
+    h = hasher_t::combine(h, hash(hasher, stats.linear_solver_ordering));
+    return hasher_t::combine(h, hash(hasher, stats.cholesky_factor_sparsity));
+}
+
+}   // namespace imsym
@@ -1,4 +1,6 @@
 #pragma once
+#include "imsym/opt/dense.hh"
+#include "imsym/opt/sparse.hh"
 #include "imsym/opt/types.hh"
 #include "imsym/opt/values_ext_ops.hh"
 #include "imsym/opt/values_ops.hh"
@@ -6,6 +8,7 @@
 #include <Eigen/Core>
 #include <lcmtypes/sym/optimization_iteration_t.hpp>
 #include <lcmtypes/sym/optimization_stats_t.hpp>
+#include <lcmtypes/sym/sparse_matrix_structure_t.hpp>
 #include <symforce/opt/key.h>
 #include <symforce/opt/optimizer.h>
 
@@ -20,148 +23,19 @@ inline auto build_residual_offsets(const auto& factors, const auto& linearizer)
     return out;
 };
 
-template<typename Scalar>
-inline auto to_imsym(const Eigen::MatrixX<Scalar>& m) -> dense_matrix<Scalar> {
-    dense_matrix<Scalar> out;
-    out.size = {.row = m.rows(), .col = m.cols()};
-    for (int col = 0; col < m.cols(); col++) {
-        for (int row = 0; row < m.rows(); row++) {
-            out.data = std::move(out.data).push_back(m(row, col));
-        }
-    }
-    return out;
-};
-
-template<typename Scalar>
-inline auto to_imsym_matrix(const Eigen::MatrixX<Scalar>& m) -> dense_matrix<Scalar> {
-    dense_matrix<Scalar> out;
-    out.size = {.row = m.rows(), .col = m.cols()};
-    for (int col = 0; col < m.cols(); col++) {
-        for (int row = 0; row < m.rows(); row++) {
-            out.data = std::move(out.data).push_back(m(row, col));
-        }
-    }
-    return out;
-};
-
-template<typename Scalar>
-inline auto to_imsym_lt(const Eigen::MatrixX<Scalar>& m) {
-    dense_lt_matrix<Scalar> out;
-    out.size = {.row = m.rows(), .col = m.cols()};
-    for (int col = 0; col < m.cols(); col++) {
-        for (int row = col; row < m.rows(); row++) {
-            out.data = std::move(out.data).push_back(m(row, col));
-        }
-    }
-    return out;
-};
-
-template<typename Scalar>
-inline auto to_eigen(const immer::vector<Scalar>& v) {
-    Eigen::VectorX<Scalar> out(v.size());
-    for (size_t i = 0; i < v.size(); ++i) {
-        out[i] = v[i];
-    }
-    return out;
-}
-
-template<typename Scalar>
-inline auto to_eigen(const sparse_matrix<Scalar>& m) {
-    std::vector<Eigen::Triplet<Scalar>> triplets;
-
-    Eigen::SparseMatrix<Scalar> sparse_mat(m.size.row, m.size.col);
-
-    for (const auto& [coords, v] : m.data) {
-        triplets.push_back({coords.row, coords.col, v});
-    }
-    sparse_mat.setFromTriplets(triplets.begin(), triplets.end());
-
-    return sparse_mat;
-};
-
-template<typename Scalar>
-inline auto to_eigen(const dense_matrix<Scalar>& m) {
-    // column major
-    Eigen::MatrixX<Scalar> out(m.size.row, m.size.col);
-    auto idx = 0;
-    for (int col = 0; col < m.size.col; col++) {
-        for (int row = 0; row < m.size.row; row++) {
-            out(row, col) = m.data[idx++];
-        }
-    }
-    return out;
-};
-
-template<typename Scalar>
-inline auto to_eigen(const dense_lt_matrix<Scalar>& m) {
-    // TODO a matrixL view?
-    // column major
-    Eigen::MatrixX<Scalar> out(m.size.row, m.size.col);
-    auto idx = 0;
-    for (int col = 0; col < m.size.col; col++) {
-        for (int row = col; row < m.size.row; row++) {
-            out(row, col) = m.data[idx++];
-        }
-    }
-    return out;
-};
-
 template<typename Scalar>
 inline auto to_imsym(std::unordered_map<sym::Key, Eigen::MatrixX<Scalar>> covariances) {
-    auto out = immer::map<imsym::key::key_t, dense_matrix<Scalar>>{};
+    auto out = immer::map<imsym::key::packed_key_t, dense_matrix<Scalar>>{};
     for (const auto& [k, v] : covariances) {
         out = std::move(out).set(imsym::key::to(k), to_imsym(v));
     }
     return out;
 };
 
-template<typename Scalar>
-inline auto to_imsym(const Eigen::SparseMatrix<Scalar>& mat) {
-    sparse_matrix<Scalar> out;
-    out.size = {mat.rows(), mat.cols()};
-
-    for (int k = 0; k < mat.outerSize(); ++k) {
-        for (typename Eigen::SparseMatrix<Scalar>::InnerIterator it(mat, k); it; ++it) {
-            // Insert the value into the immer::map with the 2D index (row, col) as the key
-            out.data = std::move(out.data).set({it.row(), it.col()}, it.value());
-        }
-    }
-
-    return out;
-};
-
-template<typename Scalar>
-inline auto to_imsym(const Eigen::MappedSparseMatrix<Scalar>& sparse_mat) {
-    sparse_matrix<Scalar> out;
-    out.size = {sparse_mat.rows(), sparse_mat.cols()};
-
-    for (int k = 0; k < sparse_mat.outerSize(); ++k) {
-        for (typename Eigen::MappedSparseMatrix<Scalar>::InnerIterator it(sparse_mat, k); it;
-             ++it) {
-            long row = it.row();
-            long col = it.col();
-            double value = it.value();
-
-            // spdlog::info("{} {} {}", it.row(), it.col(), it.value());
-            //  Insert the value into the immer::map with the 2D index (row, col) as the key
-            out.data = std::move(out.data).set({row, col}, value);
-        }
-    }
-
-    return out;
-};
-
 template<typename Scalar>
 inline auto to_imsym_matrix(const Eigen::Map<const Eigen::SparseMatrix<Scalar>>& mat)
     -> sparse_matrix<Scalar> {
-    return to_imsym(Eigen::SparseMatrix<Scalar>(mat));
-};
-
-template<typename Scalar>
-inline auto to_imsym_matrix(const Eigen::Map<const Eigen::MatrixX<Scalar>>& mat)
-    -> dense_matrix<Scalar> {
-    const Eigen::MatrixX<Scalar>& m = mat;
-    return to_imsym(m);
+    return to_imsym(mat);
 };
 
 template<typename Scalar>
@@ -169,6 +43,28 @@ inline auto to_imsym(const Eigen::VectorX<Scalar>& v) {
     return immer::vector<Scalar>{v.begin(), v.end()};
 };
 
+/*
+ * the jacobian sparsity of a symforce optimization
+ * symforce stores N column pointers, the end of the last column is appended here. A dense
+ * jacobian only has its shape
+ */
+inline auto to_imsym(const sym::sparse_matrix_structure_t& sparsity) -> sparse_matrix_structure_t {
+    auto out = sparse_matrix_structure_t{};
+    out.size = {.row = sparsity.shape[0], .col = sparsity.shape[1]};
+    if (sparsity.column_pointers.size() == 0) {
+        return out;
+    }
+    const auto* column_pointers = sparsity.column_pointers.data();
+    const auto* row_indices = sparsity.row_indices.data();
+    const auto nnz = static_cast<sparse_index_t>(sparsity.row_indices.size());
+    out.column_pointers =
+        immer::vector<sparse_index_t>(column_pointers,
+                                      column_pointers + sparsity.column_pointers.size())
+            .push_back(nnz);
+    out.row_indices = immer::vector<sparse_index_t>(row_indices, row_indices + nnz);
+    return out;
+}
+
 // could be sparse or dense iteration
 inline auto to_imsym(const sym::optimization_iteration_t& iter) -> optimization_iteration_t {
     return {
@@ -182,7 +78,6 @@ inline auto to_imsym(const sym::optimization_iteration_t& iter) -> optimization_
         .update = to_imsym(iter.update),
         // .values = imsym::values::clone(iter.values),
         .residuals = to_imsym(iter.residual),
-        //.jacobian_values = to_imsym(iter.JacobianValues()),
     };
 };
 
@@ -222,25 +117,32 @@ inline auto to_imsym(const sym::optimization_status_t& status) -> optimization_s
     }
 };
 
+// one iteration, with its jacobian values if asked for
+inline auto to_imsym(const sym::optimization_iteration_t& iter, const bool jacobians)
+    -> optimization_iteration_t {
+    auto imsym_iter = to_imsym(iter);
+    if (jacobians) {
+        // this is only possible if we have the underlying data from the solve
+        // this requires the save_jacobians flag to be set in the optimization
+        // also the debug_full flag
+        // and we have to not have an iteration limit hit. ??
+        // only the values are kept, the pattern is shared through the stats
+        imsym_iter.jacobian_values = to_imsym(iter.jacobian_values);
+    }
+    return imsym_iter;
+};
+
+// every iteration, in order, on the calling thread. see lazy_stats.hh to do this off thread
 inline auto build_iterations(const auto& opt_stats, auto jacobians = true)
     -> immer::vector<optimization_iteration_t> {
-    auto iterations = immer::vector<optimization_iteration_t>{};
-
+    auto iterations = immer::vector<optimization_iteration_t>{}.transient();
     for (size_t i = 0; i < opt_stats.iterations.size(); i++) {
-        spdlog::info("saving iteration {} / {}", i, opt_stats.iterations.size());
-        const auto& iter = opt_stats.iterations.at(i);
-        auto imsym_iter = to_imsym(iter);
-        if (jacobians) {
-            // this is only possible if we have the underlying data from the solve
-            // this requires the save_jacobians flag to be set in the optimization
-            // also the debug_full flag
-            // and we have to not have an iteration limit hit. ??
-            imsym_iter.jacobian = to_imsym_matrix(opt_stats.JacobianView(iter));
-        }
-        iterations = std::move(iterations).push_back(imsym_iter);
+        spdlog::debug("saving iteration {} / {}", i, opt_stats.iterations.size());
+        iterations.push_back(to_imsym(opt_stats.iterations.at(i), jacobians));
     }
-    return iterations;
+    return std::move(iterations).persistent();
 };
+
 template<typename MatrixType>
 inline auto to_imsym(const sym::OptimizationStats<MatrixType>& opt_stats,
                      bool save_all_iterations = false,
@@ -255,7 +157,8 @@ inline auto to_imsym(const sym::OptimizationStats<MatrixType>& opt_stats,
         .status = to_imsym(opt_stats.status),
         .failure_reason = opt_stats.failure_reason,
         .best_linearization = to_linearization(opt_stats.best_linearization),
-        //.jacobian_sparsity = to_imsym(opt_stats.jacobian_sparsity),
+        .jacobian_sparsity = jacobians ? to_imsym(opt_stats.jacobian_sparsity)
+                                       : sparse_matrix_structure_t{},
         .linear_solver_ordering = to_imsym(opt_stats.linear_solver_ordering),
         //.cholesky_factor_sparsity = to_imsym(opt_stats.cholesky_factor_sparsity),
     };
@@ -287,12 +190,22 @@ inline auto residuals(const optional<linearization_t>& lin) -> optional<immer::v
         });
 };
 
-inline auto jacobian(const optional<optimization_iteration_t>& iteration)
+// the jacobian of an iteration, over the pattern it shares with the rest of stats
+inline auto jacobian(const optimization_stats_t& stats,
+                     const optional<optimization_iteration_t>& iteration)
     -> optional<imsym::matrix_t> {
-    if (not iteration.has_value()) {
+    if (not iteration.has_value() or iteration->jacobian_values.empty()) {
         return {};
     }
-    return iteration->jacobian;
+    const auto& sparsity = stats.jacobian_sparsity;
+    if (sparsity.column_pointers.empty()) {
+        if (iteration->jacobian_values.size() !=
+            static_cast<size_t>(sparsity.size.row * sparsity.size.col)) {
+            throw std::runtime_error("jacobian: the values don't match the jacobian shape.");
+        }
+        return dense_matrix_t{.size = sparsity.size, .data = iteration->jacobian_values};
+    }
+    return with_values(sparsity, iteration->jacobian_values);
 };
 
 inline auto jacobian(const optional<linearization_t>& lin) -> optional<imsym::matrix_t> {
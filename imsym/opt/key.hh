@@ -6,6 +6,14 @@
 #pragma once
 #include "common/struct.hh"
 
+#include <cstdint>
+#include <deque>
+#include <functional>
+#include <limits>
+#include <mutex>
+#include <optional>
+#include <unordered_map>
+
 namespace imsym::key {
 
 /*
@@ -26,5 +34,190 @@ struct key_t {
 
 }   // namespace imsym::key
 
+// before the wide key table below, which compares key_t
 COMMON_STRUCT_HASH(imsym::key, key_t, letter, sub, super);
 
+namespace imsym::key {
+
+/*
+ * key_t in a single machine word, the key type of the values and covariance maps
+ *
+ * the common case, a subscript within +-(2^39 - 1) and a superscript within +-(2^14 - 1), is
+ * packed in place. Layout from the top: a zero tag bit, 8 bits letter, 15 bits super, 40 bits
+ * sub, sub and super stored with a bias so zero is left for the invalid sentinel.
+ * Wider keys set the tag bit and hold an id into a process wide table of interned key_t, see
+ * detail::wide_keys. Either way a key has one word, so equality is a word compare and unpack
+ * round trips losslessly. Ids are only meaningful within a process, cereal writes the key_t.
+ * It converts implicitly from key_t, so the maps are used with key_t as before.
+ */
+struct packed_key_t {
+    uint64_t word = 0;
+
+    constexpr packed_key_t() = default;
+    constexpr explicit packed_key_t(const uint64_t word) : word(word) {}
+    packed_key_t(const key_t& key);
+};
+
+namespace detail {
+
+constexpr int kSubBits = 40;
+constexpr int kSuperBits = 15;
+constexpr int kSuperShift = kSubBits;
+constexpr int kLetterShift = kSubBits + kSuperBits;
+constexpr int64_t kSubBias = int64_t{1} << (kSubBits - 1);
+constexpr int64_t kSuperBias = int64_t{1} << (kSuperBits - 1);
+constexpr uint64_t kSubMask = (uint64_t{1} << kSubBits) - 1;
+constexpr uint64_t kSuperMask = (uint64_t{1} << kSuperBits) - 1;
+constexpr uint64_t kWideTag = uint64_t{1} << 63;
+
+template<typename T>
+constexpr auto pack_field(const T value, const T invalid, const int64_t bias)
+    -> std::optional<uint64_t> {
+    if (value == invalid) {
+        return uint64_t{0};
+    }
+    if (value <= -bias or value >= bias) {
+        return {};
+    }
+    return static_cast<uint64_t>(value + bias);
+}
+
+template<typename T>
+constexpr auto unpack_field(const uint64_t field, const T invalid, const int64_t bias) -> T {
+    if (field == 0) {
+        return invalid;
+    }
+    return static_cast<T>(static_cast<int64_t>(field) - bias);
+}
+
+// empty if the sub or super doesn't fit
+constexpr auto packed_word(const key_t& key) -> std::optional<uint64_t> {
+    const auto sub = pack_field(key.sub, key_t::kInvalidSub, kSubBias);
+    const auto super = pack_field(key.super, key_t::kInvalidSuper, kSuperBias);
+    if (not sub or not super) {
+        return {};
+    }
+    const auto letter = static_cast<uint64_t>(static_cast<unsigned char>(key.letter));
+    return (letter << kLetterShift) | (*super << kSuperShift) | *sub;
+}
+
+constexpr auto mix(uint64_t x) -> uint64_t {
+    x ^= x >> 33;
+    x *= 0xff51afd7ed558ccdull;
+    x ^= x >> 33;
+    return x;
+}
+
+}   // namespace detail
+
+/*
+ * hash for the key maps
+ *
+ * immer's map consumes the hash from the low bits up. For packed keys the sub sits in the low bits
+ * and the letter/super are mixed in with an xor, which keeps the hash a bijection of the key and
+ * keeps runs of sequential subscripts packed into the same nodes. Wide keys are mixed.
+ */
+struct hash_t {
+    static constexpr uint64_t kMul = 0x9e3779b97f4a7c15ull;
+
+    constexpr auto operator()(const packed_key_t& key) const -> size_t {
+        if (key.word & detail::kWideTag) {
+            return detail::mix(key.word * kMul);
+        }
+        const auto high = key.word >> detail::kSuperShift;
+        return key.word ^ ((high * kMul) & detail::kSubMask);
+    }
+
+    // the same as the packed key's when it fits, doesn't intern
+    constexpr auto operator()(const key_t& key) const -> size_t {
+        if (const auto word = detail::packed_word(key)) {
+            return (*this)(packed_key_t{*word});
+        }
+        auto h = detail::mix(static_cast<uint64_t>(key.sub));
+        h = detail::mix(h ^ (static_cast<uint64_t>(key.super) * kMul));
+        return detail::mix(h ^ static_cast<unsigned char>(key.letter));
+    }
+};
+
+namespace detail {
+
+/*
+ * the keys too wide to pack, by id
+ * only ever grows, by the number of distinct wide keys the process packs, which are rare. Leaked
+ * so keys can still be unpacked during static destruction.
+ */
+struct wide_keys_t {
+    std::mutex mutex;
+    std::deque<key_t> keys;
+    std::unordered_map<key_t, uint64_t, hash_t> ids;
+};
+
+inline auto wide_keys() -> wide_keys_t& {
+    static auto* instance = new wide_keys_t{};
+    return *instance;
+}
+
+}   // namespace detail
+
+inline auto pack(const key_t& key) -> packed_key_t {
+    if (const auto word = detail::packed_word(key)) {
+        return packed_key_t{*word};
+    }
+    auto& wide = detail::wide_keys();
+    const auto lock = std::lock_guard(wide.mutex);
+    const auto [it, added] = wide.ids.try_emplace(key, wide.keys.size());
+    if (added) {
+        wide.keys.push_back(key);
+    }
+    return packed_key_t{detail::kWideTag | it->second};
+}
+
+inline packed_key_t::packed_key_t(const key_t& key) : word(pack(key).word) {}
+
+inline auto unpack(const packed_key_t& packed) -> key_t {
+    if (packed.word & detail::kWideTag) {
+        auto& wide = detail::wide_keys();
+        const auto lock = std::lock_guard(wide.mutex);
+        return wide.keys.at(packed.word & ~detail::kWideTag);
+    }
+    const auto letter = static_cast<unsigned char>(packed.word >> detail::kLetterShift);
+    const auto super = (packed.word >> detail::kSuperShift) & detail::kSuperMask;
+    const auto sub = packed.word & detail::kSubMask;
+    return key_t{
+        .letter = static_cast<key_t::letter_t>(letter),
+        .sub = detail::unpack_field(sub, key_t::kInvalidSub, detail::kSubBias),
+        .super = detail::unpack_field(super, key_t::kInvalidSuper, detail::kSuperBias),
+    };
+}
+
+constexpr auto operator==(const packed_key_t& a, const packed_key_t& b) -> bool {
+    return a.word == b.word;
+}
+
+constexpr auto operator!=(const packed_key_t& a, const packed_key_t& b) -> bool {
+    return a.word != b.word;
+}
+
+}   // namespace imsym::key
+
+// the maps take the default hash and equality, so they stay plain immer::map<packed_key_t, T>
+template<>
+struct std::hash<imsym::key::packed_key_t> {
+    auto operator()(const imsym::key::packed_key_t& key) const -> size_t {
+        return imsym::key::hash_t{}(key);
+    }
+};
+
+namespace cereal {
+template<class Archive>
+void save(Archive& archive, const imsym::key::packed_key_t& key) {
+    archive(imsym::key::unpack(key));
+}
+
+template<class Archive>
+void load(Archive& archive, imsym::key::packed_key_t& key) {
+    auto unpacked = imsym::key::key_t{};
+    archive(unpacked);
+    key = imsym::key::pack(unpacked);
+}
+}   // namespace cereal
@@ -0,0 +1,248 @@
+/* Copyright (C) Basemap, Inc DBA Automaton  All Rights Reserved
+ * Unauthorized copying of this file, via any medium is strictly prohibited
+ * Proprietary and confidential
+ * Written by Asa Hammond <asa@automaton.is>, 2022
+ */
+#pragma once
+#include "imsym/opt/interop.hh"
+#include "imsym/opt/types.hh"
+#include "imsym/opt/worker_pool.hh"
+//
+#include <immer/vector.hpp>
+#include <immer/vector_transient.hpp>
+
+#include <algorithm>
+#include <atomic>
+#include <condition_variable>
+#include <cstddef>
+#include <exception>
+#include <memory>
+#include <mutex>
+#include <stdexcept>
+#include <utility>
+
+/*
+ * conversion of sym::OptimizationStats to optimization_stats_t off the optimizer thread
+ *
+ * convert_async moves the stats into a handle and returns, the optimizer thread pays for the move
+ * and for queueing the work. The iterations are converted on a worker_pool_t, each worker takes
+ * the next unclaimed iteration off a shared counter:
+ *  - reading an iteration no worker has started converts it on the calling thread
+ *  - reading one a worker is converting waits for that worker
+ *  - an iteration whose conversion threw rethrows the exception each time it is read
+ * The other fields are converted the first time they are read, and kept.
+ * Handles are cheap to copy and share their state. Workers stop once every handle is gone.
+ */
+
+namespace imsym {
+
+// how an iteration is converted unless the handle is given something else, see interop.hh
+struct convert_iteration_t {
+    auto operator()(const sym::optimization_iteration_t& iter, const bool jacobians) const
+        -> optimization_iteration_t {
+        return to_imsym(iter, jacobians);
+    }
+};
+
+template<typename MatrixType, typename Convert = convert_iteration_t>
+class lazy_optimization_stats_t {
+   public:
+    lazy_optimization_stats_t(sym::OptimizationStats<MatrixType>&& stats,
+                              const bool jacobians,
+                              worker_pool_t& pool,
+                              Convert convert = {})
+        : state_(std::make_shared<state_t>(std::move(stats), jacobians, std::move(convert))) {
+        const auto workers = std::min(pool.size(), state_->size);
+        for (size_t i = 0; i < workers; i++) {
+            pool.submit([weak = std::weak_ptr<state_t>(state_)] {
+                work(weak);
+            });
+        }
+    }
+
+    // the number of iterations
+    auto size() const -> size_t {
+        return state_->size;
+    }
+
+    // true once every iteration is converted or failed to, doesn't wait
+    auto ready() const -> bool {
+        for (size_t i = 0; i < state_->size; i++) {
+            if (state_->slots[i].state.load(std::memory_order_acquire) < kReady) {
+                return false;
+            }
+        }
+        return true;
+    }
+
+    // rethrows whatever the conversion of the iteration threw, on whichever thread it ran
+    auto iteration(const size_t i) const -> const optimization_iteration_t& {
+        if (i >= state_->size) {
+            throw std::out_of_range("lazy_optimization_stats_t: no such iteration.");
+        }
+        auto& state = *state_;
+        auto& slot = state.slots[i];
+        if (slot.state.load(std::memory_order_acquire) < kReady and not convert(state, i)) {
+            auto lock = std::unique_lock(state.mutex);
+            state.converted.wait(lock, [&slot] {
+                return slot.state.load(std::memory_order_acquire) >= kReady;
+            });
+        }
+        if (slot.state.load(std::memory_order_acquire) == kFailed) {
+            std::rethrow_exception(slot.error);
+        }
+        return slot.value;
+    }
+
+    // every iteration, converting whatever the workers haven't got to yet
+    auto iterations() const -> immer::vector<optimization_iteration_t> {
+        auto out = immer::vector<optimization_iteration_t>{}.transient();
+        for (size_t i = 0; i < state_->size; i++) {
+            out.push_back(iteration(i));
+        }
+        return std::move(out).persistent();
+    }
+
+    auto best_index() const -> int32_t {
+        return state_->source.best_index;
+    }
+
+    auto status() const -> optimization_status_t {
+        return to_imsym(state_->source.status);
+    }
+
+    auto failure_reason() const -> int32_t {
+        return state_->source.failure_reason;
+    }
+
+    auto best_linearization() const -> const optional<linearization_t>& {
+        auto& state = *state_;
+        std::call_once(state.best_linearization_once, [&state] {
+            state.best_linearization = to_linearization(state.source.best_linearization);
+        });
+        return state.best_linearization;
+    }
+
+    // empty unless the jacobians were asked for
+    auto jacobian_sparsity() const -> const sparse_matrix_structure_t& {
+        auto& state = *state_;
+        std::call_once(state.jacobian_sparsity_once, [&state] {
+            if (state.jacobians) {
+                state.jacobian_sparsity = to_imsym(state.source.jacobian_sparsity);
+            }
+        });
+        return state.jacobian_sparsity;
+    }
+
+    auto linear_solver_ordering() const -> const immer::vector<int>& {
+        auto& state = *state_;
+        std::call_once(state.linear_solver_ordering_once, [&state] {
+            state.linear_solver_ordering = to_imsym(state.source.linear_solver_ordering);
+        });
+        return state.linear_solver_ordering;
+    }
+
+    // all of it, as to_imsym(stats, true, jacobians) would give
+    auto get() const -> optimization_stats_t {
+        return optimization_stats_t{
+            .iterations = iterations(),
+            .best_index = best_index(),
+            .status = status(),
+            .failure_reason = failure_reason(),
+            .best_linearization = best_linearization(),
+            .jacobian_sparsity = jacobian_sparsity(),
+            .linear_solver_ordering = linear_solver_ordering(),
+        };
+    }
+
+   private:
+    static constexpr int kPending = 0;
+    static constexpr int kConverting = 1;
+    static constexpr int kReady = 2;
+    static constexpr int kFailed = 3;
+
+    struct slot_t {
+        std::atomic<int> state{kPending};
+        optimization_iteration_t value{};
+        // set before the state becomes kFailed
+        std::exception_ptr error{};
+    };
+
+    struct state_t {
+        state_t(sym::OptimizationStats<MatrixType>&& stats, const bool jacobians, Convert convert)
+            : source(std::move(stats)),
+              jacobians(jacobians),
+              convert(std::move(convert)),
+              size(source.iterations.size()),
+              slots(std::make_unique<slot_t[]>(size)) {}
+
+        const sym::OptimizationStats<MatrixType> source;
+        const bool jacobians;
+        const Convert convert;
+        const size_t size;
+        std::unique_ptr<slot_t[]> slots;
+        std::atomic<size_t> next{0};
+
+        std::mutex mutex;
+        std::condition_variable converted;
+
+        std::once_flag best_linearization_once;
+        std::once_flag jacobian_sparsity_once;
+        std::once_flag linear_solver_ordering_once;
+        optional<linearization_t> best_linearization;
+        sparse_matrix_structure_t jacobian_sparsity;
+        immer::vector<int> linear_solver_ordering;
+    };
+
+    // convert iteration i if nobody has claimed it yet, false if someone else has
+    static auto convert(state_t& state, const size_t i) -> bool {
+        auto& slot = state.slots[i];
+        auto expected = kPending;
+        if (not slot.state.compare_exchange_strong(expected, kConverting)) {
+            return false;
+        }
+        auto done = kReady;
+        try {
+            slot.value = state.convert(state.source.iterations[i], state.jacobians);
+        } catch (...) {
+            // kept for the readers, a worker must not let it escape
+            slot.error = std::current_exception();
+            done = kFailed;
+        }
+        {
+            // under the lock so a reader can't miss the notify between its check and its wait
+            const auto lock = std::lock_guard(state.mutex);
+            slot.state.store(done, std::memory_order_release);
+        }
+        state.converted.notify_all();
+        return true;
+    }
+
+    static auto work(const std::weak_ptr<state_t>& weak) -> void {
+        while (const auto state = weak.lock()) {
+            const auto i = state->next.fetch_add(1, std::memory_order_relaxed);
+            if (i >= state->size) {
+                return;
+            }
+            convert(*state, i);
+        }
+    }
+
+    std::shared_ptr<state_t> state_;
+};
+
+/*
+ * a handle on stats converted in the background, see lazy_optimization_stats_t
+ * the iterations are always converted, their jacobian values only if jacobians is set.
+ * convert(iteration, jacobians) replaces to_imsym for the iterations, it runs on the workers
+ */
+template<typename MatrixType, typename Convert = convert_iteration_t>
+inline auto convert_async(sym::OptimizationStats<MatrixType>&& stats,
+                          const bool jacobians = false,
+                          worker_pool_t& pool = worker_pool_t::shared(),
+                          Convert convert = {}) -> lazy_optimization_stats_t<MatrixType, Convert> {
+    return lazy_optimization_stats_t<MatrixType, Convert>(
+        std::move(stats), jacobians, pool, std::move(convert));
+}
+
+}   // namespace imsym
@@ -0,0 +1,121 @@
+/* Copyright (C) Basemap, Inc DBA Automaton  All Rights Reserved
+ * Unauthorized copying of this file, via any medium is strictly prohibited
+ * Proprietary and confidential
+ * Written by Asa Hammond <asa@automaton.is>, 2021
+ */
+
+#pragma once
+#include "imsym/opt/key.hh"
+//
+#include <immer/flex_vector.hpp>
+#include <immer/map.hpp>
+
+#include <algorithm>
+#include <optional>
+#include <utility>
+
+namespace imsym::key {
+
+using std::move;
+
+/*
+ * persistent secondary index of keys by letter
+ * each letter holds its (sub, super) pairs in sorted order, so the largest subscript and subscript
+ * ranges are O(log n) instead of a walk over every key in a values map.
+ * Like the values map it is an immer structure, versions share everything they don't change.
+ */
+struct letter_index_t {
+    using entry_t = std::pair<key_t::subscript_t, key_t::superscript_t>;
+    using entries_t = immer::flex_vector<entry_t>;
+
+    immer::map<key_t::letter_t, entries_t> letters;
+};
+
+// position of the first entry not less than value
+inline auto lower_bound(const letter_index_t::entries_t& entries,
+                        const letter_index_t::entry_t& value) -> size_t {
+    return std::lower_bound(entries.begin(), entries.end(), value) - entries.begin();
+}
+
+inline auto insert(letter_index_t index, const key_t& key) -> letter_index_t {
+    const auto value = letter_index_t::entry_t{key.sub, key.super};
+    const auto* found = index.letters.find(key.letter);
+    auto entries = found != nullptr ? *found : letter_index_t::entries_t{};
+
+    const auto pos = lower_bound(entries, value);
+    if (pos < entries.size() and entries[pos] == value) {
+        return index;
+    }
+    index.letters = move(index.letters).set(key.letter, move(entries).insert(pos, value));
+    return index;
+}
+
+inline auto erase(letter_index_t index, const key_t& key) -> letter_index_t {
+    const auto* found = index.letters.find(key.letter);
+    if (found == nullptr) {
+        return index;
+    }
+    const auto value = letter_index_t::entry_t{key.sub, key.super};
+    const auto pos = lower_bound(*found, value);
+    if (pos == found->size() or (*found)[pos] != value) {
+        return index;
+    }
+
+    auto entries = found->erase(pos);
+    if (entries.empty()) {
+        index.letters = move(index.letters).erase(key.letter);
+    } else {
+        index.letters = move(index.letters).set(key.letter, move(entries));
+    }
+    return index;
+}
+
+inline auto entries(const letter_index_t& index, const key_t::letter_t letter)
+    -> letter_index_t::entries_t {
+    const auto* found = index.letters.find(letter);
+    return found != nullptr ? *found : letter_index_t::entries_t{};
+}
+
+/*
+ * all entries for letter with sub in [sub_begin, sub_end), shares structure with the index
+ */
+inline auto range(const letter_index_t& index,
+                  const key_t::letter_t letter,
+                  const key_t::subscript_t sub_begin,
+                  const key_t::subscript_t sub_end) -> letter_index_t::entries_t {
+    const auto all = entries(index, letter);
+    const auto first = lower_bound(all, {sub_begin, key_t::kInvalidSuper});
+    const auto last = lower_bound(all, {sub_end, key_t::kInvalidSuper});
+    return all.drop(first).take(last - std::min(first, last));
+}
+
+inline auto largest_sub(const letter_index_t& index, const key_t::letter_t letter)
+    -> key_t::subscript_t {
+    const auto* found = index.letters.find(letter);
+    if (found == nullptr) {
+        return key_t::kInvalidSub;
+    }
+    return found->back().first;
+}
+
+// supers aren't ordered, this only walks the keys with letter
+inline auto largest_super(const letter_index_t& index, const key_t::letter_t letter)
+    -> key_t::superscript_t {
+    key_t::superscript_t largest = key_t::kInvalidSuper;
+    for (const auto& [sub, super] : entries(index, letter)) {
+        largest = std::max(largest, super);
+    }
+    return largest;
+}
+
+// first key with the letter and sub of key, in super order
+inline auto find_letter_sub(const letter_index_t& index, const key_t& key) -> std::optional<key_t> {
+    const auto all = entries(index, key.letter);
+    const auto pos = lower_bound(all, {key.sub, key_t::kInvalidSuper});
+    if (pos == all.size() or all[pos].first != key.sub) {
+        return {};
+    }
+    return key_t{.letter = key.letter, .sub = key.sub, .super = all[pos].second};
+}
+
+}   // namespace imsym::key
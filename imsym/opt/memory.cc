@@ -0,0 +1,242 @@
+/* Copyright (C) Basemap, Inc DBA Automaton  All Rights Reserved
+ * Unauthorized copying of this file, via any medium is strictly prohibited
+ * Proprietary and confidential
+ * Written by Asa Hammond <asa@automaton.is>, 2022
+ */
+#include "imsym/opt/memory.hh"
+
+#include <array>
+#include <atomic>
+#include <cstdint>
+#include <mutex>
+#include <new>
+#include <utility>
+#include <vector>
+
+namespace imsym {
+
+namespace {
+
+struct free_node_t {
+    free_node_t* next;
+};
+
+// a free list which knows its length and its last node, so it can be handed over in O(1)
+struct chain_t {
+    free_node_t* head = nullptr;
+    free_node_t* tail = nullptr;
+    uint32_t count = 0;
+};
+
+auto push(chain_t& chain, free_node_t* node) -> void {
+    node->next = chain.head;
+    if (chain.head == nullptr) {
+        chain.tail = node;
+    }
+    chain.head = node;
+    chain.count++;
+}
+
+auto pop(chain_t& chain) -> free_node_t* {
+    auto* node = chain.head;
+    chain.head = node->next;
+    if (chain.head == nullptr) {
+        chain.tail = nullptr;
+    }
+    chain.count--;
+    return node;
+}
+
+// nodes move between the threads and the depot in chains of at most this many
+constexpr uint32_t kBatch = pool_heap_t::kMaxCached / 2;
+
+/*
+ * free nodes given back by threads, and every slab ever carved
+ * leaked on purpose so threads exiting during static destruction can still flush into it
+ */
+struct depot_t {
+    std::mutex mutex;
+    std::array<std::vector<chain_t>, pool_heap_t::kNumClasses> chains;
+    std::vector<void*> slabs;
+};
+
+auto depot() -> depot_t& {
+    static auto* instance = new depot_t{};
+    return *instance;
+}
+
+// bumped by release(), a thread cache from an older generation points into freed slabs
+std::atomic<uint64_t> generation{1};
+std::atomic<size_t> large_allocations{0};
+
+/*
+ * two chains per class, loaded is allocated from and freed into, previous is a full or empty
+ * spare. A thread swaps between them before it touches the depot, so alternating allocations and
+ * frees at a chain boundary don't take the lock each time, and it holds at most 2 * kBatch nodes.
+ * Kept trivially destructible so it is still usable by thread_local destructors which run after
+ * the flush at thread exit, nodes freed then are simply not reused.
+ */
+struct thread_cache_t {
+    std::array<chain_t, pool_heap_t::kNumClasses> loaded;
+    std::array<chain_t, pool_heap_t::kNumClasses> previous;
+    uint64_t generation;
+};
+
+thread_local thread_cache_t cache{};
+
+struct flush_at_exit_t {
+    ~flush_at_exit_t() {
+        pool_heap_t::flush();
+    }
+};
+
+// this thread's cache, emptied first if release() ran since it was last used
+auto current() -> thread_cache_t& {
+    const auto latest = generation.load(std::memory_order_acquire);
+    if (cache.generation != latest) {
+        cache.loaded.fill(chain_t{});
+        cache.previous.fill(chain_t{});
+        cache.generation = latest;
+    }
+    return cache;
+}
+
+auto local() -> thread_cache_t& {
+    static thread_local flush_at_exit_t flush_at_exit;
+    (void)flush_at_exit;
+    return current();
+}
+
+// hand a chain to the depot, the depot lock must be held
+auto give_back(depot_t& d, const size_t size_class, chain_t& chain) -> void {
+    if (chain.head == nullptr) {
+        return;
+    }
+    auto& chains = d.chains[size_class];
+    // short chains, from flushes, are joined up so refills don't get a handful of nodes
+    if (not chains.empty() and chains.back().count + chain.count <= kBatch) {
+        auto& back = chains.back();
+        back.tail->next = chain.head;
+        back.tail = chain.tail;
+        back.count += chain.count;
+    } else {
+        chains.push_back(chain);
+    }
+    chain = chain_t{};
+}
+
+// a chain from the depot, or a batch carved from a new slab with the rest left in the depot
+auto refill(const size_t size_class) -> chain_t {
+    auto& d = depot();
+    {
+        const auto lock = std::lock_guard(d.mutex);
+        auto& chains = d.chains[size_class];
+        if (not chains.empty()) {
+            const auto chain = chains.back();
+            chains.pop_back();
+            return chain;
+        }
+    }
+
+    auto* slab = static_cast<std::byte*>(std::aligned_alloc(pool_heap_t::kGranularity,
+                                                            pool_heap_t::kSlabSize));
+    if (slab == nullptr) {
+        throw std::bad_alloc{};
+    }
+
+    // threaded outside the lock
+    const auto node_size = (size_class + 1) * pool_heap_t::kGranularity;
+    const auto count = pool_heap_t::kSlabSize / node_size;
+    auto rest = std::vector<chain_t>{};
+    auto chain = chain_t{};
+    for (size_t i = count; i-- > 0;) {
+        if (chain.count == kBatch) {
+            rest.push_back(chain);
+            chain = chain_t{};
+        }
+        push(chain, reinterpret_cast<free_node_t*>(slab + i * node_size));
+    }
+
+    const auto lock = std::lock_guard(d.mutex);
+    d.slabs.push_back(slab);
+    auto& chains = d.chains[size_class];
+    chains.insert(chains.end(), rest.begin(), rest.end());
+    return chain;
+}
+
+}   // namespace
+
+auto pool_heap_t::allocate_large(const size_t size) -> void* {
+    void* data = std::malloc(size);
+    if (data == nullptr) {
+        throw std::bad_alloc{};
+    }
+    large_allocations.fetch_add(1, std::memory_order_relaxed);
+    return data;
+}
+
+auto pool_heap_t::allocate_pooled(const size_t size_class) -> void* {
+    auto& c = local();
+    auto& loaded = c.loaded[size_class];
+    if (loaded.head == nullptr) {
+        if (c.previous[size_class].head != nullptr) {
+            std::swap(loaded, c.previous[size_class]);
+        } else {
+            loaded = refill(size_class);
+        }
+    }
+    return pop(loaded);
+}
+
+auto pool_heap_t::deallocate_pooled(const size_t size_class, void* data) -> void {
+    auto& c = local();
+    auto& loaded = c.loaded[size_class];
+    if (loaded.count >= kBatch) {
+        auto& previous = c.previous[size_class];
+        if (previous.head != nullptr) {
+            auto& d = depot();
+            const auto lock = std::lock_guard(d.mutex);
+            give_back(d, size_class, previous);
+        }
+        previous = loaded;
+        loaded = chain_t{};
+    }
+    push(loaded, static_cast<free_node_t*>(data));
+}
+
+auto pool_heap_t::flush() -> void {
+    auto& c = current();
+    auto& d = depot();
+    const auto lock = std::lock_guard(d.mutex);
+    for (size_t size_class = 0; size_class < kNumClasses; size_class++) {
+        give_back(d, size_class, c.loaded[size_class]);
+        give_back(d, size_class, c.previous[size_class]);
+    }
+}
+
+auto pool_heap_t::release() -> size_t {
+    auto& d = depot();
+    const auto lock = std::lock_guard(d.mutex);
+    const auto released = d.slabs.size() * kSlabSize;
+    for (auto* slab : d.slabs) {
+        std::free(slab);
+    }
+    d.slabs.clear();
+    for (auto& chains : d.chains) {
+        chains.clear();
+    }
+    generation.fetch_add(1, std::memory_order_release);
+    return released;
+}
+
+auto pool_heap_t::stats() -> pool_stats_t {
+    auto& d = depot();
+    const auto lock = std::lock_guard(d.mutex);
+    return pool_stats_t{
+        .slabs = d.slabs.size(),
+        .slab_bytes = d.slabs.size() * kSlabSize,
+        .large_allocations = large_allocations.load(std::memory_order_relaxed),
+    };
+}
+
+}   // namespace imsym
@@ -0,0 +1,167 @@
+/* Copyright (C) Basemap, Inc DBA Automaton  All Rights Reserved
+ * Unauthorized copying of this file, via any medium is strictly prohibited
+ * Proprietary and confidential
+ * Written by Asa Hammond <asa@automaton.is>, 2022
+ */
+#pragma once
+#include "imsym/opt/types.hh"
+#include "imsym/opt/values.hh"
+//
+#include <immer/algorithm.hpp>
+#include <immer/flex_vector_transient.hpp>
+#include <immer/heap/heap_policy.hpp>
+#include <immer/lock/no_lock_policy.hpp>
+#include <immer/memory_policy.hpp>
+#include <immer/refcount/unsafe_refcount_policy.hpp>
+
+#include <cstddef>
+#include <cstdlib>
+#include <utility>
+
+/*
+ * immer memory policies for the imsym types
+ *
+ * values_t and the types.hh matrices take an immer memory policy as their last template
+ * parameter, defaulting to immer's. pool_memory_policy allocates nodes from pool_heap_t:
+ *  - nodes are rounded up to 16 byte size classes, each thread keeps a free list per class
+ *  - free nodes move between the threads and a shared depot in counted chains of up to
+ *    kMaxCached / 2, handed over in O(1) under the depot lock
+ *  - an empty free list is refilled from a chain other threads gave back, or by carving up a new
+ *    64k slab, so the system allocator is hit once per slab rather than once per node
+ *  - slabs are only given back to the system all at once, by release()
+ * Nodes over kMaxPooled bytes go straight to malloc.
+ *
+ * Refcounting is immer's default, values on the pool can be shared between threads like any other.
+ *
+ * local_memory_policy is for values which never leave the thread that made them, eg. the working
+ * values of one optimization: copies bump a plain int instead of an atomic. Publish them with
+ * to_shared.
+ */
+
+namespace imsym {
+
+struct pool_stats_t {
+    // slabs currently held, and their total size
+    size_t slabs = 0;
+    size_t slab_bytes = 0;
+    // allocations too large to pool, served by malloc
+    size_t large_allocations = 0;
+};
+
+class pool_heap_t {
+   public:
+    static constexpr size_t kGranularity = 16;
+    static constexpr size_t kMaxPooled = 1024;
+    static constexpr size_t kNumClasses = kMaxPooled / kGranularity;
+    static constexpr size_t kSlabSize = 64 * 1024;
+    // at most this many free nodes are held per thread and class, the rest go to the shared depot
+    static constexpr size_t kMaxCached = 4096;
+
+    template<typename... Tags>
+    static auto allocate(const size_t size, Tags...) -> void* {
+        if (size > kMaxPooled) {
+            return allocate_large(size);
+        }
+        return allocate_pooled(size_class(size));
+    }
+
+    template<typename... Tags>
+    static auto deallocate(const size_t size, void* data, Tags...) -> void {
+        if (size > kMaxPooled) {
+            std::free(data);
+            return;
+        }
+        deallocate_pooled(size_class(size), data);
+    }
+
+    // give this thread's free nodes back to the depot, done automatically when a thread exits
+    static auto flush() -> void;
+
+    /*
+     * free every slab, returns the number of bytes given back to the system
+     * only valid once nothing allocated from the pool is alive. Free lists other threads still
+     * hold are dropped the next time they touch the pool.
+     */
+    static auto release() -> size_t;
+
+    static auto stats() -> pool_stats_t;
+
+   private:
+    static constexpr auto size_class(const size_t size) -> size_t {
+        return size == 0 ? 0 : (size - 1) / kGranularity;
+    }
+
+    static auto allocate_large(size_t size) -> void*;
+    static auto allocate_pooled(size_t size_class) -> void*;
+    static auto deallocate_pooled(size_t size_class, void* data) -> void;
+};
+
+using pool_memory_policy = immer::memory_policy<immer::heap_policy<pool_heap_t>,
+                                                immer::default_refcount_policy,
+                                                immer::default_lock_policy>;
+
+template<typename Scalar>
+using pooled_values_t = values::values_t<Scalar, pool_memory_policy>;
+using pooled_valuesd_t = pooled_values_t<double>;
+using pooled_valuesf_t = pooled_values_t<float>;
+
+using local_memory_policy = immer::memory_policy<immer::default_heap_policy,
+                                                 immer::unsafe_refcount_policy,
+                                                 immer::no_lock_policy>;
+
+template<typename Scalar>
+using local_values_t = values::values_t<Scalar, local_memory_policy>;
+using local_valuesd_t = local_values_t<double>;
+using local_valuesf_t = local_values_t<float>;
+
+template<typename Scalar>
+using pooled_sparse_matrix = sparse_matrix<Scalar, pool_memory_policy>;
+template<typename Scalar>
+using pooled_dense_matrix = dense_matrix<Scalar, pool_memory_policy>;
+template<typename Scalar>
+using pooled_dense_lt_matrix = dense_lt_matrix<Scalar, pool_memory_policy>;
+
+}   // namespace imsym
+
+namespace imsym::values {
+
+/*
+ * copy values onto another memory policy
+ * nodes can't be shared across policies, so this is a full copy, the data a leaf at a time
+ */
+template<typename ToPolicy, typename Scalar, typename FromPolicy>
+inline auto rebind(const values_t<Scalar, FromPolicy>& values) -> values_t<Scalar, ToPolicy> {
+    auto out = values_t<Scalar, ToPolicy>{};
+    out.garbage = values.garbage;
+    out.letter_index = values.letter_index;
+    out.offset_index = values.offset_index;
+
+    auto map = std::move(out.map).transient();
+    for (const auto& [k, entry] : values.map) {
+        map.set(k, entry);
+    }
+    out.map = std::move(map).persistent();
+
+    auto data = typename values_t<Scalar, ToPolicy>::data_t{}.transient();
+    immer::for_each_chunk(values.data, [&data](const Scalar* first, const Scalar* last) {
+        for (; first != last; ++first) {
+            data.push_back(*first);
+        }
+    });
+    out.data = std::move(data).persistent();
+    return out;
+}
+
+// a thread local copy of values, see local_memory_policy
+template<typename Scalar, typename MemoryPolicy>
+inline auto to_local(const values_t<Scalar, MemoryPolicy>& values) -> local_values_t<Scalar> {
+    return rebind<local_memory_policy>(values);
+}
+
+// a copy of thread local values that is safe to hand to other threads
+template<typename Scalar>
+inline auto to_shared(const local_values_t<Scalar>& values) -> values_t<Scalar> {
+    return rebind<immer::default_memory_policy>(values);
+}
+
+}   // namespace imsym::values
@@ -0,0 +1,84 @@
+/* Copyright (C) Basemap, Inc DBA Automaton  All Rights Reserved
+ * Unauthorized copying of this file, via any medium is strictly prohibited
+ * Proprietary and confidential
+ * Written by Asa Hammond <asa@automaton.is>, 2021
+ */
+
+#pragma once
+#include "imsym/opt/key.hh"
+//
+#include <immer/flex_vector.hpp>
+
+#include <algorithm>
+#include <cstdint>
+#include <utility>
+
+namespace imsym::values {
+
+using std::move;
+
+/*
+ * persistent secondary index of the keys of a values_t by data offset
+ * the map is keyed by hash, this keeps the keys in data order so the entries over a stretch of
+ * data are found in O(log n) instead of a walk over every key, see values_diff.hh.
+ * Like the letter index it is an immer structure, versions share everything they don't change.
+ */
+struct offset_index_t {
+    using entry_t = std::pair<int32_t, imsym::key::key_t>;
+    using entries_t = immer::flex_vector<entry_t>;
+
+    entries_t entries;
+};
+
+// position of the first entry at or after offset
+inline auto lower_bound(const offset_index_t& index, const int32_t offset) -> size_t {
+    const auto it = std::lower_bound(
+        index.entries.begin(), index.entries.end(), offset, [](const auto& entry, const int32_t o) {
+            return entry.first < o;
+        });
+    return it - index.entries.begin();
+}
+
+inline auto insert(offset_index_t index, const imsym::key::key_t& key, const int32_t offset)
+    -> offset_index_t {
+    auto pos = lower_bound(index, offset);
+    // entries at the same offset can only be empty ones, keep them in insertion order
+    while (pos < index.entries.size() and index.entries[pos].first == offset) {
+        if (index.entries[pos].second == key) {
+            return index;
+        }
+        pos++;
+    }
+    index.entries = move(index.entries).insert(pos, {offset, key});
+    return index;
+}
+
+inline auto erase(offset_index_t index, const imsym::key::key_t& key, const int32_t offset)
+    -> offset_index_t {
+    for (auto pos = lower_bound(index, offset);
+         pos < index.entries.size() and index.entries[pos].first == offset;
+         pos++) {
+        if (index.entries[pos].second == key) {
+            index.entries = move(index.entries).erase(pos);
+            return index;
+        }
+    }
+    return index;
+}
+
+/*
+ * the entries which can hold data in [begin, end), shares structure with the index
+ * live entries don't overlap, so besides the ones starting in the range only the last one starting
+ * before it can reach into it. Callers check that one against its storage_dim.
+ */
+inline auto overlapping(const offset_index_t& index, const int32_t begin, const int32_t end)
+    -> offset_index_t::entries_t {
+    auto first = lower_bound(index, begin);
+    const auto last = lower_bound(index, end);
+    if (first > 0) {
+        first--;
+    }
+    return index.entries.drop(first).take(last - first);
+}
+
+}   // namespace imsym::values
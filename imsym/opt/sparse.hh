@@ -0,0 +1,199 @@
+/* Copyright (C) Basemap, Inc DBA Automaton  All Rights Reserved
+ * Unauthorized copying of this file, via any medium is strictly prohibited
+ * Proprietary and confidential
+ * Written by Asa Hammond <asa@automaton.is>, 2022
+ */
+#pragma once
+#include "imsym/opt/chunks.hh"
+#include "imsym/opt/types.hh"
+//
+#include <immer/vector.hpp>
+
+#include <Eigen/SparseCore>
+#include <algorithm>
+#include <memory>
+#include <optional>
+#include <stdexcept>
+#include <type_traits>
+#include <utility>
+
+/*
+ * ops on the CSC sparse_matrix, and its conversions to and from Eigen
+ *
+ * The three arrays are copied in bulk both ways, nothing goes through triplets or per nonzero
+ * inserts. eigen_view only avoids the copy when each of the three arrays fits in one immer leaf,
+ * i.e. for small matrices, anything bigger is copied into the view.
+ */
+
+namespace imsym {
+
+template<typename Scalar, typename MemoryPolicy>
+inline auto nonzeros(const sparse_matrix<Scalar, MemoryPolicy>& m) -> size_t {
+    return m.values.size();
+}
+
+// the entry at (row, col), or zero if it isn't stored. binary search within the column
+template<typename Scalar, typename MemoryPolicy>
+inline auto coeff(const sparse_matrix<Scalar, MemoryPolicy>& m, const long row, const long col)
+    -> Scalar {
+    if (m.column_pointers.empty()) {
+        return Scalar{0};
+    }
+    const auto first = m.row_indices.begin() + m.column_pointers[col];
+    const auto last = m.row_indices.begin() + m.column_pointers[col + 1];
+    const auto found = std::lower_bound(first, last, static_cast<sparse_index_t>(row));
+    if (found == last or *found != row) {
+        return Scalar{0};
+    }
+    return m.values[found - m.row_indices.begin()];
+}
+
+// the pattern of m, sharing its arrays
+template<typename Scalar, typename MemoryPolicy>
+inline auto structure(const sparse_matrix<Scalar, MemoryPolicy>& m)
+    -> sparse_matrix_structure<MemoryPolicy> {
+    return {.size = m.size, .column_pointers = m.column_pointers, .row_indices = m.row_indices};
+}
+
+/*
+ * the matrix with the given pattern and values, in the order of row_indices
+ * shares the arrays of both, so many matrices over one pattern only pay for their values
+ */
+template<typename Scalar, typename MemoryPolicy>
+inline auto with_values(const sparse_matrix_structure<MemoryPolicy>& structure,
+                        immer::vector<Scalar, MemoryPolicy> values)
+    -> sparse_matrix<Scalar, MemoryPolicy> {
+    if (values.size() != structure.row_indices.size()) {
+        throw std::runtime_error("with_values: the values don't match the sparsity pattern.");
+    }
+    return {.size = structure.size,
+            .column_pointers = structure.column_pointers,
+            .row_indices = structure.row_indices,
+            .values = std::move(values)};
+}
+
+/*
+ * from the compressed arrays of a CSC matrix
+ * column_pointers has cols + 1 entries, the others column_pointers[cols]
+ */
+template<typename Scalar>
+inline auto from_csc(const long rows,
+                     const long cols,
+                     const sparse_index_t* column_pointers,
+                     const sparse_index_t* row_indices,
+                     const Scalar* values) -> sparse_matrix<Scalar> {
+    const auto nnz = column_pointers[cols];
+    auto out = sparse_matrix<Scalar>{};
+    out.size = {.row = rows, .col = cols};
+    out.column_pointers =
+        immer::vector<sparse_index_t>(column_pointers, column_pointers + cols + 1);
+    out.row_indices = immer::vector<sparse_index_t>(row_indices, row_indices + nnz);
+    out.values = immer::vector<Scalar>(values, values + nnz);
+    return out;
+}
+
+template<typename Scalar, int Options>
+inline auto to_imsym(const Eigen::SparseMatrix<Scalar, Options, sparse_index_t>& mat)
+    -> sparse_matrix<Scalar> {
+    if constexpr (Options & Eigen::RowMajor) {
+        return to_imsym(Eigen::SparseMatrix<Scalar, Eigen::ColMajor, sparse_index_t>(mat));
+    } else {
+        if (not mat.isCompressed()) {
+            auto compressed = mat;
+            compressed.makeCompressed();
+            return to_imsym(compressed);
+        }
+        return from_csc(mat.rows(),
+                        mat.cols(),
+                        mat.outerIndexPtr(),
+                        mat.innerIndexPtr(),
+                        mat.valuePtr());
+    }
+}
+
+template<typename Scalar>
+inline auto to_imsym(const Eigen::MappedSparseMatrix<Scalar>& mat) -> sparse_matrix<Scalar> {
+    if (not mat.isCompressed()) {
+        return to_imsym(Eigen::SparseMatrix<Scalar>(mat));
+    }
+    return from_csc(
+        mat.rows(), mat.cols(), mat.outerIndexPtr(), mat.innerIndexPtr(), mat.valuePtr());
+}
+
+template<typename Scalar>
+inline auto to_imsym(const Eigen::Map<const Eigen::SparseMatrix<Scalar>>& mat)
+    -> sparse_matrix<Scalar> {
+    if (not mat.isCompressed()) {
+        return to_imsym(Eigen::SparseMatrix<Scalar>(mat));
+    }
+    return from_csc(
+        mat.rows(), mat.cols(), mat.outerIndexPtr(), mat.innerIndexPtr(), mat.valuePtr());
+}
+
+template<typename Scalar, typename MemoryPolicy>
+inline auto to_eigen(const sparse_matrix<Scalar, MemoryPolicy>& m) -> Eigen::SparseMatrix<Scalar> {
+    auto out = Eigen::SparseMatrix<Scalar>(m.size.row, m.size.col);
+    if (m.column_pointers.empty()) {
+        return out;
+    }
+    out.resizeNonZeros(static_cast<Eigen::Index>(nonzeros(m)));
+    values::copy_chunks(m.column_pointers, out.outerIndexPtr());
+    values::copy_chunks(m.row_indices, out.innerIndexPtr());
+    values::copy_chunks(m.values, out.valuePtr());
+    return out;
+}
+
+/*
+ * a read only Eigen view of a sparse_matrix
+ * This copies the matrix unless column_pointers, row_indices and values each sit in one immer
+ * leaf, which only holds for small matrices. In that case map points straight into the leaves,
+ * otherwise into a copy owned by the view, check zero_copy(). It holds on to the arrays it maps,
+ * and stays valid when copied or moved.
+ */
+template<typename Scalar, typename MemoryPolicy = immer::default_memory_policy>
+struct sparse_eigen_view_t {
+    using map_t = Eigen::Map<const Eigen::SparseMatrix<Scalar>>;
+
+    sparse_matrix<Scalar, MemoryPolicy> source;
+    std::shared_ptr<const Eigen::SparseMatrix<Scalar>> copy;
+    map_t map;
+
+    // true if map reads the immer leaves in place
+    auto zero_copy() const -> bool {
+        return copy == nullptr;
+    }
+};
+
+template<typename Scalar, typename MemoryPolicy>
+inline auto eigen_view(const sparse_matrix<Scalar, MemoryPolicy>& m)
+    -> sparse_eigen_view_t<Scalar, MemoryPolicy> {
+    using view_t = sparse_eigen_view_t<Scalar, MemoryPolicy>;
+    const auto rows = m.size.row;
+    const auto cols = m.size.col;
+    const auto nnz = static_cast<Eigen::Index>(nonzeros(m));
+
+    const auto* column_pointers = values::single_chunk(m.column_pointers);
+    const auto* row_indices = values::single_chunk(m.row_indices);
+    const auto* data = values::single_chunk(m.values);
+    if (column_pointers != nullptr and (nnz == 0 or (row_indices != nullptr and data != nullptr))) {
+        return view_t{
+            .source = m,
+            .copy = nullptr,
+            .map = typename view_t::map_t(rows, cols, nnz, column_pointers, row_indices, data),
+        };
+    }
+
+    auto copy = std::make_shared<const Eigen::SparseMatrix<Scalar>>(to_eigen(m));
+    return view_t{
+        .source = m,
+        .copy = copy,
+        .map = typename view_t::map_t(rows,
+                                      cols,
+                                      nnz,
+                                      copy->outerIndexPtr(),
+                                      copy->innerIndexPtr(),
+                                      copy->valuePtr()),
+    };
+}
+
+}   // namespace imsym
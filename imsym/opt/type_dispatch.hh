@@ -0,0 +1,137 @@
+/* Copyright (C) Basemap, Inc DBA Automaton  All Rights Reserved
+ * Unauthorized copying of this file, via any medium is strictly prohibited
+ * Proprietary and confidential
+ * Written by Asa Hammond <asa@automaton.is>, 2021
+ */
+
+#pragma once
+#include "imsym/opt/values.hh"
+#include "imsym/opt/values_ops.hh"
+//
+#include <sym/ops/storage_ops.h>
+
+#include <Eigen/Core>
+#include <algorithm>
+#include <array>
+#include <cstddef>
+#include <stdexcept>
+#include <type_traits>
+#include <variant>
+
+/*
+ * type erased dispatch over sym::type_t
+ *
+ * The table is generated from AllowedTypes<Scalar> at compile time: a constexpr std::array indexed
+ * by the type enum, each entry a function instantiated for its concrete type. Dispatch is a bounds
+ * check and an indirect call, adding a type to AllowedTypes adds it to every op built on this.
+ */
+
+namespace imsym::values {
+
+// vectors, matrices and scalars, whose tangent space is their storage
+template<typename T>
+constexpr bool is_vector_space_v =
+    std::is_arithmetic_v<T> or std::is_base_of_v<Eigen::MatrixBase<T>, T>;
+
+template<typename Scalar, typename Fn>
+struct type_table_t {
+    using entry_t = void (*)(Fn&);
+
+    template<typename T>
+    static auto call(Fn& fn) -> void {
+        fn(std::type_identity<T>{});
+    }
+
+    template<typename T>
+    static constexpr auto slot() -> size_t {
+        return static_cast<size_t>(sym::StorageOps<T>::TypeEnum().value);
+    }
+
+    // the table is only built at compile time if every TypeEnum() is a constant expression,
+    // checked per alternative by using it as a template argument
+    template<typename T>
+    static constexpr auto constant_slot() -> size_t {
+        static_assert(requires { typename std::integral_constant<size_t, slot<T>()>; },
+                      "StorageOps<T>::TypeEnum() must be a constant expression");
+        return slot<T>();
+    }
+
+    // nullptr for the enum values which aren't in AllowedTypes
+    template<typename... Ts>
+    static constexpr auto build(std::type_identity<std::variant<Ts...>>) {
+        constexpr auto size = std::max({constant_slot<Ts>()...}) + 1;
+        auto out = std::array<entry_t, size>{};
+        ((out[constant_slot<Ts>()] = &call<Ts>), ...);
+        return out;
+    }
+
+    static constexpr auto table = build(std::type_identity<AllowedTypes<Scalar>>{});
+};
+
+/*
+ * call fn(std::type_identity<T>{}) for the T in AllowedTypes<Scalar> with the given type enum
+ * returns false if the type isn't one of them
+ */
+template<typename Scalar, typename Fn>
+inline auto visit_type(const sym::type_t type, Fn&& fn) -> bool {
+    constexpr const auto& table = type_table_t<Scalar, std::remove_reference_t<Fn>>::table;
+    const auto slot = static_cast<size_t>(type.value);
+    if (slot >= table.size() or table[slot] == nullptr) {
+        return false;
+    }
+    table[slot](fn);
+    return true;
+}
+
+/*
+ * call visitor(entry, value) with the value typed as the entry's concrete type
+ * the value is built from the data in place or from a stack copy, nothing is allocated
+ * returns false, without calling visitor, if the type isn't one of AllowedTypes<Scalar>
+ */
+template<typename Scalar, typename MemoryPolicy, typename Visitor>
+inline auto try_visit_entry(const values_t<Scalar, MemoryPolicy>& values,
+                            const index_entry_t& entry,
+                            Visitor&& visitor) -> bool {
+    const auto typed = [&]<typename T>(std::type_identity<T>) {
+        constexpr int32_t storage_dim = sym::StorageOps<T>::StorageDim();
+        if (entry.storage_dim != storage_dim or
+            entry.offset + storage_dim > static_cast<int32_t>(values.data.size())) {
+            throw std::runtime_error("not enough data to load data");
+        }
+        with_storage<storage_dim>(values.data, entry.offset, [&](const Scalar* storage) {
+            visitor(entry, sym::StorageOps<T>::FromStorage(storage));
+        });
+    };
+    return visit_type<Scalar>(entry.type, typed);
+}
+
+// as above, throws on a type that isn't one of AllowedTypes<Scalar>
+template<typename Scalar, typename MemoryPolicy, typename Visitor>
+inline auto visit_entry(const values_t<Scalar, MemoryPolicy>& values,
+                        const index_entry_t& entry,
+                        Visitor&& visitor) -> void {
+    if (not try_visit_entry(values, entry, visitor)) {
+        throw std::runtime_error("unsupported value type");
+    }
+}
+
+// every entry of values, in map order
+template<typename Scalar, typename MemoryPolicy, typename Visitor>
+inline auto for_each_entry(const values_t<Scalar, MemoryPolicy>& values, Visitor&& visitor)
+    -> void {
+    for (const auto& [k, entry] : values.map) {
+        visit_entry(values, entry, visitor);
+    }
+}
+
+// the entries of index, in index order
+template<typename Scalar, typename MemoryPolicy, typename Visitor>
+inline auto for_each_entry(const values_t<Scalar, MemoryPolicy>& values,
+                           const index_t& index,
+                           Visitor&& visitor) -> void {
+    for (const auto& entry : index.entries) {
+        visit_entry(values, entry, visitor);
+    }
+}
+
+}   // namespace imsym::values
@@ -9,9 +9,11 @@
 //
 //
 #include "immer/map.hpp"
+#include "immer/memory_policy.hpp"
 #include "immer/vector.hpp"
 #include "motion/types.hh"
 
+#include <cstdint>
 #include <optional>
 #include <variant>
 //
@@ -41,30 +43,49 @@ struct coords_t {
     long col;
 };
 
-template<typename Scalar>
+// index type of the CSC arrays, the same as Eigen::SparseMatrix's so they can be mapped directly
+using sparse_index_t = int32_t;
+
+/*
+ * sparse matrix in CSC format, see imsym/opt/sparse.hh for the ops on it
+ * For a description of the format, see
+ * https://en.wikipedia.org/wiki/Sparse_matrix#Compressed_sparse_column_(CSC_or_CCS)
+ * In the comments below, assume an M x N matrix with nnz nonzeros
+ * MemoryPolicy is the immer memory policy of the arrays, see imsym/opt/memory.hh
+ */
+template<typename Scalar, typename MemoryPolicy = immer::default_memory_policy>
 struct sparse_matrix {
+    // (M, N)
     coords_t size;
-    immer::map<coords_t, Scalar> data;
+
+    // the index into row_indices and values of the start of each column, and of the end of the
+    // last one
+    immer::vector<sparse_index_t, MemoryPolicy> column_pointers;   // size N + 1, or 0 when empty
+
+    // the row of each nonzero, ascending within a column
+    immer::vector<sparse_index_t, MemoryPolicy> row_indices;   // size nnz
+
+    immer::vector<Scalar, MemoryPolicy> values;   // size nnz
 };
 
 using sparse_matrix_t = sparse_matrix<double>;
 using sparse_matrixf_t = sparse_matrix<float>;
 
-template<typename Scalar>
+template<typename Scalar, typename MemoryPolicy = immer::default_memory_policy>
 struct dense_matrix {
     // column major dense matrix
     coords_t size;
-    immer::vector<Scalar> data;
+    immer::vector<Scalar, MemoryPolicy> data;
 };
 
 using dense_matrix_t = dense_matrix<double>;
 using dense_matrixf_t = dense_matrix<float>;
 
-template<typename Scalar>
+template<typename Scalar, typename MemoryPolicy = immer::default_memory_policy>
 struct dense_lt_matrix {
     // column major dense matrix with only the lower triangular part filled in
     coords_t size;
-    immer::vector<Scalar> data;
+    immer::vector<Scalar, MemoryPolicy> data;
 };
 using dense_lt_matrix_t = dense_lt_matrix<double>;
 using dense_lt_matrixf_t = dense_lt_matrix<float>;
@@ -115,25 +136,28 @@ struct optimization_iteration_t {
     // The problem residual
     immer::vector<double> residuals;
 
-    // The problem jacobian exactly if dense, or as CSC format sparse data column vector if sparse
-    // either sparse or dense jacobian // TODO support the CSC format of sparse data
-    matrix_t jacobian;
+    // The problem jacobian exactly if dense (column major), or as the CSC format values if sparse.
+    // The structure is optimization_stats_t::jacobian_sparsity, shared by every iteration
+    immer::vector<double> jacobian_values;
 };
 
 // The structure of a sparse matrix in CSC format, not including the numerical values
 // For a description of the format, see
 // https://en.wikipedia.org/wiki/Sparse_matrix#Compressed_sparse_column_(CSC_or_CCS)
 // In the comments below, assume an M x N matrix with nnz nonzeros
-// struct sparse_matrix_structure_t {
-//    // The row for each nonzero entry in the matrix
-//    eigen_lcm.VectorXi row_indices;   // size nnz
-//
-//    // The index into row_indices (and the values) of the start of each column
-//    eigen_lcm.VectorXi column_pointers;   // size N
-//
-//    // The shape (M, N) of the sparse matrix
-//    int64_t shape[2];
-//};
+template<typename MemoryPolicy = immer::default_memory_policy>
+struct sparse_matrix_structure {
+    // the shape (M, N) of the sparse matrix
+    coords_t size;
+
+    // as in sparse_matrix, size N + 1, or 0 when empty or when the matrix is dense
+    immer::vector<sparse_index_t, MemoryPolicy> column_pointers;
+
+    // the row of each nonzero
+    immer::vector<sparse_index_t, MemoryPolicy> row_indices;   // size nnz
+};
+
+using sparse_matrix_structure_t = sparse_matrix_structure<>;
 
 enum optimization_status_t {
     // Uninitialized enum value
@@ -200,7 +224,7 @@ struct optimization_stats_t {
     /// otherwise default constructed.
     ///
     /// If using a dense linearization, only the shape field will be filled.
-    // sparse_matrix_t jacobian_sparsity;
+    sparse_matrix_structure_t jacobian_sparsity;
 
     /// The permutation used by the linear solver
     ///
@@ -217,17 +241,18 @@ struct optimization_stats_t {
     sparse_matrix_t cholesky_factor_sparsity;
 };
 
-using covariance_map_t = immer::map<imsym::key::key_t, dense_matrix_t>;
-// using full_covariance_t = dense_lt_matrix_t;
-using full_covariance_t = dense_matrix_t;
+using covariance_map_t = immer::map<imsym::key::packed_key_t, dense_matrix_t>;
+// symmetric, only the lower triangle is stored, see covariance.hh for ops on it
+using full_covariance_t = dense_lt_matrix_t;
 
 }   // namespace imsym
 
 COMMON_STRUCT_HASH(imsym, coords_t, row, col);
 COMMON_STRUCT_HASH(imsym, offset_t, offset, dim);
 
-COMMON_STRUCT_HASH(imsym, sparse_matrix_t, size, data);
-COMMON_STRUCT_HASH(imsym, sparse_matrixf_t, size, data);
+COMMON_STRUCT_HASH(imsym, sparse_matrix_t, size, column_pointers, row_indices, values);
+COMMON_STRUCT_HASH(imsym, sparse_matrixf_t, size, column_pointers, row_indices, values);
+COMMON_STRUCT_HASH(imsym, sparse_matrix_structure_t, size, column_pointers, row_indices);
 COMMON_STRUCT_HASH(imsym, dense_matrix_t, size, data);
 COMMON_STRUCT_HASH(imsym, dense_matrixf_t, size, data);
 COMMON_STRUCT_HASH(imsym, dense_lt_matrix_t, size, data);
@@ -250,7 +275,7 @@ COMMON_STRUCT(imsym,
               update,
               values,
               residuals,
-              jacobian);   // full jacobian is here
+              jacobian_values);   // structure is in optimization_stats_t
 
 /*
 COMMON_ENUM(imsym,
@@ -267,7 +292,7 @@ COMMON_STRUCT(imsym,
               status,               //
               failure_reason,       //
               best_linearization,   //
-              // jacobian_sparsity,    // jacobian is stored in each iteration directly
+              jacobian_sparsity,    // shared by the jacobian_values of every iteration
               linear_solver_ordering,
               cholesky_factor_sparsity);
 
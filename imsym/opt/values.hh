@@ -9,10 +9,13 @@
 #include "common/immer/utils.hh"
 #include "common/struct.hh"
 #include "imsym/opt/key.hh"
+#include "imsym/opt/letter_index.hh"
+#include "imsym/opt/offset_index.hh"
 
 //
 #include <immer/flex_vector.hpp>
 #include <immer/map.hpp>
+#include <immer/memory_policy.hpp>
 //
 #include <lcmtypes/sym/type_t.hpp>
 #include <sym/atan_camera_cal.h>
@@ -30,6 +33,8 @@
 #include <sym/unit3.h>
 #include <sym/util/typedefs.h>
 ////
+#include <functional>
+#include <optional>
 #include <vector>
 /*
  * immutable variant of symforce structures for use in logging and playback
@@ -163,18 +168,41 @@ using AllowedTypes = std::variant<Scalar,
                                   sym::PolynomialCameraCal<Scalar>,
                                   sym::SphericalCameraCal<Scalar>>;
 
+// the key -> entry map of a values_t, the same for any Scalar, on the one word key of key.hh
+template<typename MemoryPolicy = immer::default_memory_policy>
+using basic_values_map_t = immer::map<imsym::key::packed_key_t,
+                                      index_entry_t,
+                                      std::hash<imsym::key::packed_key_t>,
+                                      std::equal_to<imsym::key::packed_key_t>,
+                                      MemoryPolicy>;
+using values_map_t = basic_values_map_t<>;
+
 /*
  * a la sym::Valuesd
  * a map of keys to values and the scalar data underlying it
  * values are stored in a flex_vector
+ * MemoryPolicy is the immer memory policy of both, see imsym/opt/memory.hh
  */
-template<typename Scalar>
+template<typename Scalar, typename MemoryPolicy = immer::default_memory_policy>
 struct values_t {
-    using map_t = immer::map<imsym::key::key_t, index_entry_t>;
-    using data_t = immer::flex_vector<Scalar>;
+    using memory_policy = MemoryPolicy;
+    using map_t = basic_values_map_t<MemoryPolicy>;
+    using data_t = immer::flex_vector<Scalar, MemoryPolicy>;
     map_t map;
     data_t data;
 
+    // number of scalars in data no longer referenced by the map, left behind by remove and friends
+    // not part of the contents, it only drives compaction
+    int32_t garbage = 0;
+
+    // optional secondary index of the keys by letter, see with_letter_index
+    // when present every op that adds or removes keys keeps it in sync
+    std::optional<imsym::key::letter_index_t> letter_index{};
+
+    // optional secondary index of the keys by data offset, see with_offset_index
+    // when present every op that adds, removes or moves entries keeps it in sync
+    std::optional<offset_index_t> offset_index{};
+
     values_t(std::initializer_list<std::tuple<imsym::key::key_t, AllowedTypes<Scalar>>> init_list);
 
     values_t(){};
@@ -184,6 +212,16 @@ struct values_t {
     };
 };
 
+/*
+ * when to repack data automatically, see compact_if_needed
+ */
+struct compaction_policy_t {
+    // compact once garbage makes up more than this fraction of data
+    double max_garbage_ratio = 0.5;
+    // don't bother compacting below this many garbage scalars
+    int32_t min_garbage = 1024;
+};
+
 using valuesd_t = values_t<double>;
 using valuesf_t = values_t<float>;
 
@@ -0,0 +1,384 @@
+/* Copyright (C) Basemap, Inc DBA Automaton  All Rights Reserved
+ * Unauthorized copying of this file, via any medium is strictly prohibited
+ * Proprietary and confidential
+ * Written by Asa Hammond <asa@automaton.is>, 2021
+ */
+
+#pragma once
+#include "common/cereal/immer_flex_vector.hh"
+#include "common/struct.hh"
+//
+#include "imsym/opt/key.hh"
+#include "imsym/opt/values.hh"
+#include "imsym/opt/values_ops.hh"
+//
+#include <immer/algorithm.hpp>
+#include <immer/flex_vector.hpp>
+
+#include <cstdint>
+#include <optional>
+#include <stdexcept>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+/*
+ * structure sharing archive of a sequence of values_t snapshots
+ *
+ * Consecutive snapshots of a solve or a log share almost all of their nodes in memory. The archive
+ * keeps that sharing on disk: each snapshot is stored as a delta against the one before it, the map
+ * entries set or erased plus the runs of data either taken from the previous snapshot or from a
+ * pool holding the leaves new in it. The size of an archive scales with the volume of change, not
+ * with snapshots x problem size.
+ *
+ * restore() rebuilds the snapshots from the deltas, each on top of the previous one, so the
+ * restored snapshots share their unchanged nodes again.
+ * values_stream_writer_t and values_stream_reader_t do the same through a cereal stream, a
+ * snapshot at a time, holding only the previous snapshot on either side.
+ */
+
+namespace imsym::values {
+
+using std::move;
+
+/*
+ * a stretch of snapshot data
+ * leaf < 0 is the range [offset, offset + count) of the previous snapshot, otherwise the first
+ * count scalars of a leaf in the pool
+ */
+struct data_run_t {
+    int32_t leaf = -1;
+    int64_t offset = 0;
+    int64_t count = 0;
+};
+
+/*
+ * a snapshot, relative to the snapshot before it in the archive
+ */
+struct values_delta_t {
+    immer::flex_vector<index_entry_t> set;
+    immer::flex_vector<imsym::key::key_t> erased;
+    immer::flex_vector<data_run_t> data;
+    int32_t garbage = 0;
+    bool letter_index = false;
+    bool offset_index = false;
+};
+
+template<typename Scalar>
+struct values_archive_t {
+    // each distinct leaf of data, written once
+    immer::flex_vector<immer::flex_vector<Scalar>> leaves;
+    immer::flex_vector<values_delta_t> snapshots;
+};
+
+using values_archived_t = values_archive_t<double>;
+using values_archivef_t = values_archive_t<float>;
+
+namespace detail {
+
+/*
+ * turns each snapshot into a delta against the one pushed before it
+ *
+ * Leaves are recognized by their address, against the previous snapshot only. It is the one
+ * snapshot held on to, so its addresses can't be reused by a different leaf while they are looked
+ * up, and memory stays at one snapshot however many are pushed. A leaf only found further back is
+ * written again.
+ */
+template<typename Scalar>
+struct delta_writer_t {
+    using values_type = values_t<Scalar>;
+    using data_t = typename values_type::data_t;
+
+    struct chunk_t {
+        int64_t offset;
+        int64_t count;
+    };
+
+    struct leaf_t {
+        int32_t id;
+        int64_t count;
+    };
+
+    // the delta of values against the previous snapshot, new leaves are appended to leaves
+    auto push(const values_type& values, immer::flex_vector<data_t>& leaves) -> values_delta_t {
+        auto delta = values_delta_t{};
+        delta.garbage = values.garbage;
+        delta.letter_index = values.letter_index.has_value();
+        delta.offset_index = values.offset_index.has_value();
+
+        // map side, only what changed since the previous snapshot
+        auto set = move(delta.set).transient();
+        auto erased = move(delta.erased).transient();
+        immer::diff(
+            previous_.map,
+            values.map,
+            [&](const auto& kv) {
+                set.push_back(kv.second);
+            },
+            [&](const auto& kv) {
+                erased.push_back(kv.second.key);
+            },
+            [&](const auto&, const auto& kv) {
+                set.push_back(kv.second);
+            });
+        delta.set = move(set).persistent();
+        delta.erased = move(erased).persistent();
+
+        // data side, a walk over the leaves of the new data
+        auto runs = std::vector<data_run_t>{};
+        auto chunks = std::unordered_map<const Scalar*, chunk_t>{};
+        // leaves written for this snapshot, a leaf can show up twice after a concat
+        auto written = std::unordered_map<const Scalar*, leaf_t>{};
+        int64_t offset = 0;
+        const auto visit = [&](const Scalar* first, const Scalar* last) {
+            const auto count = static_cast<int64_t>(last - first);
+            chunks[first] = chunk_t{offset, count};
+            offset += count;
+
+            // in the previous snapshot, extend the run when it continues there too
+            const auto in_previous = previous_chunks_.find(first);
+            if (in_previous != previous_chunks_.end() and count <= in_previous->second.count) {
+                const auto source = in_previous->second.offset;
+                if (not runs.empty() and runs.back().leaf < 0 and
+                    runs.back().offset + runs.back().count == source) {
+                    runs.back().count += count;
+                } else {
+                    runs.push_back({.leaf = -1, .offset = source, .count = count});
+                }
+                return;
+            }
+
+            auto in_pool = written.find(first);
+            if (in_pool == written.end() or count > in_pool->second.count) {
+                const auto id = static_cast<int32_t>(leaves.size());
+                leaves = move(leaves).push_back(data_t(first, last));
+                in_pool = written.insert_or_assign(first, leaf_t{id, count}).first;
+            }
+            runs.push_back({.leaf = in_pool->second.id, .offset = 0, .count = count});
+        };
+        immer::for_each_chunk(values.data.begin(), values.data.end(), visit);
+        delta.data = immer::flex_vector<data_run_t>(runs.begin(), runs.end());
+
+        previous_ = values;
+        previous_chunks_ = move(chunks);
+        return delta;
+    }
+
+   private:
+    values_type previous_{};
+    std::unordered_map<const Scalar*, chunk_t> previous_chunks_{};
+};
+
+}   // namespace detail
+
+/*
+ * builds an archive one snapshot at a time, eg. from an optimizer callback
+ * besides the archive itself it holds on to the last snapshot pushed, see detail::delta_writer_t
+ */
+template<typename Scalar>
+struct values_archive_writer_t {
+    using values_type = values_t<Scalar>;
+
+    values_archive_t<Scalar> archive;
+
+    auto push(const values_type& values) -> values_archive_writer_t& {
+        auto delta = writer_.push(values, archive.leaves);
+        archive.snapshots = move(archive.snapshots).push_back(move(delta));
+        return *this;
+    };
+
+   private:
+    detail::delta_writer_t<Scalar> writer_{};
+};
+
+/*
+ * writes snapshots to a cereal archive as they are pushed, nothing but the last snapshot is kept
+ *
+ * Each snapshot goes out as a frame, a values_archive_t holding its one delta and the leaves that
+ * are new in it. finish() writes an empty frame to mark the end, values_stream_reader_t reads the
+ * frames back one at a time.
+ */
+template<typename Scalar, typename OutputArchive>
+class values_stream_writer_t {
+   public:
+    explicit values_stream_writer_t(OutputArchive& out) : out_(out){};
+
+    auto push(const values_t<Scalar>& values) -> values_stream_writer_t& {
+        auto frame = values_archive_t<Scalar>{};
+        auto delta = writer_.push(values, frame.leaves);
+        frame.snapshots = move(frame.snapshots).push_back(move(delta));
+        out_(frame);
+        return *this;
+    };
+
+    auto finish() -> void {
+        out_(values_archive_t<Scalar>{});
+    };
+
+   private:
+    OutputArchive& out_;
+    detail::delta_writer_t<Scalar> writer_{};
+};
+
+/*
+ * archive a sequence of snapshots, see values_archive_writer_t
+ */
+template<typename Container,
+         typename Scalar = typename Container::value_type::data_t::value_type>
+inline auto persist(const Container& snapshots) -> values_archive_t<Scalar> {
+    auto writer = values_archive_writer_t<Scalar>{};
+    for (const auto& values : snapshots) {
+        writer.push(values);
+    }
+    return move(writer.archive);
+}
+
+/*
+ * rebuild one snapshot on top of the one before it in the archive
+ */
+template<typename Scalar>
+inline auto restore(const values_archive_t<Scalar>& archive,
+                    const values_delta_t& delta,
+                    const values_t<Scalar>& previous) -> values_t<Scalar> {
+    auto values = values_t<Scalar>{};
+
+    auto map = previous.map.transient();
+    for (const auto& k : delta.erased) {
+        map.erase(k);
+    }
+    for (const auto& entry : delta.set) {
+        map.set(entry.key, entry);
+    }
+    values.map = move(map).persistent();
+
+    // runs of the previous snapshot are taken from it, so its nodes are shared
+    for (const auto& run : delta.data) {
+        const auto& source = run.leaf < 0 ? previous.data : archive.leaves[run.leaf];
+        if (run.offset == 0 and run.count == static_cast<int64_t>(source.size())) {
+            values.data = move(values.data) + source;
+        } else {
+            values.data = move(values.data) + source.drop(run.offset).take(run.count);
+        }
+    }
+
+    values.garbage = delta.garbage;
+    if (delta.letter_index and previous.letter_index) {
+        auto index = *previous.letter_index;
+        for (const auto& k : delta.erased) {
+            index = imsym::key::erase(move(index), k);
+        }
+        for (const auto& entry : delta.set) {
+            index = imsym::key::insert(move(index), entry.key);
+        }
+        values.letter_index = move(index);
+    } else if (delta.letter_index) {
+        values = with_letter_index(move(values));
+    }
+    if (delta.offset_index and previous.offset_index) {
+        auto index = *previous.offset_index;
+        for (const auto& k : delta.erased) {
+            index = values::erase(move(index), k, previous.map.at(k).offset);
+        }
+        for (const auto& entry : delta.set) {
+            if (const auto* before = previous.map.find(entry.key)) {
+                index = values::erase(move(index), entry.key, before->offset);
+            }
+            index = values::insert(move(index), entry.key, entry.offset);
+        }
+        values.offset_index = move(index);
+    } else if (delta.offset_index) {
+        values = with_offset_index(move(values));
+    }
+    return values;
+}
+
+template<typename Scalar>
+inline auto restore(const values_archive_t<Scalar>& archive) -> std::vector<values_t<Scalar>> {
+    auto out = std::vector<values_t<Scalar>>{};
+    out.reserve(archive.snapshots.size());
+    auto previous = values_t<Scalar>{};
+    for (const auto& delta : archive.snapshots) {
+        previous = restore(archive, delta, previous);
+        out.push_back(previous);
+    }
+    return out;
+}
+
+/*
+ * reads back what a values_stream_writer_t wrote, a snapshot per next()
+ * each is rebuilt on top of the one before it, which is the only one kept
+ */
+template<typename Scalar, typename InputArchive>
+class values_stream_reader_t {
+   public:
+    explicit values_stream_reader_t(InputArchive& in) : in_(in){};
+
+    // the next snapshot, empty at the end of the stream
+    auto next() -> std::optional<values_t<Scalar>> {
+        if (done_) {
+            return {};
+        }
+        auto frame = values_archive_t<Scalar>{};
+        in_(frame);
+        if (frame.snapshots.empty()) {
+            done_ = true;
+            return {};
+        }
+        if (frame.snapshots.size() != 1) {
+            throw std::runtime_error("values_stream_reader_t: a frame holds a single snapshot.");
+        }
+        previous_ = restore(frame, frame.snapshots.front(), previous_);
+        return previous_;
+    };
+
+   private:
+    InputArchive& in_;
+    values_t<Scalar> previous_{};
+    bool done_ = false;
+};
+
+}   // namespace imsym::values
+
+namespace cereal {
+
+template<class Archive>
+void save(Archive& archive, const imsym::values::data_run_t& run) {
+    archive(run.leaf, run.offset, run.count);
+}
+
+template<class Archive>
+void load(Archive& archive, imsym::values::data_run_t& run) {
+    archive(run.leaf, run.offset, run.count);
+}
+
+template<class Archive>
+void save(Archive& archive, const imsym::values::values_delta_t& delta) {
+    archive(delta.set,
+            delta.erased,
+            delta.data,
+            delta.garbage,
+            delta.letter_index,
+            delta.offset_index);
+}
+
+template<class Archive>
+void load(Archive& archive, imsym::values::values_delta_t& delta) {
+    archive(delta.set,
+            delta.erased,
+            delta.data,
+            delta.garbage,
+            delta.letter_index,
+            delta.offset_index);
+}
+
+template<class Archive, typename Scalar>
+void save(Archive& archive, const imsym::values::values_archive_t<Scalar>& values_archive) {
+    archive(values_archive.leaves, values_archive.snapshots);
+}
+
+template<class Archive, typename Scalar>
+void load(Archive& archive, imsym::values::values_archive_t<Scalar>& values_archive) {
+    archive(values_archive.leaves, values_archive.snapshots);
+}
+
+}   // namespace cereal
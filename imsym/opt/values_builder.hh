@@ -0,0 +1,140 @@
+/* Copyright (C) Basemap, Inc DBA Automaton  All Rights Reserved
+ * Unauthorized copying of this file, via any medium is strictly prohibited
+ * Proprietary and confidential
+ * Written by Asa Hammond <asa@automaton.is>, 2021
+ */
+
+#pragma once
+#include "imsym/opt/key.hh"
+#include "imsym/opt/values.hh"
+//
+#include <immer/flex_vector_transient.hpp>
+#include <immer/map_transient.hpp>
+
+#include <array>
+#include <optional>
+
+namespace imsym::values {
+
+using std::move;
+
+/*
+ * transient companion of values_t for batches of edits
+ *
+ * set / update / remove mutate the transient map and data in place, finalize() hands back a single
+ * persistent values_t. Each edit on a values_t directly creates a new root and copies a path per
+ * scalar written, the builder only copies nodes it doesn't already own.
+ *
+ * A builder is single threaded, and must not be used after finalize().
+ */
+template<typename Scalar, typename MemoryPolicy = immer::default_memory_policy>
+struct values_builder_t {
+    using values_type = values_t<Scalar, MemoryPolicy>;
+    using map_transient_t = typename values_type::map_t::transient_type;
+    using data_transient_t = typename values_type::data_t::transient_type;
+
+    map_transient_t map;
+    data_transient_t data;
+    int32_t garbage = 0;
+    std::optional<imsym::key::letter_index_t> letter_index{};
+    std::optional<offset_index_t> offset_index{};
+
+    values_builder_t(){};
+
+    // start from an existing values, taking ownership of its nodes when it is the only owner
+    explicit values_builder_t(values_type values)
+        : map(move(values.map).transient())
+        , data(move(values.data).transient())
+        , garbage(values.garbage)
+        , letter_index(move(values.letter_index))
+        , offset_index(move(values.offset_index)){};
+
+    /*
+     * a la values::set
+     * if the key exists the entry's data is overwritten in place, otherwise the storage is appended
+     */
+    template<typename T>
+    auto set(const imsym::key::key_t& key, const T& value) -> values_builder_t& {
+        static_assert(std::is_same<Scalar, typename sym::StorageOps<T>::Scalar>::value,
+                      "Calling Values.Set on mismatched scalar type.");
+
+        constexpr int32_t storage_dim = sym::StorageOps<T>::StorageDim();
+        const auto type = sym::StorageOps<T>::TypeEnum();
+
+        std::array<Scalar, storage_dim> storage;
+        sym::StorageOps<T>::ToStorage(value, storage.data());
+
+        const auto* existing = map.find(key);
+        if (existing == nullptr) {
+            auto entry = values::index_entry_t{};
+            entry.key = key;
+            entry.type = type;
+            entry.offset = static_cast<int32_t>(data.size());
+            entry.storage_dim = storage_dim;
+            entry.tangent_dim = sym::LieGroupOps<T>::TangentDim();
+
+            for (const auto& v : storage) {
+                data.push_back(v);
+            }
+            map.set(key, entry);
+            if (letter_index) {
+                letter_index = imsym::key::insert(move(*letter_index), key);
+            }
+            if (offset_index) {
+                offset_index = values::insert(move(*offset_index), key, entry.offset);
+            }
+            return *this;
+        }
+
+        if (existing->type != type) {
+            // TODO make monadic with expected{}
+            throw std::runtime_error("Calling Set on the wrong value type.");
+        }
+
+        const auto offset = existing->offset;
+        for (int32_t i = 0; i < storage_dim; i++) {
+            data.set(offset + i, storage[i]);
+        }
+        return *this;
+    };
+
+    // only update an existing key, and keep its same type. returns true if the key was written
+    template<typename T>
+    auto update(const imsym::key::key_t& key, const T& value) -> bool {
+        const auto* existing = map.find(key);
+        if (existing == nullptr or existing->type != sym::StorageOps<T>::TypeEnum()) {
+            return false;
+        }
+        set(key, value);
+        return true;
+    };
+
+    // leaves the data alone, a la values::remove. returns true if the key was present
+    auto remove(const imsym::key::key_t& key) -> bool {
+        const auto* existing = map.find(key);
+        if (existing == nullptr) {
+            return false;
+        }
+        garbage += existing->storage_dim;
+        if (offset_index) {
+            offset_index = values::erase(move(*offset_index), key, existing->offset);
+        }
+        map.erase(key);
+        if (letter_index) {
+            letter_index = imsym::key::erase(move(*letter_index), key);
+        }
+        return true;
+    };
+
+    auto finalize() && -> values_type {
+        auto values = values_type{};
+        values.map = move(map).persistent();
+        values.data = move(data).persistent();
+        values.garbage = garbage;
+        values.letter_index = move(letter_index);
+        values.offset_index = move(offset_index);
+        return values;
+    };
+};
+
+}   // namespace imsym::values
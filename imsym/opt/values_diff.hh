@@ -0,0 +1,201 @@
+/* Copyright (C) Basemap, Inc DBA Automaton  All Rights Reserved
+ * Unauthorized copying of this file, via any medium is strictly prohibited
+ * Proprietary and confidential
+ * Written by Asa Hammond <asa@automaton.is>, 2021
+ */
+
+#pragma once
+#include "imsym/opt/chunks.hh"
+#include "imsym/opt/key.hh"
+#include "imsym/opt/offset_index.hh"
+#include "imsym/opt/values.hh"
+//
+#include <immer/algorithm.hpp>
+#include <immer/flex_vector.hpp>
+
+#include <algorithm>
+#include <cstdint>
+#include <type_traits>
+#include <unordered_set>
+#include <utility>
+#include <vector>
+
+namespace imsym::values {
+
+/*
+ * keys which differ between two values_t
+ */
+struct values_diff_t {
+    immer::flex_vector<imsym::key::key_t> added;
+    immer::flex_vector<imsym::key::key_t> removed;
+    immer::flex_vector<imsym::key::key_t> changed;
+};
+
+namespace detail {
+
+template<typename Scalar, typename AddedFn, typename RemovedFn, typename ChangedFn, typename Eq>
+inline auto diff(const values_t<Scalar>& a,
+                 const values_t<Scalar>& b,
+                 AddedFn&& added,
+                 RemovedFn&& removed,
+                 ChangedFn&& changed,
+                 Eq&& eq) -> void {
+    const auto values_equal = [&](const index_entry_t& entry_a, const index_entry_t& entry_b) {
+        return entry_a.type == entry_b.type and entry_a.storage_dim == entry_b.storage_dim and
+               ranges_equal(
+                   a.data, entry_a.offset, b.data, entry_b.offset, entry_a.storage_dim, eq);
+    };
+
+    // the map diff skips subtrees shared by both versions
+    // an entry can change without its value changing, eg. moved by compact()
+    auto moved = std::unordered_set<imsym::key::key_t, imsym::key::hash_t>{};
+    immer::diff(
+        a.map,
+        b.map,
+        [&](const auto& kv) {
+            added(kv.second);
+        },
+        [&](const auto& kv) {
+            removed(kv.second);
+        },
+        [&](const auto& kv_a, const auto& kv_b) {
+            moved.insert(kv_b.second.key);
+            if (not values_equal(kv_a.second, kv_b.second)) {
+                changed(kv_a.second, kv_b.second);
+            }
+        });
+
+    // entries which are the same on both sides can still have new data under them
+    // collect the stretches of data that differ, leaves shared by both sides are skipped
+    std::vector<std::pair<size_t, size_t>> dirty;
+    const auto collect_dirty = [&](const size_t offset, const Scalar* first, const Scalar* last) {
+        const auto count = static_cast<size_t>(last - first);
+        if (range_equal(a.data, offset, first, count, eq)) {
+            return;
+        }
+        if (not dirty.empty() and dirty.back().second == offset) {
+            dirty.back().second += count;
+            return;
+        }
+        dirty.push_back({offset, offset + count});
+    };
+    for_each_unshared_chunk(a.data, b.data, collect_dirty);
+
+    if (dirty.empty()) {
+        return;
+    }
+
+    const auto check = [&](const imsym::key::key_t& k, const index_entry_t& entry_b) {
+        if (moved.count(k)) {
+            return;
+        }
+        const auto* entry_a = a.map.find(k);
+        if (entry_a != nullptr and not values_equal(*entry_a, entry_b)) {
+            changed(*entry_a, entry_b);
+        }
+    };
+
+    // with an offset index only the entries under the dirty ranges are looked at
+    if (b.offset_index) {
+        // an entry spanning two ranges comes up twice, the index is in offset order
+        int32_t last_checked = -1;
+        for (const auto& [begin, end] : dirty) {
+            const auto under = overlapping(
+                *b.offset_index, static_cast<int32_t>(begin), static_cast<int32_t>(end));
+            for (const auto& [offset, k] : under) {
+                const auto& entry_b = b.map.at(k);
+                if (offset <= last_checked or
+                    static_cast<size_t>(offset + entry_b.storage_dim) <= begin) {
+                    continue;
+                }
+                last_checked = offset;
+                check(k, entry_b);
+            }
+        }
+        return;
+    }
+
+    // otherwise every entry of b is tested against the dirty ranges
+    const auto touches_dirty = [&](const index_entry_t& entry) {
+        const size_t begin = entry.offset;
+        const size_t end = begin + entry.storage_dim;
+        auto it = std::lower_bound(
+            dirty.begin(), dirty.end(), begin, [](const auto& range, const size_t offset) {
+                return range.second <= offset;
+            });
+        return it != dirty.end() and it->first < end;
+    };
+    for (const auto& [k, entry_b] : b.map) {
+        if (touches_dirty(entry_b)) {
+            check(entry_b.key, entry_b);
+        }
+    }
+}
+
+template<typename Scalar, typename Eq>
+inline auto collect_diff(const values_t<Scalar>& a, const values_t<Scalar>& b, Eq&& eq)
+    -> values_diff_t {
+    auto out = values_diff_t{};
+    detail::diff(
+        a,
+        b,
+        [&](const index_entry_t& e) {
+            out.added = std::move(out.added).push_back(e.key);
+        },
+        [&](const index_entry_t& e) {
+            out.removed = std::move(out.removed).push_back(e.key);
+        },
+        [&](const index_entry_t&, const index_entry_t& e) {
+            out.changed = std::move(out.changed).push_back(e.key);
+        },
+        eq);
+    return out;
+}
+
+}   // namespace detail
+
+/*
+ * structural diff of two values_t
+ *
+ * added(entry_b), removed(entry_a) and changed(entry_a, entry_b) are called per key. A key is
+ * changed when its value differs, a new offset for the same value doesn't count.
+ *
+ * The map side comes from immer::diff, which skips subtrees shared between the versions. On the
+ * data side subtrees and leaves shared between the versions are skipped by pointer, only leaves
+ * which were rewritten are compared. With an offset index on b, see with_offset_index, the entries
+ * under those leaves are found through it and the whole diff is proportional to the changes,
+ * otherwise every entry of b is tested against the rewritten ranges.
+ */
+template<typename Scalar, typename AddedFn, typename RemovedFn, typename ChangedFn>
+inline auto diff(const values_t<Scalar>& a,
+                 const values_t<Scalar>& b,
+                 AddedFn&& added,
+                 RemovedFn&& removed,
+                 ChangedFn&& changed) -> void {
+    detail::diff(a, b, added, removed, changed, exact_equal_t{});
+}
+
+// as above, values within tolerance of each other are considered the same
+template<typename Scalar, typename AddedFn, typename RemovedFn, typename ChangedFn>
+inline auto diff(const values_t<Scalar>& a,
+                 const values_t<Scalar>& b,
+                 AddedFn&& added,
+                 RemovedFn&& removed,
+                 ChangedFn&& changed,
+                 const std::type_identity_t<Scalar> tolerance) -> void {
+    detail::diff(a, b, added, removed, changed, within_t<Scalar>{tolerance});
+}
+
+template<typename Scalar>
+inline auto diff(const values_t<Scalar>& a, const values_t<Scalar>& b) -> values_diff_t {
+    return detail::collect_diff(a, b, exact_equal_t{});
+}
+
+template<typename Scalar>
+inline auto diff(const values_t<Scalar>& a,
+                 const values_t<Scalar>& b,
+                 const std::type_identity_t<Scalar> tolerance) -> values_diff_t {
+    return detail::collect_diff(a, b, within_t<Scalar>{tolerance});
+}
+
+}   // namespace imsym::values
@@ -12,22 +12,47 @@
 #include "common/struct.hh"
 #include "common/variant/match.hh"
 //
+#include "imsym/opt/chunks.hh"
 #include "imsym/opt/values.hh"
+#include "imsym/opt/values_builder.hh"
 //
+#include <immer/algorithm.hpp>
 #include <immer/flex_vector.hpp>
+#include <immer/flex_vector_transient.hpp>
 #include <immer/map.hpp>
 #include <immer/vector.hpp>
 
+#include <algorithm>
+#include <array>
+#include <cassert>
+#include <cstddef>
+#include <optional>
+#include <span>
+#include <stdexcept>
+#include <type_traits>
+#include <utility>
 #include <vector>
 
 namespace imsym::values {
 
 using std::move;
 
-template<typename Scalar>
-inline auto remove(values_t<Scalar> values, imsym::key::key_t key) -> values_t<Scalar> {
+template<typename Scalar, typename MemoryPolicy>
+inline auto remove(values_t<Scalar, MemoryPolicy> values, imsym::key::key_t key)
+    -> values_t<Scalar, MemoryPolicy> {
+    const auto* entry = values.map.find(key);
+    if (entry == nullptr) {
+        return values;
+    }
+    values.garbage += entry->storage_dim;
+    if (values.offset_index) {
+        values.offset_index = values::erase(move(*values.offset_index), key, entry->offset);
+    }
     values.map = move(values.map).erase(key);
-    // leave data alone, it can be cleaned up manually later with the Cleanup() method
+    if (values.letter_index) {
+        values.letter_index = imsym::key::erase(move(*values.letter_index), key);
+    }
+    // leave data alone, it can be cleaned up manually later with the cleanup() method
     return values;
 };
 
@@ -45,8 +70,8 @@ inline auto remove(values_t<Scalar> values, imsym::key::key_t key) -> values_t<S
  * only thing that needs to get updated after repacking.
  */
 
-template<typename Scalar>
-inline auto create_index(const values_t<Scalar>& values,
+template<typename Scalar, typename MemoryPolicy>
+inline auto create_index(const values_t<Scalar, MemoryPolicy>& values,
                          const immer::vector<imsym::key::key_t>& keys) -> index_t {
     index_t index{.storage_dim = 0, .tangent_dim = 0};
 
@@ -70,37 +95,118 @@ inline auto create_index(const values_t<Scalar>& values,
 // ----------------------------------------------------------------------------
 // Public Methods
 // ----------------------------------------------------------------------------
-template<typename Scalar>
-auto has(const values_t<Scalar>& values, const key::key_t& key) -> bool {
+template<typename Scalar, typename MemoryPolicy>
+auto has(const values_t<Scalar, MemoryPolicy>& values, const key::key_t& key) -> bool {
     return values.map.count(key);
 }
 
-template<typename Scalar>
-auto keys_with_letter(const values_t<Scalar>& values, const key::key_t::letter_t& letter)
-    -> immer::flex_vector<key::key_t> {
+/*
+ * build the per letter secondary index of the keys, from here on ops that add or remove keys
+ * maintain it and the letter queries below become O(log n)
+ */
+template<typename Scalar, typename MemoryPolicy>
+inline auto with_letter_index(values_t<Scalar, MemoryPolicy> values)
+    -> values_t<Scalar, MemoryPolicy> {
+    auto index = key::letter_index_t{};
+    for (const auto& [k, v] : values.map) {
+        index = imsym::key::insert(move(index), v.key);
+    }
+    values.letter_index = move(index);
+    return values;
+}
+
+/*
+ * build the secondary index of the keys by data offset, from here on ops that add, remove or move
+ * entries maintain it and diff only looks at the entries under data that changed
+ */
+template<typename Scalar, typename MemoryPolicy>
+inline auto with_offset_index(values_t<Scalar, MemoryPolicy> values)
+    -> values_t<Scalar, MemoryPolicy> {
+    auto entries = std::vector<offset_index_t::entry_t>{};
+    entries.reserve(values.map.size());
+    for (const auto& [k, v] : values.map) {
+        entries.push_back({v.offset, v.key});
+    }
+    std::sort(entries.begin(), entries.end(), [](const auto& a, const auto& b) {
+        return a.first < b.first;
+    });
+    values.offset_index =
+        offset_index_t{.entries = offset_index_t::entries_t(entries.begin(), entries.end())};
+    return values;
+}
+
+template<typename Scalar, typename MemoryPolicy>
+auto keys_with_letter(const values_t<Scalar, MemoryPolicy>& values,
+                      const key::key_t::letter_t& letter) -> immer::flex_vector<key::key_t> {
     immer::flex_vector<key::key_t> out{};
 
+    if (values.letter_index) {
+        for (const auto& [sub, super] : key::entries(*values.letter_index, letter)) {
+            out = move(out).push_back(key::key_t{.letter = letter, .sub = sub, .super = super});
+        }
+        return out;
+    }
+
     for (const auto& [k, v] : values.map) {
-        if (k.letter == letter) {
-            out = move(out).push_back(k);
+        if (v.key.letter == letter) {
+            out = move(out).push_back(v.key);
         }
     }
     return out;
 }
 
-template<typename Scalar>
-auto find_letter_sub(const values_t<Scalar>& values, const key::key_t& key)
+/*
+ * keys with letter and sub in [sub_begin, sub_end), in (sub, super) order
+ */
+template<typename Scalar, typename MemoryPolicy>
+auto keys_with_letter(const values_t<Scalar, MemoryPolicy>& values,
+                      const key::key_t::letter_t& letter,
+                      const key::key_t::subscript_t sub_begin,
+                      const key::key_t::subscript_t sub_end) -> immer::flex_vector<key::key_t> {
+    immer::flex_vector<key::key_t> out{};
+
+    if (values.letter_index) {
+        for (const auto& [sub, super] :
+             key::range(*values.letter_index, letter, sub_begin, sub_end)) {
+            out = move(out).push_back(key::key_t{.letter = letter, .sub = sub, .super = super});
+        }
+        return out;
+    }
+
+    std::vector<key::key_t> found;
+    for (const auto& [k, v] : values.map) {
+        if (v.key.letter == letter and v.key.sub >= sub_begin and v.key.sub < sub_end) {
+            found.push_back(v.key);
+        }
+    }
+    std::sort(found.begin(), found.end(), [](const auto& a, const auto& b) {
+        return std::pair{a.sub, a.super} < std::pair{b.sub, b.super};
+    });
+    for (const auto& k : found) {
+        out = move(out).push_back(k);
+    }
+    return out;
+}
+
+template<typename Scalar, typename MemoryPolicy>
+auto find_letter_sub(const values_t<Scalar, MemoryPolicy>& values, const key::key_t& key)
     -> std::optional<key::key_t> {
+    if (values.letter_index) {
+        return key::find_letter_sub(*values.letter_index, key);
+    }
     for (const auto& [k, v] : values.map) {
-        if (k.letter == key.letter and k.sub == key.sub) {
-            return k;
+        if (v.key.letter == key.letter and v.key.sub == key.sub) {
+            return v.key;
         }
     }
     return {};
 }
 
-template<typename Scalar>
-inline auto get_largest_sub(const values_t<Scalar>& values, char letter) {
+template<typename Scalar, typename MemoryPolicy>
+inline auto get_largest_sub(const values_t<Scalar, MemoryPolicy>& values, char letter) {
+    if (values.letter_index) {
+        return key::largest_sub(*values.letter_index, letter);
+    }
     key::key_t::subscript_t largest = key::key_t::kInvalidSub;
     for (const auto& k : keys_with_letter(values, letter)) {
         largest = std::max(largest, k.sub);
@@ -108,18 +214,60 @@ inline auto get_largest_sub(const values_t<Scalar>& values, char letter) {
     return largest;
 };
 
-template<typename Scalar>
-inline auto get_largest_super(const values_t<Scalar>& values, char letter) {
+template<typename Scalar, typename MemoryPolicy>
+inline auto get_largest_super(const values_t<Scalar, MemoryPolicy>& values, char letter) {
+    if (values.letter_index) {
+        return key::largest_super(*values.letter_index, letter);
+    }
     key::key_t::superscript_t largest = key::key_t::kInvalidSuper;
     for (const auto& k : keys_with_letter(values, letter)) {
         largest = std::max(largest, k.super);
     }
     return largest;
 };
-// need a storageOps that can read immer::vector
 
-template<typename Scalar, typename T>
-auto at(const values_t<Scalar>& values, const index_entry_t& entry) -> T {
+/*
+ * hand the storage for [offset, offset + StorageDim) of data to fn without allocating
+ * if the range lives inside a single leaf, fn gets a pointer straight into the leaf,
+ * otherwise the chunks are gathered into a stack buffer
+ */
+template<int32_t StorageDim, typename Data, typename Fn>
+inline auto with_storage(const Data& data, const int32_t offset, Fn&& fn) {
+    using Scalar = typename Data::value_type;
+
+    const Scalar* direct = nullptr;
+    std::array<Scalar, StorageDim> buffer;
+    size_t filled = 0;
+
+    const auto first = data.begin() + offset;
+    immer::for_each_chunk(first, first + StorageDim, [&](const Scalar* begin, const Scalar* end) {
+        if (filled == 0 and end - begin == StorageDim) {
+            direct = begin;
+            return;
+        }
+        filled = std::copy(begin, end, buffer.begin() + filled) - buffer.begin();
+    });
+
+    return fn(direct != nullptr ? direct : buffer.data());
+}
+
+/*
+ * copy [offset, offset + dim) of data into out, a chunk at a time
+ */
+template<typename Data>
+inline auto copy_storage(const Data& data,
+                         const int32_t offset,
+                         const int32_t dim,
+                         typename Data::value_type* out) -> void {
+    using Scalar = typename Data::value_type;
+    const auto first = data.begin() + offset;
+    immer::for_each_chunk(first, first + dim, [&](const Scalar* begin, const Scalar* end) {
+        out = std::copy(begin, end, out);
+    });
+}
+
+template<typename Scalar, typename T, typename MemoryPolicy>
+auto at(const values_t<Scalar, MemoryPolicy>& values, const index_entry_t& entry) -> T {
     // Check the type
     const sym::type_t type = sym::StorageOps<T>::TypeEnum();
 
@@ -128,24 +276,25 @@ auto at(const values_t<Scalar>& values, const index_entry_t& entry) -> T {
         // fmt::format("Mismatched types; index entry is type {}, T is {}", entry.type, type));
     }
 
-    auto slice = values.data.drop(entry.offset).take(entry.storage_dim);
-    if (slice.size() < entry.storage_dim) {
+    constexpr int32_t storage_dim = sym::StorageOps<T>::StorageDim();
+    if (entry.storage_dim != storage_dim or
+        entry.offset + storage_dim > static_cast<int32_t>(values.data.size())) {
         // TODO really don't want this to throw
         throw std::runtime_error("not enough data to load data");
         // fmt::format("not enough data {} {} to load data", slice.size(), entry.storage_dim));
     }
 
-    // slice off the bit of entry
-    const auto data = common::immer::to_std(slice);
-    // Construct the object
-    return sym::StorageOps<T>::FromStorage(data.data());
+    // Construct the object straight from the leaf, or from a stack copy if it straddles leaves
+    return with_storage<storage_dim>(values.data, entry.offset, [](const Scalar* storage) {
+        return sym::StorageOps<T>::FromStorage(storage);
+    });
 }
 
-template<typename Scalar, typename T>
-auto at(const values_t<Scalar>& values, const key::key_t& key) -> T {
+template<typename Scalar, typename T, typename MemoryPolicy>
+auto at(const values_t<Scalar, MemoryPolicy>& values, const key::key_t& key) -> T {
     auto entry = values.map.at(key);
     // TODO handle failure
-    return at<T>(values, entry);
+    return at<Scalar, T>(values, entry);
 }
 
 template<typename T>
@@ -169,9 +318,10 @@ auto at(const valuesf_t& values, const key::key_t& key) -> T {
 }
 
 /*
-template<typename Scalar, typename T>
-inline auto at_or(const values_t<Scalar>& values, const key::key_t& key, const T& default_value)
-    -> T {
+template<typename Scalar, typename T, typename MemoryPolicy>
+inline auto at_or(const values_t<Scalar, MemoryPolicy>& values,
+                  const key::key_t& key,
+                  const T& default_value) -> T {
     if (not has(values, key)) {
         return default_value;
     }
@@ -218,21 +368,21 @@ auto at_or(const values_t<float>& values,
     return at<float, T>(values, key);
 }
 
-template<typename Scalar>
-inline auto keys(const values_t<Scalar>& values) {
-    return keys<Scalar>(values.map);
+template<typename Scalar, typename MemoryPolicy>
+inline auto keys(const values_t<Scalar, MemoryPolicy>& values) {
+    return keys<Scalar, MemoryPolicy>(values.map);
 };
 
-template<typename Scalar>
-inline auto keys(typename values_t<Scalar>::map_t map, const bool sort_by_offset = true)
-    -> immer::vector<imsym::key::key_t> {
+template<typename Scalar, typename MemoryPolicy = immer::default_memory_policy>
+inline auto keys(typename values_t<Scalar, MemoryPolicy>::map_t map,
+                 const bool sort_by_offset = true) -> immer::vector<imsym::key::key_t> {
     // Sort the keys by offset so iterating through is saner and more memory friendly
     if (sort_by_offset) {
         std::vector<imsym::key::key_t> keys;
         keys.reserve(map.size());
 
         for (const auto& [k, v] : map) {
-            keys.push_back(k);
+            keys.push_back(v.key);
         }
         std::sort(keys.begin(), keys.end(), [&](const auto& a, const auto& b) {
             return map.at(a).offset < map.at(b).offset;
@@ -242,17 +392,17 @@ inline auto keys(typename values_t<Scalar>::map_t map, const bool sort_by_offset
 
     immer::vector<imsym::key::key_t> keys;
     for (const auto& [k, v] : map) {
-        keys = move(keys).push_back(k);
+        keys = move(keys).push_back(v.key);
     }
     return keys;
 };
 
-template<typename Scalar, typename T>
-auto at(const values_t<Scalar>& values, const immer::flex_vector<key::key_t>& keys)
+template<typename Scalar, typename T, typename MemoryPolicy>
+auto at(const values_t<Scalar, MemoryPolicy>& values, const immer::flex_vector<key::key_t>& keys)
     -> immer::flex_vector<T> {
     auto out = immer::flex_vector<T>{};
     for (const auto& key : keys) {
-        out = move(out).push_back(at<T>(values, key));
+        out = move(out).push_back(at<Scalar, T>(values, key));
     }
     return out;
 }
@@ -270,110 +420,301 @@ auto at(const valuesd_t& values, const immer::flex_vector<key::key_t>& keys)
 }
 
 /**
- * Repack the data array to get rid of empty space from removed keys. If regularly removing
- * keys, it's up to the user to call this appropriately to avoid storage growth. Returns the
- * number of Scalar elements cleaned up from the data array.
+ * Repack the data array to get rid of empty space from removed keys.
+ *
+ * Live entries are walked in data order and coalesced into runs that are adjacent in the old data,
+ * the new data is the concatenation of one take/drop slice per run. This costs
+ * O(live runs * log n) on the data instead of touching every scalar, and only the map entries which
+ * actually move are rewritten.
  *
  * It will INVALIDATE all indices, offset increments, and pointers.
- * Re-create an index with CreateIndex().
+ * Re-create an index with create_index().
  */
-template<typename Scalar>
-inline auto cleanup(values_t<Scalar> values) -> std::pair<decltype(values), size_t> {
-    // Copy the original data
-    const auto data_copy = values.data;
-
-    // Build an index of all keys
-    const auto full_index = create_index(values, keys<Scalar>(values));
-
-    // initialize all the data
-    values.data = immer::vector<Scalar>(full_index.storage_dim, Scalar{});
+template<typename Scalar, typename MemoryPolicy>
+inline auto compact(values_t<Scalar, MemoryPolicy> values) -> values_t<Scalar, MemoryPolicy> {
+    std::vector<index_entry_t> entries;
+    entries.reserve(values.map.size());
+    for (const auto& [k, entry] : values.map) {
+        entries.push_back(entry);
+    }
+    std::sort(entries.begin(), entries.end(), [](const auto& a, const auto& b) {
+        return a.offset < b.offset;
+    });
 
-    assert(data_copy.size() >= values.data.size());
+    auto data = typename values_t<Scalar, MemoryPolicy>::data_t{};
+    auto map = move(values.map).transient();
+    // entries are visited in offset order, so the new offset index is built by appending
+    auto offsets = offset_index_t::entries_t{}.transient();
 
-    // Copy into new data and update the offset in the map
     int32_t new_offset = 0;
-    for (index_entry_t entry : full_index.entries) {
-        // copy data over
-        for (int i = entry.offset, j = new_offset; i < (entry.offset + entry.storage_dim);
-             i++, j++) {
-            values.data = move(values.data).set(j, data_copy.at(i));
+    for (size_t i = 0; i < entries.size();) {
+        const int32_t run_start = entries[i].offset;
+        int32_t run_end = run_start;
+
+        for (; i < entries.size() and entries[i].offset == run_end; i++) {
+            auto entry = entries[i];
+            run_end += entry.storage_dim;
+
+            const auto offset = new_offset + (entry.offset - run_start);
+            if (entry.offset != offset) {
+                entry.offset = offset;
+                map.set(entry.key, entry);
+            }
+            if (values.offset_index) {
+                offsets.push_back({offset, entry.key});
+            }
         }
-        // TODO, take advantage of the fact that we are using a flex vector. we can just drop the
-        // unused / deleted values in data
 
-        entry.offset = new_offset;
-        values.map = move(values.map).set(entry.key, entry);
+        data = move(data) + values.data.drop(run_start).take(run_end - run_start);
+        new_offset += run_end - run_start;
+    }
 
-        new_offset += entry.storage_dim;
+    values.map = move(map).persistent();
+    values.data = move(data);
+    values.garbage = 0;
+    if (values.offset_index) {
+        values.offset_index = offset_index_t{.entries = move(offsets).persistent()};
     }
-    return std::pair<decltype(values), size_t>{values, data_copy.size() - values.data.size()};
+    return values;
 };
 
-template<typename Scalar>
-inline auto merge(const values_t<Scalar>& a, const values_t<Scalar>& b) -> values_t<Scalar> {
-    auto out = a;
-    for (const auto& [k, v] : b.map) {
-        auto v_out = v;
-        // UPDATE THE POSITION OF THE ENTRY by length of a.data
-        // we are appending all the data from b to a
-        v_out.offset += a.data.size();
-        out.map = move(out.map).set(k, v_out);
+/**
+ * Repack the data array to get rid of empty space from removed keys. Returns the number of Scalar
+ * elements cleaned up from the data array.
+ *
+ * It will INVALIDATE all indices, offset increments, and pointers.
+ * Re-create an index with create_index().
+ */
+template<typename Scalar, typename MemoryPolicy>
+inline auto cleanup(values_t<Scalar, MemoryPolicy> values) -> std::pair<decltype(values), size_t> {
+    const auto original_size = values.data.size();
+    values = compact(move(values));
+    return std::pair<decltype(values), size_t>{values, original_size - values.data.size()};
+};
+
+template<typename Scalar, typename MemoryPolicy>
+inline auto garbage_ratio(const values_t<Scalar, MemoryPolicy>& values) -> double {
+    if (values.data.empty()) {
+        return 0.0;
     }
+    return static_cast<double>(values.garbage) / static_cast<double>(values.data.size());
+};
 
-    for (const auto& v : b.data) {
-        out.data = move(out.data).push_back(v);
+/**
+ * compact once the garbage crosses the thresholds of the policy
+ * called after every removal this amortizes the repack over the removed scalars, which keeps
+ * sliding window style usage from growing data without bound
+ */
+template<typename Scalar, typename MemoryPolicy>
+inline auto compact_if_needed(values_t<Scalar, MemoryPolicy> values,
+                              const compaction_policy_t& policy) -> values_t<Scalar, MemoryPolicy> {
+    if (values.garbage < policy.min_garbage or garbage_ratio(values) <= policy.max_garbage_ratio) {
+        return values;
     }
+    return compact(move(values));
+};
+
+template<typename Scalar, typename MemoryPolicy>
+inline auto remove(values_t<Scalar, MemoryPolicy> values,
+                   const imsym::key::key_t& key,
+                   const compaction_policy_t& policy) -> values_t<Scalar, MemoryPolicy> {
+    return compact_if_needed(remove(move(values), key), policy);
+};
+
+/*
+ * what merge does with a key present in more than one of its inputs
+ */
+enum class overlap_policy_t {
+    // the entry from the later input replaces the earlier one
+    LAST_WINS,
+    // the earlier entry is kept, the later one's data becomes garbage
+    FIRST_WINS,
+    // throw
+    ERROR,
+};
+
+/*
+ * merge any number of values, in order
+ * the data ropes are concatenated as they are, O(K log n) for K inputs. The map starts from the
+ * first input's and takes the entries of the rest through a transient, offsets shifted by where
+ * their data lands. Data no longer referenced on overlaps is counted as garbage.
+ */
+template<typename Scalar, typename MemoryPolicy>
+inline auto merge(std::span<const values_t<Scalar, MemoryPolicy>> parts,
+                  const overlap_policy_t policy = overlap_policy_t::LAST_WINS)
+    -> values_t<Scalar, MemoryPolicy> {
+    if (parts.empty()) {
+        return {};
+    }
+
+    auto out = parts.front();
+    auto map = move(out.map).transient();
+    for (const auto& part : parts.subspan(1)) {
+        const auto base = static_cast<int32_t>(out.data.size());
+        out.garbage += part.garbage;
+        for (const auto& [k, v] : part.map) {
+            const auto* existing = map.find(k);
+            if (existing != nullptr) {
+                switch (policy) {
+                    case overlap_policy_t::LAST_WINS:
+                        out.garbage += existing->storage_dim;
+                        break;
+                    case overlap_policy_t::FIRST_WINS:
+                        out.garbage += v.storage_dim;
+                        continue;
+                    case overlap_policy_t::ERROR:
+                        throw std::runtime_error("merge of values with overlapping keys");
+                }
+            } else if (out.letter_index) {
+                out.letter_index = imsym::key::insert(move(*out.letter_index), v.key);
+            }
+            auto v_out = v;
+            v_out.offset += base;
+            if (out.offset_index) {
+                if (existing != nullptr) {
+                    out.offset_index =
+                        values::erase(move(*out.offset_index), v.key, existing->offset);
+                }
+                out.offset_index = values::insert(move(*out.offset_index), v.key, v_out.offset);
+            }
+            map.set(k, v_out);
+        }
+        out.data = move(out.data) + part.data;
+    }
+    out.map = move(map).persistent();
     return out;
 }
 
-template<typename Scalar>
-inline auto merge(const values_t<Scalar>& a, const values_t<Scalar>& b, const values_t<Scalar>& c)
-    -> values_t<Scalar> {
-    return merge(merge(a, b), c);
+template<typename Scalar, typename MemoryPolicy>
+inline auto merge(const std::vector<values_t<Scalar, MemoryPolicy>>& parts,
+                  const overlap_policy_t policy = overlap_policy_t::LAST_WINS)
+    -> values_t<Scalar, MemoryPolicy> {
+    return merge(std::span<const values_t<Scalar, MemoryPolicy>>(parts), policy);
 }
 
-// merge b over a for keys which exist in both
-template<typename Scalar>
-inline auto merge_over(const values_t<Scalar>& a, const values_t<Scalar>& b) -> values_t<Scalar> {
-    // Create a new values_t<Scalar> with only the keys from b that exist in a
-    values_t<Scalar> trimmed_b = b;
-    trimmed_b.map = {};
+// b's entries replace a's for keys which exist in both
+template<typename Scalar, typename MemoryPolicy>
+inline auto merge(const values_t<Scalar, MemoryPolicy>& a, const values_t<Scalar, MemoryPolicy>& b)
+    -> values_t<Scalar, MemoryPolicy> {
+    const auto parts = std::array<values_t<Scalar, MemoryPolicy>, 2>{a, b};
+    return merge(std::span<const values_t<Scalar, MemoryPolicy>>(parts));
+}
+
+template<typename Scalar, typename MemoryPolicy>
+inline auto merge(const values_t<Scalar, MemoryPolicy>& a,
+                  const values_t<Scalar, MemoryPolicy>& b,
+                  const values_t<Scalar, MemoryPolicy>& c) -> values_t<Scalar, MemoryPolicy> {
+    const auto parts = std::array<values_t<Scalar, MemoryPolicy>, 3>{a, b, c};
+    return merge(std::span<const values_t<Scalar, MemoryPolicy>>(parts));
+}
 
+// merge b over a for keys which exist in both
+template<typename Scalar, typename MemoryPolicy>
+inline auto merge_over(const values_t<Scalar, MemoryPolicy>& a,
+                       const values_t<Scalar, MemoryPolicy>& b) -> values_t<Scalar, MemoryPolicy> {
+    // only the keys from b that exist in a, the data of the rest is carried along as garbage
+    values_t<Scalar, MemoryPolicy> trimmed_b = b;
+    trimmed_b.letter_index = {};
+    trimmed_b.offset_index = {};
+    auto map = move(trimmed_b.map).transient();
     for (const auto& [k, v] : b.map) {
-        if (a.map.count(k)) {
-            trimmed_b.map = std::move(trimmed_b.map).set(k, v);
+        if (a.map.count(k) == 0) {
+            map.erase(k);
+            trimmed_b.garbage += v.storage_dim;
+        }
+    }
+    trimmed_b.map = move(map).persistent();
+
+    const auto parts = std::array<values_t<Scalar, MemoryPolicy>, 2>{a, trimmed_b};
+    return merge(std::span<const values_t<Scalar, MemoryPolicy>>(parts),
+                 overlap_policy_t::LAST_WINS);
+}
+
+/*
+ * a run of scalars to copy from source[source_offset, source_offset + dim) over
+ * target[offset, offset + dim)
+ */
+struct splice_t {
+    int32_t offset;
+    int32_t source_offset;
+    int32_t dim;
+};
+
+/*
+ * sort the runs by target offset and merge those that are adjacent on both sides
+ * runs must not overlap on the target side
+ */
+inline auto coalesce(std::vector<splice_t> runs) -> std::vector<splice_t> {
+    std::sort(runs.begin(), runs.end(), [](const auto& a, const auto& b) {
+        return a.offset < b.offset;
+    });
+
+    std::vector<splice_t> merged;
+    merged.reserve(runs.size());
+    for (const auto& run : runs) {
+        if (run.dim == 0) {
+            continue;
         }
+        if (not merged.empty()) {
+            auto& last = merged.back();
+            assert(last.offset + last.dim <= run.offset);
+            if (last.offset + last.dim == run.offset and
+                last.source_offset + last.dim == run.source_offset) {
+                last.dim += run.dim;
+                continue;
+            }
+        }
+        merged.push_back(run);
     }
+    return merged;
+}
 
-    return merge(a, trimmed_b);
+/*
+ * copy coalesced runs of source over target, building the output rope in one left to right pass
+ * every run costs a couple of O(log n) slices and concats, untouched stretches of target are shared
+ */
+template<typename Data>
+inline auto splice(const Data& target, const Data& source, const std::vector<splice_t>& runs)
+    -> Data {
+    auto out = Data{};
+    int32_t cursor = 0;
+    for (const auto& run : runs) {
+        out = move(out) + target.drop(cursor).take(run.offset - cursor) +
+              source.drop(run.source_offset).take(run.dim);
+        cursor = run.offset + run.dim;
+    }
+    return move(out) + target.drop(cursor);
 }
 
 /**
  * Efficiently update the keys from a different structured values, given by
  * `index_a` and `index_b`. This purely copies slices of the data arrays.
  *
+ * The entries are sorted by offset in a, runs that are adjacent on both sides are merged, and the
+ * output data is built in a single pass.
+ *
  * `index_a` MUST be valid for this object; `index_b` MUST be valid for other object.
  */
-template<typename Scalar>
-inline values_t<Scalar> update(const index_t& index_a,
-                               const index_t& index_b,
-                               const values_t<Scalar>& values_a,
-                               const values_t<Scalar>& values_b) {
+template<typename Scalar, typename MemoryPolicy>
+inline values_t<Scalar, MemoryPolicy> update(const index_t& index_a,
+                                             const index_t& index_b,
+                                             const values_t<Scalar, MemoryPolicy>& values_a,
+                                             const values_t<Scalar, MemoryPolicy>& values_b) {
     auto values_out = values_a;
     assert(index_a.entries.size() == index_b.entries.size());
+
+    std::vector<splice_t> runs;
+    runs.reserve(index_a.entries.size());
     for (int i = 0; i < static_cast<int>(index_a.entries.size()); ++i) {
         const imsym::values::index_entry_t& entry_a = index_a.entries[i];
         const imsym::values::index_entry_t& entry_b = index_b.entries[i];
         assert(entry_a.storage_dim == entry_b.storage_dim);
         assert(entry_a.key == entry_b.key);
 
-        auto pre_a = values_a.data.take(entry_a.offset);
-        auto post_a = values_a.data.drop(entry_a.offset + entry_a.storage_dim);
-
-        auto slice_b = values_b.data.drop(entry_b.offset).take(entry_b.storage_dim);
-
-        values_out.data = pre_a + slice_b + post_a;
+        runs.push_back({entry_a.offset, entry_b.offset, entry_a.storage_dim});
     }
+
+    values_out.data = splice(values_a.data, values_b.data, coalesce(move(runs)));
     return values_out;
 }
 
@@ -382,10 +723,11 @@ inline values_t<Scalar> update(const index_t& index_a,
  * this avoids having to know about type info
  * key doesn't exist on the a side
  */
-template<typename Scalar>
-inline values_t<Scalar> copy_data_for_new_key(const values_t<Scalar>& values_a,
-                                              const values_t<Scalar>& values_b,
-                                              const imsym::key::key_t& key) {
+template<typename Scalar, typename MemoryPolicy>
+inline values_t<Scalar, MemoryPolicy>
+    copy_data_for_new_key(const values_t<Scalar, MemoryPolicy>& values_a,
+                          const values_t<Scalar, MemoryPolicy>& values_b,
+                          const imsym::key::key_t& key) {
     auto values_out = values_a;
     auto entry_b = values_b.map.at(key);
 
@@ -394,6 +736,13 @@ inline values_t<Scalar> copy_data_for_new_key(const values_t<Scalar>& values_a,
     entry_b.offset = values_out.data.size();
     values_out.data = move(values_out.data) + slice_b;
     values_out.map = move(values_out.map).set(key, entry_b);
+    if (values_out.letter_index) {
+        values_out.letter_index = imsym::key::insert(move(*values_out.letter_index), key);
+    }
+    if (values_out.offset_index) {
+        values_out.offset_index =
+            values::insert(move(*values_out.offset_index), key, entry_b.offset);
+    }
 
     return values_out;
 }
@@ -401,10 +750,11 @@ inline values_t<Scalar> copy_data_for_new_key(const values_t<Scalar>& values_a,
 // data has to be the same size for both sides
 // we just insert the data directly over the old data
 // key has to exist on both sides
-template<typename Scalar>
-inline values_t<Scalar> copy_data_for_existing_key(const values_t<Scalar>& values_a,
-                                                   const values_t<Scalar>& values_b,
-                                                   const imsym::key::key_t& key) {
+template<typename Scalar, typename MemoryPolicy>
+inline values_t<Scalar, MemoryPolicy>
+    copy_data_for_existing_key(const values_t<Scalar, MemoryPolicy>& values_a,
+                               const values_t<Scalar, MemoryPolicy>& values_b,
+                               const imsym::key::key_t& key) {
     auto values_out = values_a;
 
     const auto& entry_a = values_a.map.at(key);
@@ -427,9 +777,11 @@ inline values_t<Scalar> copy_data_for_existing_key(const values_t<Scalar>& value
  * if key exists in b
  * - copy the data from other
  */
-template<typename Scalar>
-inline values_t<Scalar>
-    update(const values_t<Scalar>& values_a, const values_t<Scalar>& values_b, const key_t& key) {
+template<typename Scalar, typename MemoryPolicy>
+inline values_t<Scalar, MemoryPolicy>
+    update(const values_t<Scalar, MemoryPolicy>& values_a,
+           const values_t<Scalar, MemoryPolicy>& values_b,
+           const key_t& key) {
     auto values_out = values_a;
 
     const auto& entry_a = values_a.map.get(key);
@@ -449,32 +801,82 @@ inline values_t<Scalar>
     return values_out;
 }
 /**
- * extract values from the given keys into a new values
+ * extract values from the given keys into a new values, along with the index of the keys in it
+ * the data is laid out in index order. Entries adjacent in other's data are coalesced into runs,
+ * each run is taken as a single slice, so eg. a window of consecutive poses costs one slice.
  */
-template<typename Scalar>
-inline values_t<Scalar> extract(const values_t<Scalar>& other, const index_t& index) {
-    auto values = values_t<Scalar>{};
+template<typename Scalar, typename MemoryPolicy>
+inline auto extract_indexed(const values_t<Scalar, MemoryPolicy>& other, const index_t& index)
+    -> std::pair<values_t<Scalar, MemoryPolicy>, index_t> {
+    auto values = values_t<Scalar, MemoryPolicy>{};
+    auto out_index = index_t{.storage_dim = 0, .tangent_dim = 0};
+    auto map = move(values.map).transient();
+    auto entries = move(out_index.entries).transient();
+
+    int32_t run_offset = 0;
+    int32_t run_dim = 0;
+    const auto flush = [&] {
+        if (run_dim > 0) {
+            values.data = move(values.data) + other.data.drop(run_offset).take(run_dim);
+        }
+    };
 
     for (const auto& other_entry : index.entries) {
         auto entry = other_entry;
-        entry.offset = static_cast<int32_t>(values.data.size());
-
-        const auto other_slice = other.data.drop(other_entry.offset).take(other_entry.storage_dim);
+        entry.offset = out_index.storage_dim;
+        map.set(entry.key, entry);
+        entries.push_back(entry);
+        out_index.storage_dim += entry.storage_dim;
+        out_index.tangent_dim += entry.tangent_dim;
+
+        if (run_dim > 0 and run_offset + run_dim == other_entry.offset) {
+            run_dim += other_entry.storage_dim;
+            continue;
+        }
+        flush();
+        run_offset = other_entry.offset;
+        run_dim = other_entry.storage_dim;
+    }
+    flush();
 
-        values.data = values.data + other_slice;
-        values.map = move(values.map).set(entry.key, entry);
+    values.map = move(map).persistent();
+    out_index.entries = move(entries).persistent();
+    if (other.letter_index) {
+        values = with_letter_index(move(values));
     }
-    return values;
+    if (other.offset_index) {
+        values = with_offset_index(move(values));
+    }
+    return {move(values), move(out_index)};
+}
+
+/**
+ * extract values from the given keys into a new values
+ */
+template<typename Scalar, typename MemoryPolicy>
+inline values_t<Scalar, MemoryPolicy> extract(const values_t<Scalar, MemoryPolicy>& other,
+                                              const index_t& index) {
+    return extract_indexed(other, index).first;
 }
 
 // remove keys from a
-template<typename Scalar, typename Container>
-inline auto drop_keys(const values_t<Scalar>& a, const Container& keys)
+template<typename Scalar, typename Container, typename MemoryPolicy>
+inline auto drop_keys(const values_t<Scalar, MemoryPolicy>& a, const Container& keys)
     -> std::enable_if_t<std::is_same_v<typename Container::value_type, imsym::key::key_t>,
-                        values_t<Scalar>> {
-    values_t<Scalar> result = a;
+                        values_t<Scalar, MemoryPolicy>> {
+    values_t<Scalar, MemoryPolicy> result = a;
     for (const auto& key : keys) {
-        result.map = move(result.map).erase(key);
+        if (const auto* entry = result.map.find(key)) {
+            result.garbage += entry->storage_dim;
+            if (result.offset_index) {
+                result.offset_index =
+                    values::erase(move(*result.offset_index), key, entry->offset);
+            }
+            result.map = move(result.map).erase(key);
+            if (result.letter_index) {
+                result.letter_index = imsym::key::erase(move(*result.letter_index), key);
+            }
+        }
     }
 
     // Note: The data is not repacked here. cleanup() should be called
@@ -483,15 +885,26 @@ inline auto drop_keys(const values_t<Scalar>& a, const Container& keys)
     return result;
 }
 
-template<typename Scalar>
-values_t<Scalar>::values_t(
+// remove keys from a, then compact if the policy says so
+template<typename Scalar, typename Container, typename MemoryPolicy>
+inline auto drop_keys(const values_t<Scalar, MemoryPolicy>& a,
+                      const Container& keys,
+                      const compaction_policy_t& policy)
+    -> std::enable_if_t<std::is_same_v<typename Container::value_type, imsym::key::key_t>,
+                        values_t<Scalar, MemoryPolicy>> {
+    return compact_if_needed(drop_keys(a, keys), policy);
+}
+
+template<typename Scalar, typename MemoryPolicy>
+values_t<Scalar, MemoryPolicy>::values_t(
     std::initializer_list<std::tuple<imsym::key::key_t, AllowedTypes<Scalar>>> init_list) {
-    values_t<Scalar> me = *this;
+    auto builder = values_builder_t<Scalar, MemoryPolicy>{};
     for (const auto& [k, v] : init_list) {
-        me = mmm::match(v)([me = move(me), k = k](auto a) {
-            return set(move(me), k, a);
+        mmm::match(v)([&builder, &k = k](const auto& a) {
+            builder.set(k, a);
         });
     }
+    auto me = move(builder).finalize();
     map = move(me.map);
     data = move(me.data);
 };
@@ -516,43 +929,70 @@ namespace imsym::values {
 
 // perhaps move this to a detail namespace
 
+/*
+ * convert the scalar type of values
+ * the map is shared as is, offsets and dims don't depend on the scalar type. The data is converted
+ * a leaf at a time straight into a transient, which fills its tail in place, with no intermediate
+ * copy of the whole data.
+ */
+template<typename To, typename From, typename MemoryPolicy>
+inline auto cast(const values_t<From, MemoryPolicy>& values) -> values_t<To, MemoryPolicy> {
+    auto out = values_t<To, MemoryPolicy>{};
+    out.map = values.map;
+    out.garbage = values.garbage;
+    out.letter_index = values.letter_index;
+    out.offset_index = values.offset_index;
+
+    if constexpr (std::is_same_v<To, From>) {
+        out.data = values.data;
+    } else {
+        auto data = typename values_t<To, MemoryPolicy>::data_t{}.transient();
+        immer::for_each_chunk(values.data, [&data](const From* first, const From* last) {
+            for (; first != last; ++first) {
+                data.push_back(static_cast<To>(*first));
+            }
+        });
+        out.data = move(data).persistent();
+    }
+    return out;
+}
+
 /*
  * check equality of map contents
- * this is different than object equality offered by operator == on the map which checks for
- * identity() through map tree operations
+ * maps with the same root are equal without looking further, otherwise immer::diff walks both and
+ * skips the subtrees they share
  */
-inline auto contents_equal(const immer::map<imsym::key::key_t, imsym::values::index_entry_t>& a,
-                           const immer::map<imsym::key::key_t, imsym::values::index_entry_t>& b)
-    -> bool {
-    for (const auto& [key, entry] : a) {
-        if (b.count(key) == 0) {
-            return false;
-        }
-        // entry exists in b
-        const imsym::values::index_entry_t& v_b = b.at(key);
-        if (entry != v_b) {
-            return false;
-        }
+template<typename MemoryPolicy>
+inline auto contents_equal(const basic_values_map_t<MemoryPolicy>& a,
+                           const basic_values_map_t<MemoryPolicy>& b) -> bool {
+    if (a.impl().root == b.impl().root) {
+        return true;
     }
-    // check back in the other direction
-    for (const auto& [key, entry] : b) {
-        if (a.count(key) == 0) {
-            return false;
-        }
-        // entry exists in a
-        if (entry != a.at(key)) {
-            return false;
-        }
+    if (a.size() != b.size()) {
+        return false;
     }
-    return true;
+    bool equal = true;
+    const auto differs = [&equal](const auto&...) {
+        equal = false;
+    };
+    immer::diff(a, b, differs, differs, differs);
+    return equal;
 }
 
 /* check equality of map and data
- * this is different than object equality offered by operator == on the map which checks for
- * identity()
+ * the data is compared leaf by leaf, leaves shared by a and b are skipped, the rest are memcmp'd
  */
-template<typename Scalar>
-inline auto contents_equal(const values_t<Scalar>& a, const values_t<Scalar>& b) -> bool {
-    return contents_equal(a.map, b.map) and (a.data == b.data);
+template<typename Scalar, typename MemoryPolicy>
+inline auto contents_equal(const values_t<Scalar, MemoryPolicy>& a,
+                           const values_t<Scalar, MemoryPolicy>& b) -> bool {
+    return contents_equal(a.map, b.map) and data_equal(a.data, b.data, exact_equal_t{});
+}
+
+// as above, with data within tolerance of each other considered the same
+template<typename Scalar, typename MemoryPolicy>
+inline auto contents_equal(const values_t<Scalar, MemoryPolicy>& a,
+                           const values_t<Scalar, MemoryPolicy>& b,
+                           const std::type_identity_t<Scalar> tolerance) -> bool {
+    return contents_equal(a.map, b.map) and data_equal(a.data, b.data, within_t<Scalar>{tolerance});
 }
 }   // namespace imsym::values
@@ -0,0 +1,242 @@
+/* Copyright (C) Basemap, Inc DBA Automaton  All Rights Reserved
+ * Unauthorized copying of this file, via any medium is strictly prohibited
+ * Proprietary and confidential
+ * Written by Asa Hammond <asa@automaton.is>, 2021
+ */
+
+#pragma once
+#include "imsym/opt/type_dispatch.hh"
+#include "imsym/opt/values.hh"
+#include "imsym/opt/values_ops.hh"
+//
+#include <sym/ops/lie_group_ops.h>
+#include <sym/ops/storage_ops.h>
+
+#include <Eigen/Core>
+#include <algorithm>
+#include <cassert>
+#include <cstdint>
+#include <stdexcept>
+#include <type_traits>
+#include <utility>
+#include <vector>
+
+/*
+ * batched tangent space ops over a values_t, a la sym::Values::Retract / LocalCoordinates
+ *
+ * The entries of the index are gathered into one working buffer, grouped by type, and each group
+ * runs one tight loop with the type resolved once for the whole group through visit_type.
+ * Vector, matrix and scalar entries retract by plain addition, contiguous runs of them are done as
+ * a single span.
+ * The result is spliced back into the persistent data in one pass, so the parts of the values not
+ * in the index stay shared.
+ */
+
+namespace imsym::values {
+
+namespace detail {
+
+/*
+ * the entries of an index laid out in a working buffer
+ * windows are the coalesced storage ranges the entries cover, the buffer holds them back to back
+ */
+struct tangent_layout_t {
+    struct item_t {
+        index_entry_t entry;
+        int32_t tangent_offset;   // into the tangent vector, in index order
+        int32_t buffer_offset;    // into the working buffer
+    };
+
+    std::vector<item_t> items;   // grouped by type, by storage offset within a group
+    std::vector<splice_t> windows;
+    int32_t buffer_size = 0;
+};
+
+inline auto layout(const index_t& index) -> tangent_layout_t {
+    auto out = tangent_layout_t{};
+    out.items.reserve(index.entries.size());
+    int32_t tangent_offset = 0;
+    for (const auto& entry : index.entries) {
+        out.items.push_back({entry, tangent_offset, 0});
+        tangent_offset += entry.tangent_dim;
+    }
+
+    std::sort(out.items.begin(), out.items.end(), [](const auto& a, const auto& b) {
+        return a.entry.offset < b.entry.offset;
+    });
+    for (auto& item : out.items) {
+        const auto& entry = item.entry;
+        if (not out.windows.empty()) {
+            auto& last = out.windows.back();
+            if (last.offset + last.dim == entry.offset) {
+                item.buffer_offset = last.source_offset + last.dim;
+                last.dim += entry.storage_dim;
+                out.buffer_size += entry.storage_dim;
+                continue;
+            }
+        }
+        item.buffer_offset = out.buffer_size;
+        out.windows.push_back({entry.offset, out.buffer_size, entry.storage_dim});
+        out.buffer_size += entry.storage_dim;
+    }
+
+    std::stable_sort(out.items.begin(), out.items.end(), [](const auto& a, const auto& b) {
+        return a.entry.type.value < b.entry.type.value;
+    });
+    return out;
+}
+
+template<typename Data>
+inline auto gather(const Data& data, const tangent_layout_t& layout)
+    -> std::vector<typename Data::value_type> {
+    auto buffer = std::vector<typename Data::value_type>(layout.buffer_size);
+    for (const auto& window : layout.windows) {
+        copy_storage(data, window.offset, window.dim, buffer.data() + window.source_offset);
+    }
+    return buffer;
+}
+
+/*
+ * call fn(type, first, last) for each run of items sharing a type
+ */
+template<typename Fn>
+inline auto for_each_type_group(const tangent_layout_t& layout, Fn&& fn) -> void {
+    auto first = layout.items.begin();
+    while (first != layout.items.end()) {
+        const auto type = first->entry.type;
+        const auto last = std::find_if(first, layout.items.end(), [&](const auto& item) {
+            return item.entry.type.value != type.value;
+        });
+        fn(type, first, last);
+        first = last;
+    }
+}
+
+/*
+ * call fn(buffer_offset, tangent_offset, dim) over the items of a vector space group, merging
+ * items which are contiguous in both the buffer and the tangent vector
+ */
+template<typename It, typename Fn>
+inline auto for_each_span(It first, It last, Fn&& fn) -> void {
+    if (first == last) {
+        return;
+    }
+    auto buffer_offset = first->buffer_offset;
+    auto tangent_offset = first->tangent_offset;
+    auto dim = first->entry.storage_dim;
+    for (auto it = std::next(first); it != last; ++it) {
+        if (it->buffer_offset == buffer_offset + dim and
+            it->tangent_offset == tangent_offset + dim) {
+            dim += it->entry.storage_dim;
+            continue;
+        }
+        fn(buffer_offset, tangent_offset, dim);
+        buffer_offset = it->buffer_offset;
+        tangent_offset = it->tangent_offset;
+        dim = it->entry.storage_dim;
+    }
+    fn(buffer_offset, tangent_offset, dim);
+}
+
+}   // namespace detail
+
+/*
+ * a la sym::Values::Retract
+ * retract the entries of index by delta, which is laid out in index order
+ * index must be valid for values
+ */
+template<typename Scalar, typename MemoryPolicy>
+inline auto retract(values_t<Scalar, MemoryPolicy> values,
+                    const index_t& index,
+                    const Scalar* delta,
+                    const Scalar epsilon) -> values_t<Scalar, MemoryPolicy> {
+    const auto layout = detail::layout(index);
+    auto buffer = detail::gather(values.data, layout);
+    Scalar* const storage = buffer.data();
+
+    const auto retract_group = [&](const sym::type_t type, auto first, auto last) {
+        const auto known = visit_type<Scalar>(type, [&]<typename T>(std::type_identity<T>) {
+            if constexpr (is_vector_space_v<T>) {
+                detail::for_each_span(first, last, [&](const auto o, const auto t, const auto dim) {
+                    Scalar* const out = storage + o;
+                    const Scalar* const d = delta + t;
+                    for (int32_t i = 0; i < dim; i++) {
+                        out[i] += d[i];
+                    }
+                });
+            } else {
+                for (auto it = first; it != last; ++it) {
+                    Scalar* const out = storage + it->buffer_offset;
+                    using TangentVec = typename sym::LieGroupOps<T>::TangentVec;
+                    const T value = sym::StorageOps<T>::FromStorage(out);
+                    const auto tangent = Eigen::Map<const TangentVec>(delta + it->tangent_offset);
+                    sym::StorageOps<T>::ToStorage(
+                        sym::LieGroupOps<T>::Retract(value, tangent, epsilon), out);
+                }
+            }
+        });
+        if (not known) {
+            throw std::runtime_error("Retract on an unsupported value type.");
+        }
+    };
+    detail::for_each_type_group(layout, retract_group);
+
+    const auto source = decltype(values.data)(buffer.begin(), buffer.end());
+    values.data = splice(values.data, source, layout.windows);
+    return values;
+}
+
+template<typename Scalar, typename MemoryPolicy>
+inline auto retract(values_t<Scalar, MemoryPolicy> values,
+                    const index_t& index,
+                    const Eigen::Matrix<Scalar, Eigen::Dynamic, 1>& delta,
+                    const Scalar epsilon) -> values_t<Scalar, MemoryPolicy> {
+    assert(delta.rows() == index.tangent_dim);
+    return retract(move(values), index, delta.data(), epsilon);
+}
+
+/*
+ * a la sym::Values::LocalCoordinates
+ * a in the local coordinates of b, ie. the tangent vector d so that retract(b, d) == a
+ * index must be valid for both a and b, laid out in index order
+ */
+template<typename Scalar, typename MemoryPolicy>
+inline auto local_coordinates(const values_t<Scalar, MemoryPolicy>& a,
+                              const values_t<Scalar, MemoryPolicy>& b,
+                              const index_t& index,
+                              const Scalar epsilon) -> Eigen::Matrix<Scalar, Eigen::Dynamic, 1> {
+    const auto layout = detail::layout(index);
+    const auto buffer_a = detail::gather(a.data, layout);
+    const auto buffer_b = detail::gather(b.data, layout);
+    auto out = Eigen::Matrix<Scalar, Eigen::Dynamic, 1>(index.tangent_dim);
+
+    const auto local_group = [&](const sym::type_t type, auto first, auto last) {
+        const auto known = visit_type<Scalar>(type, [&]<typename T>(std::type_identity<T>) {
+            if constexpr (is_vector_space_v<T>) {
+                detail::for_each_span(first, last, [&](const auto o, const auto t, const auto dim) {
+                    const Scalar* const from_a = buffer_a.data() + o;
+                    const Scalar* const from_b = buffer_b.data() + o;
+                    Scalar* const d = out.data() + t;
+                    for (int32_t i = 0; i < dim; i++) {
+                        d[i] = from_a[i] - from_b[i];
+                    }
+                });
+            } else {
+                for (auto it = first; it != last; ++it) {
+                    const auto o = it->buffer_offset;
+                    const T value_a = sym::StorageOps<T>::FromStorage(buffer_a.data() + o);
+                    const T value_b = sym::StorageOps<T>::FromStorage(buffer_b.data() + o);
+                    out.segment(it->tangent_offset, it->entry.tangent_dim) =
+                        sym::LieGroupOps<T>::LocalCoordinates(value_b, value_a, epsilon);
+                }
+            }
+        });
+        if (not known) {
+            throw std::runtime_error("LocalCoordinates on an unsupported value type.");
+        }
+    };
+    detail::for_each_type_group(layout, local_group);
+    return out;
+}
+
+}   // namespace imsym::values
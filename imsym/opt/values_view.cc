@@ -0,0 +1,49 @@
+/* Copyright (C) Basemap, Inc DBA Automaton  All Rights Reserved
+ * Unauthorized copying of this file, via any medium is strictly prohibited
+ * Proprietary and confidential
+ * Written by Asa Hammond <asa@automaton.is>, 2021
+ */
+#include "imsym/opt/values_view.hh"
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+namespace imsym::values {
+
+mapped_file_t::mapped_file_t(const std::string& path) {
+    const int fd = ::open(path.c_str(), O_RDONLY | O_CLOEXEC);
+    if (fd < 0) {
+        throw std::runtime_error("can't open values view file: " + path);
+    }
+
+    struct stat st {};
+    if (::fstat(fd, &st) != 0) {
+        ::close(fd);
+        throw std::runtime_error("can't stat values view file: " + path);
+    }
+    size_ = static_cast<size_t>(st.st_size);
+    if (size_ == 0) {
+        ::close(fd);
+        return;
+    }
+
+    void* mapped = ::mmap(nullptr, size_, PROT_READ, MAP_PRIVATE, fd, 0);
+    // the mapping holds its own reference to the file
+    ::close(fd);
+    if (mapped == MAP_FAILED) {
+        throw std::runtime_error("can't map values view file: " + path);
+    }
+    // playback touches a handful of keys per frame, don't read ahead the whole log
+    ::madvise(mapped, size_, MADV_RANDOM);
+    data_ = static_cast<const std::byte*>(mapped);
+}
+
+mapped_file_t::~mapped_file_t() {
+    if (data_ != nullptr) {
+        ::munmap(const_cast<std::byte*>(data_), size_);
+    }
+}
+
+}   // namespace imsym::values
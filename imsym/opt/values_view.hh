@@ -0,0 +1,315 @@
+/* Copyright (C) Basemap, Inc DBA Automaton  All Rights Reserved
+ * Unauthorized copying of this file, via any medium is strictly prohibited
+ * Proprietary and confidential
+ * Written by Asa Hammond <asa@automaton.is>, 2021
+ */
+
+#pragma once
+#include "imsym/opt/key.hh"
+#include "imsym/opt/values.hh"
+#include "imsym/opt/values_ops.hh"
+//
+#include <immer/algorithm.hpp>
+#include <immer/flex_vector.hpp>
+#include <immer/flex_vector_transient.hpp>
+
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <fstream>
+#include <memory>
+#include <optional>
+#include <stdexcept>
+#include <string>
+#include <tuple>
+#include <vector>
+
+/*
+ * flat, read only on disk form of a values_t, opened with mmap
+ *
+ * layout, native endian:
+ *   view_header_t
+ *   view_entry_t[num_entries], sorted by (letter, sub, super)
+ *   Scalar[num_scalars]
+ *
+ * Opening a file maps it and checks the header, nothing is parsed, so it is constant time however
+ * large the log. Lookups binary search the mapped entries and read the scalars in place.
+ */
+
+namespace imsym::values {
+
+struct view_header_t {
+    static constexpr char kMagic[8] = {'I', 'M', 'S', 'Y', 'M', 'V', 'A', 'L'};
+    static constexpr uint32_t kVersion = 1;
+
+    char magic[8];
+    uint32_t version;
+    uint32_t scalar_size;
+    uint64_t num_entries;
+    uint64_t num_scalars;
+    uint64_t entries_offset;
+    uint64_t data_offset;
+    int64_t garbage;
+};
+
+struct view_entry_t {
+    int64_t sub;
+    int64_t super;
+    int64_t offset;
+    int32_t type;
+    int32_t storage_dim;
+    int32_t tangent_dim;
+    char letter;
+    char padding[3];
+};
+
+static_assert(sizeof(view_header_t) == 56);
+static_assert(sizeof(view_entry_t) == 40);
+
+/*
+ * a read only memory mapping of a whole file, unmapped when the last view on it goes away
+ */
+class mapped_file_t {
+   public:
+    explicit mapped_file_t(const std::string& path);
+    ~mapped_file_t();
+
+    mapped_file_t(const mapped_file_t&) = delete;
+    auto operator=(const mapped_file_t&) -> mapped_file_t& = delete;
+
+    auto data() const -> const std::byte* {
+        return data_;
+    };
+    auto size() const -> size_t {
+        return size_;
+    };
+
+   private:
+    const std::byte* data_ = nullptr;
+    size_t size_ = 0;
+};
+
+/*
+ * a values_t read in place from a mapped file, see open_view
+ * cheap to copy, copies share the mapping
+ */
+template<typename Scalar>
+struct values_view_t {
+    std::shared_ptr<const mapped_file_t> file;
+    const view_header_t* header = nullptr;
+    const view_entry_t* entries = nullptr;
+    const Scalar* data = nullptr;
+
+    auto num_entries() const -> size_t {
+        return header != nullptr ? header->num_entries : 0;
+    };
+
+    auto num_scalars() const -> size_t {
+        return header != nullptr ? header->num_scalars : 0;
+    };
+};
+
+namespace detail {
+
+inline auto view_order(const char letter, const int64_t sub, const int64_t super) {
+    return std::make_tuple(letter, sub, super);
+}
+
+inline auto view_order(const view_entry_t& e) {
+    return view_order(e.letter, e.sub, e.super);
+}
+
+inline auto view_order(const imsym::key::key_t& k) {
+    return view_order(k.letter, k.sub, k.super);
+}
+
+inline auto to_key(const view_entry_t& e) -> imsym::key::key_t {
+    return imsym::key::key_t{.letter = e.letter, .sub = e.sub, .super = e.super};
+}
+
+inline auto to_entry(const view_entry_t& e) -> index_entry_t {
+    auto entry = index_entry_t{};
+    entry.key = to_key(e);
+    entry.type.value = static_cast<sym::type_t::option_t>(e.type);
+    entry.offset = static_cast<int32_t>(e.offset);
+    entry.storage_dim = e.storage_dim;
+    entry.tangent_dim = e.tangent_dim;
+    return entry;
+}
+
+}   // namespace detail
+
+/*
+ * map a file written by save_view
+ * throws if the file can't be mapped or doesn't hold values of this Scalar
+ */
+template<typename Scalar>
+inline auto open_view(const std::string& path) -> values_view_t<Scalar> {
+    auto view = values_view_t<Scalar>{};
+    view.file = std::make_shared<const mapped_file_t>(path);
+    const auto* base = view.file->data();
+    const auto size = view.file->size();
+
+    if (size < sizeof(view_header_t)) {
+        throw std::runtime_error("values view file is too small: " + path);
+    }
+    view.header = reinterpret_cast<const view_header_t*>(base);
+    const auto& header = *view.header;
+    if (std::memcmp(header.magic, view_header_t::kMagic, sizeof(header.magic)) != 0 or
+        header.version != view_header_t::kVersion) {
+        throw std::runtime_error("not a values view file: " + path);
+    }
+    if (header.scalar_size != sizeof(Scalar)) {
+        throw std::runtime_error("values view file holds a different scalar type: " + path);
+    }
+    // the header is untrusted, compare by subtracting from the file size so nothing can overflow
+    const auto fits = [size](const uint64_t offset, const uint64_t count, const size_t stride) {
+        return offset <= size and count <= (size - offset) / stride;
+    };
+    if (header.entries_offset % alignof(view_entry_t) != 0 or
+        header.data_offset % alignof(Scalar) != 0 or
+        not fits(header.entries_offset, header.num_entries, sizeof(view_entry_t)) or
+        not fits(header.data_offset, header.num_scalars, sizeof(Scalar))) {
+        throw std::runtime_error("values view file is truncated or corrupt: " + path);
+    }
+
+    view.entries = reinterpret_cast<const view_entry_t*>(base + header.entries_offset);
+    view.data = reinterpret_cast<const Scalar*>(base + header.data_offset);
+    return view;
+}
+
+// nullptr if the key isn't in the view
+template<typename Scalar>
+inline auto find_entry(const values_view_t<Scalar>& view, const key::key_t& key)
+    -> const view_entry_t* {
+    const auto* first = view.entries;
+    const auto* last = view.entries + view.num_entries();
+    const auto* it = std::lower_bound(first, last, key, [](const view_entry_t& e, const auto& k) {
+        return detail::view_order(e) < detail::view_order(k);
+    });
+    if (it == last or detail::view_order(*it) != detail::view_order(key)) {
+        return nullptr;
+    }
+    return it;
+}
+
+template<typename Scalar>
+auto has(const values_view_t<Scalar>& view, const key::key_t& key) -> bool {
+    return find_entry(view, key) != nullptr;
+}
+
+template<typename Scalar>
+auto entry(const values_view_t<Scalar>& view, const key::key_t& key)
+    -> std::optional<index_entry_t> {
+    const auto* found = find_entry(view, key);
+    if (found == nullptr) {
+        return {};
+    }
+    return detail::to_entry(*found);
+}
+
+/*
+ * a la at(values, key), the object is constructed straight from the mapped scalars
+ */
+template<typename T, typename Scalar>
+auto at(const values_view_t<Scalar>& view, const key::key_t& key) -> T {
+    static_assert(std::is_same<Scalar, typename sym::StorageOps<T>::Scalar>::value,
+                  "Calling at on mismatched scalar type.");
+    const auto* found = find_entry(view, key);
+    if (found == nullptr) {
+        throw std::runtime_error("key not in values view");
+    }
+
+    const sym::type_t type = sym::StorageOps<T>::TypeEnum();
+    if (found->type != static_cast<int32_t>(type.value)) {
+        throw std::runtime_error("Mismatched types; view entry is wrong type");
+    }
+
+    constexpr int32_t storage_dim = sym::StorageOps<T>::StorageDim();
+    const uint64_t num_scalars = view.num_scalars();
+    const uint64_t dim = storage_dim;
+    if (found->storage_dim != storage_dim or found->offset < 0 or dim > num_scalars or
+        static_cast<uint64_t>(found->offset) > num_scalars - dim) {
+        throw std::runtime_error("not enough data to load data");
+    }
+    return sym::StorageOps<T>::FromStorage(view.data + found->offset);
+}
+
+// keys in (letter, sub, super) order
+template<typename Scalar>
+inline auto keys(const values_view_t<Scalar>& view) -> immer::flex_vector<key::key_t> {
+    auto out = immer::flex_vector<key::key_t>{}.transient();
+    for (size_t i = 0; i < view.num_entries(); i++) {
+        out.push_back(detail::to_key(view.entries[i]));
+    }
+    return move(out).persistent();
+}
+
+/*
+ * copy a view into a values_t, the data in one bulk range construction
+ */
+template<typename Scalar>
+inline auto clone(const values_view_t<Scalar>& view) -> values_t<Scalar> {
+    auto values = values_t<Scalar>{};
+    auto map = values.map.transient();
+    for (size_t i = 0; i < view.num_entries(); i++) {
+        const auto entry = detail::to_entry(view.entries[i]);
+        map.set(entry.key, entry);
+    }
+    values.map = move(map).persistent();
+    values.data = typename values_t<Scalar>::data_t(view.data, view.data + view.num_scalars());
+    values.garbage = static_cast<int32_t>(view.header->garbage);
+    return values;
+}
+
+/*
+ * write values in the view layout, to be opened with open_view
+ * the data is streamed out leaf by leaf
+ */
+template<typename Scalar>
+inline auto save_view(const values_t<Scalar>& values, const std::string& path) -> void {
+    auto entries = std::vector<view_entry_t>{};
+    entries.reserve(values.map.size());
+    for (const auto& [k, e] : values.map) {
+        auto flat = view_entry_t{};
+        flat.letter = e.key.letter;
+        flat.sub = e.key.sub;
+        flat.super = e.key.super;
+        flat.offset = e.offset;
+        flat.type = static_cast<int32_t>(e.type.value);
+        flat.storage_dim = e.storage_dim;
+        flat.tangent_dim = e.tangent_dim;
+        entries.push_back(flat);
+    }
+    std::sort(entries.begin(), entries.end(), [](const auto& a, const auto& b) {
+        return detail::view_order(a) < detail::view_order(b);
+    });
+
+    auto header = view_header_t{};
+    std::memcpy(header.magic, view_header_t::kMagic, sizeof(header.magic));
+    header.version = view_header_t::kVersion;
+    header.scalar_size = sizeof(Scalar);
+    header.num_entries = entries.size();
+    header.num_scalars = values.data.size();
+    header.entries_offset = sizeof(view_header_t);
+    header.data_offset = header.entries_offset + entries.size() * sizeof(view_entry_t);
+    header.garbage = values.garbage;
+
+    auto out = std::ofstream(path, std::ios::binary | std::ios::trunc);
+    if (not out) {
+        throw std::runtime_error("can't open values view file for writing: " + path);
+    }
+    out.write(reinterpret_cast<const char*>(&header), sizeof(header));
+    out.write(reinterpret_cast<const char*>(entries.data()),
+              static_cast<std::streamsize>(entries.size() * sizeof(view_entry_t)));
+    immer::for_each_chunk(values.data, [&](const Scalar* first, const Scalar* last) {
+        out.write(reinterpret_cast<const char*>(first),
+                  static_cast<std::streamsize>((last - first) * sizeof(Scalar)));
+    });
+    if (not out) {
+        throw std::runtime_error("failed writing values view file: " + path);
+    }
+}
+
+}   // namespace imsym::values
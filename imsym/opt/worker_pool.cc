@@ -0,0 +1,67 @@
+/* Copyright (C) Basemap, Inc DBA Automaton  All Rights Reserved
+ * Unauthorized copying of this file, via any medium is strictly prohibited
+ * Proprietary and confidential
+ * Written by Asa Hammond <asa@automaton.is>, 2022
+ */
+#include "imsym/opt/worker_pool.hh"
+
+#include <algorithm>
+#include <utility>
+
+namespace imsym {
+
+worker_pool_t::worker_pool_t(size_t threads) {
+    if (threads == 0) {
+        threads = std::max(1u, std::thread::hardware_concurrency());
+    }
+    threads_.reserve(threads);
+    for (size_t i = 0; i < threads; i++) {
+        threads_.emplace_back([this] {
+            run();
+        });
+    }
+}
+
+worker_pool_t::~worker_pool_t() {
+    {
+        const auto lock = std::lock_guard(mutex_);
+        stopping_ = true;
+    }
+    ready_.notify_all();
+    for (auto& thread : threads_) {
+        thread.join();
+    }
+}
+
+auto worker_pool_t::submit(std::function<void()> task) -> void {
+    {
+        const auto lock = std::lock_guard(mutex_);
+        tasks_.push_back(std::move(task));
+    }
+    ready_.notify_one();
+}
+
+auto worker_pool_t::shared() -> worker_pool_t& {
+    static auto* instance = new worker_pool_t{};
+    return *instance;
+}
+
+auto worker_pool_t::run() -> void {
+    while (true) {
+        auto task = std::function<void()>{};
+        {
+            auto lock = std::unique_lock(mutex_);
+            ready_.wait(lock, [this] {
+                return stopping_ or not tasks_.empty();
+            });
+            if (tasks_.empty()) {
+                return;
+            }
+            task = std::move(tasks_.front());
+            tasks_.pop_front();
+        }
+        task();
+    }
+}
+
+}   // namespace imsym
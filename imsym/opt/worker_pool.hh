@@ -0,0 +1,55 @@
+/* Copyright (C) Basemap, Inc DBA Automaton  All Rights Reserved
+ * Unauthorized copying of this file, via any medium is strictly prohibited
+ * Proprietary and confidential
+ * Written by Asa Hammond <asa@automaton.is>, 2022
+ */
+#pragma once
+
+#include <condition_variable>
+#include <cstddef>
+#include <deque>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+/*
+ * a fixed set of threads running tasks off one queue, in the order they were submitted
+ * used to move conversion work off the optimizer thread, see lazy_stats.hh
+ */
+
+namespace imsym {
+
+class worker_pool_t {
+   public:
+    // zero threads means one per hardware thread
+    explicit worker_pool_t(size_t threads = 0);
+    // runs whatever is still queued, then joins
+    ~worker_pool_t();
+
+    worker_pool_t(const worker_pool_t&) = delete;
+    auto operator=(const worker_pool_t&) -> worker_pool_t& = delete;
+
+    auto submit(std::function<void()> task) -> void;
+
+    auto size() const -> size_t {
+        return threads_.size();
+    }
+
+    /*
+     * the pool shared by the whole process, started on first use
+     * never destroyed, so tasks still queued at exit don't race its destruction
+     */
+    static auto shared() -> worker_pool_t&;
+
+   private:
+    auto run() -> void;
+
+    std::mutex mutex_;
+    std::condition_variable ready_;
+    std::deque<std::function<void()>> tasks_;
+    bool stopping_ = false;
+    std::vector<std::thread> threads_;
+};
+
+}   // namespace imsym
@@ -6,10 +6,13 @@
 #define CATCH_CONFIG_MAIN
 #include "imsym/imsym.hh"
 #include "imsym/opt/formatters.hh"
+#include "imsym/opt/interop.hh"
+#include "imsym/opt/lazy_stats.hh"
 #include "imsym/opt/values_ext_ops.hh"
 #include "imsym/opt/values_ops.hh"
 //
 #include "catch2/catch_all.hpp"
+#include "cereal/archives/binary.hpp"
 // first spdlog include wins
 #include "spdlog/spdlog.h"
 //
@@ -30,7 +33,15 @@
 using Catch::Matchers::WithinAbs;
 constexpr double tol = 1e-10;
 
+#include <algorithm>
 #include <chrono>
+#include <filesystem>
+#include <fstream>
+#include <numeric>
+#include <random>
+#include <sstream>
+#include <thread>
+#include <unordered_set>
 
 using sym::Pose3d;
 using sym::Rot3d;
@@ -521,6 +532,86 @@ TEST_CASE("check diff operations") {
     }
 
     */
+    WHEN("diff") {
+        values = imsym::values::set<>(values, imsym::key::to(sym_key_0), sym_pose_0);
+        auto values2 = imsym::values::set<>(values, imsym::key::to(sym_key_1), sym_pose_1);
+        values2 = imsym::values::set<>(values2, imsym::key::to(sym_config_key_0), sym_config_0);
+
+        SECTION("added and removed keys") {
+            const auto forward = diff(values, values2);
+            CHECK(forward.added.size() == 2);
+            CHECK(forward.removed.size() == 0);
+            CHECK(forward.changed.size() == 0);
+
+            const auto backward = diff(values2, values);
+            CHECK(backward.added.size() == 0);
+            CHECK(backward.removed.size() == 2);
+            CHECK(backward.changed.size() == 0);
+        }
+
+        SECTION("change a value at a key") {
+            // the index doesn't change, just the data
+            auto values3 = imsym::values::set<>(values2, imsym::key::to(sym_key_1), sym_pose_1_alt);
+            const auto changes = diff(values2, values3);
+            CHECK(changes.added.size() == 0);
+            CHECK(changes.removed.size() == 0);
+            REQUIRE(changes.changed.size() == 1);
+            CHECK(changes.changed[0] == imsym::key::to(sym_key_1));
+
+            size_t calls = 0;
+            diff(
+                values2,
+                values3,
+                [&](const auto&) {
+                    calls++;
+                },
+                [&](const auto&) {
+                    calls++;
+                },
+                [&](const index_entry_t& a, const index_entry_t& b) {
+                    calls++;
+                    CHECK(a.key == b.key);
+                    CHECK(at<Pose3d>(values2, a.key) == sym_pose_1);
+                    CHECK(at<Pose3d>(values3, b.key) == sym_pose_1_alt);
+                });
+            CHECK(calls == 1);
+        }
+
+        SECTION("a moved but equal value isn't a change") {
+            auto trimmed = remove(values2, imsym::key::to(sym_key_0));
+            auto [compacted, _] = cleanup(trimmed);
+            const auto changes = diff(trimmed, compacted);
+            CHECK(changes.added.size() == 0);
+            CHECK(changes.removed.size() == 0);
+            CHECK(changes.changed.size() == 0);
+        }
+
+        SECTION("tolerance") {
+            auto nudged = sym_config_0 + sym::Vector3d::Constant(1e-12);
+            auto values3 = imsym::values::set<>(values2, imsym::key::to(sym_config_key_0), nudged);
+            CHECK(diff(values2, values3).changed.size() == 1);
+            CHECK(diff(values2, values3, 1e-9).changed.size() == 0);
+
+            auto moved = sym_config_0 + sym::Vector3d::Constant(1.0);
+            auto values4 = imsym::values::set<>(values2, imsym::key::to(sym_config_key_0), moved);
+            CHECK(diff(values2, values4, 1e-9).changed.size() == 1);
+        }
+
+        SECTION("whole values obj is roundtriped through sym::Values") {
+            // no data changed, no keys changed
+            auto round_tripped = imsym::values::clone(imsym::values::clone(values2));
+            const auto changes = diff(values2, round_tripped);
+            CHECK(changes.added.size() == 0);
+            CHECK(changes.removed.size() == 0);
+            CHECK(changes.changed.size() == 0);
+        }
+
+        SECTION("no changes against itself") {
+            const auto changes = diff(values2, values2);
+            CHECK(changes.added.size() + changes.removed.size() + changes.changed.size() == 0);
+        }
+    }
+
     WHEN("merge") {
         auto values = imsym::values::valuesd_t{{imsym::key::to(sym_key_0), sym_pose_0}};
         auto values2 = imsym::values::valuesd_t{{imsym::key::to(sym_key_1), sym_pose_1}};
@@ -556,6 +647,43 @@ TEST_CASE("check diff operations") {
         }
         */
         SECTION("merge n values") {
+            auto values3 = imsym::values::valuesd_t{{imsym::key::to(sym_key_0), sym_pose_1_alt}};
+            auto sensor =
+                imsym::values::valuesd_t{{imsym::key::to(sym_config_key_0), sym_config_0}};
+            const auto parts = std::vector<valuesd_t>{values, values2, values3, sensor};
+
+            const auto last_wins = merge(parts);
+            CHECK(last_wins.map.size() == 3);
+            CHECK(last_wins.data.size() ==
+                  values.data.size() + values2.data.size() + values3.data.size() + 3);
+            CHECK(at<Pose3d>(last_wins, imsym::key::to(sym_key_0)) == sym_pose_1_alt);
+            CHECK(at<Pose3d>(last_wins, imsym::key::to(sym_key_1)) == sym_pose_1);
+            CHECK(at<Vector3d>(last_wins, imsym::key::to(sym_config_key_0)) == sym_config_0);
+            CHECK(last_wins.garbage == 7);
+
+            const auto first_wins = merge(parts, overlap_policy_t::FIRST_WINS);
+            CHECK(at<Pose3d>(first_wins, imsym::key::to(sym_key_0)) == sym_pose_0);
+            CHECK(first_wins.garbage == 7);
+
+            CHECK_THROWS(merge(parts, overlap_policy_t::ERROR));
+            CHECK_NOTHROW(merge(std::vector<valuesd_t>{values, values2, sensor},
+                                overlap_policy_t::ERROR));
+
+            // pairwise merges agree with the n-ary one
+            CHECK(contents_equal(merge(merge(merge(values, values2), values3), sensor), last_wins));
+            CHECK(merge(std::vector<valuesd_t>{}).map.size() == 0);
+        }
+
+        SECTION("merge over") {
+            auto values3 = imsym::values::valuesd_t{
+                {imsym::key::to(sym_key_0), sym_pose_1_alt},
+                {imsym::key::to(sym_config_key_0), sym_config_0},
+            };
+            const auto over = merge_over(values, values3);
+            CHECK(over.map.size() == 1);
+            CHECK(at<Pose3d>(over, imsym::key::to(sym_key_0)) == sym_pose_1_alt);
+            CHECK(not has(over, imsym::key::to(sym_config_key_0)));
+            CHECK(over.garbage == 7 + 3);
         }
     }
 
@@ -720,6 +848,53 @@ TEST_CASE("conversion") {
     // auto imstats = imsym::to_imsym(move(stats));
     // spdlog::info("sparse problem optimized imsym values: {}", common::to_json(imstats));
     //     }
+
+    // one jacobian pattern for the whole run, each iteration only holds its values
+    const auto imstats = imsym::to_imsym(stats, true, true);
+    REQUIRE(imstats.iterations.size() == stats.iterations.size());
+    const auto& sparsity = imstats.jacobian_sparsity;
+    for (size_t i = 0; i < stats.iterations.size(); i++) {
+        const auto jacobian = imsym::jacobian(imstats, imstats.iterations[i]);
+        REQUIRE(jacobian.has_value());
+        const auto& sparse = std::get<imsym::sparse_matrix_t>(*jacobian);
+        CHECK(sparse.row_indices.identity() == sparsity.row_indices.identity());
+        CHECK(sparse.column_pointers.identity() == sparsity.column_pointers.identity());
+        const auto expected = Eigen::SparseMatrix<double>(stats.JacobianView(stats.iterations[i]));
+        CHECK((imsym::to_eigen(sparse) - expected).norm() == 0.0);
+    }
+
+    // converted in the background, the same stats come out
+    auto hasher = imsym::hasher_t{};
+    auto pool = imsym::worker_pool_t{2};
+    auto copy = stats;
+    const auto lazy = imsym::convert_async(std::move(copy), true, pool);
+    REQUIRE(lazy.size() == stats.iterations.size());
+    // read back to front so the calling thread races the workers for the early ones
+    for (size_t i = lazy.size(); i-- > 0;) {
+        CHECK(imsym::hash(hasher, lazy.iteration(i)) ==
+              imsym::hash(hasher, imstats.iterations[i]));
+    }
+    CHECK(lazy.ready());
+    CHECK(lazy.jacobian_sparsity().row_indices == sparsity.row_indices);
+    CHECK(imsym::hash(hasher, lazy.get()) == imsym::hash(hasher, imstats));
+    CHECK_THROWS(lazy.iteration(lazy.size()));
+
+    // a conversion which throws on a worker is rethrown to the reader, the rest still convert
+    REQUIRE(stats.iterations.size() > 1);
+    const auto failing = [bad = stats.iterations[1].iteration](
+                             const sym::optimization_iteration_t& iter, const bool jacobians) {
+        if (iter.iteration == bad) {
+            throw std::runtime_error("failed conversion");
+        }
+        return imsym::to_imsym(iter, jacobians);
+    };
+    copy = stats;
+    const auto failed = imsym::convert_async(std::move(copy), false, pool, failing);
+    CHECK_THROWS_WITH(failed.iteration(1), "failed conversion");
+    CHECK_THROWS_WITH(failed.iteration(1), "failed conversion");
+    CHECK_THROWS_WITH(failed.get(), "failed conversion");
+    CHECK(failed.ready());
+    CHECK(failed.iteration(0).iteration == stats.iterations[0].iteration);
 }
 
 TEST_CASE("tangent") {
@@ -755,3 +930,1560 @@ TEST_CASE("tangent") {
     }
 }
 
+TEST_CASE("values builder") {
+    auto sym_pose_0 = Pose3d(Rot3d::FromQuaternion({0, 1, 2, 3}), Vector3d{4, 5, 6});
+    auto sym_pose_1 = Pose3d(Rot3d::FromQuaternion({10, 11, 12, 13}), Vector3d{14, 15, 16});
+    const auto key_0 = imsym::key::key_t{.letter = 'P', .sub = 0};
+    const auto key_1 = imsym::key::key_t{.letter = 'P', .sub = 1};
+    const auto key_m = imsym::key::key_t{.letter = 'm'};
+
+    auto per_call = valuesd_t{};
+    per_call = set(per_call, key_0, sym_pose_0);
+    per_call = set(per_call, key_1, sym_pose_1);
+    per_call = set(per_call, key_m, 1.2345);
+
+    auto builder = values_builder_t<double>{};
+    builder.set(key_0, sym_pose_0).set(key_1, sym_pose_1).set(key_m, 1.2345);
+    const auto built = std::move(builder).finalize();
+
+    CHECK(contents_equal(built, per_call));
+    CHECK(at<Pose3d>(built, key_1) == sym_pose_1);
+
+    SECTION("edits on an existing values leave the original untouched") {
+        auto edit = values_builder_t<double>{built};
+        CHECK(edit.update(key_0, sym_pose_1));
+        CHECK(not edit.update(key_m, sym_pose_1));   // wrong type
+        CHECK(not edit.update(imsym::key::key_t{.letter = 'x'}, 1.0));
+        CHECK(edit.remove(key_m));
+        CHECK(not edit.remove(key_m));
+        const auto edited = std::move(edit).finalize();
+
+        CHECK(at<Pose3d>(edited, key_0) == sym_pose_1);
+        CHECK(not has(edited, key_m));
+        CHECK(edited.data.size() == built.data.size());   // data isn't repacked by remove
+
+        CHECK(at<Pose3d>(built, key_0) == sym_pose_0);
+        CHECK(has(built, key_m));
+    }
+
+    SECTION("set on the wrong type throws") {
+        auto edit = values_builder_t<double>{built};
+        CHECK_THROWS(edit.set(key_m, sym_pose_0));
+    }
+}
+
+TEST_CASE("values builder benchmark", "[.][benchmark]") {
+    constexpr int num_keys = 50000;
+    std::mt19937 gen(42);
+    std::vector<Pose3d> poses;
+    poses.reserve(num_keys);
+    for (int i = 0; i < num_keys; i++) {
+        poses.push_back(sym::Random<Pose3d>(gen));
+    }
+
+    BENCHMARK("per-call set") {
+        auto values = valuesd_t{};
+        for (int i = 0; i < num_keys; i++) {
+            values = set(std::move(values), imsym::key::key_t{.letter = 'P', .sub = i}, poses[i]);
+        }
+        return values.num_entries();
+    };
+
+    BENCHMARK("builder") {
+        auto builder = values_builder_t<double>{};
+        for (int i = 0; i < num_keys; i++) {
+            builder.set(imsym::key::key_t{.letter = 'P', .sub = i}, poses[i]);
+        }
+        return std::move(builder).finalize().num_entries();
+    };
+}
+
+TEST_CASE("at reads entries inside and across leaves") {
+    std::mt19937 gen(42);
+    // odd sized scalars first so poses land at every alignment against the leaf boundaries
+    auto builder = values_builder_t<double>{};
+    for (int i = 0; i < 100; i++) {
+        builder.set(imsym::key::key_t{.letter = 's', .sub = i}, static_cast<double>(i));
+    }
+    std::vector<Pose3d> poses;
+    for (int i = 0; i < 200; i++) {
+        poses.push_back(sym::Random<Pose3d>(gen));
+        builder.set(imsym::key::key_t{.letter = 'P', .sub = i}, poses.back());
+    }
+    const auto values = std::move(builder).finalize();
+
+    for (int i = 0; i < 200; i++) {
+        CHECK(at<Pose3d>(values, imsym::key::key_t{.letter = 'P', .sub = i}) == poses[i]);
+    }
+    for (int i = 0; i < 100; i++) {
+        CHECK(at<double>(values, imsym::key::key_t{.letter = 's', .sub = i}) == i);
+    }
+    CHECK_THROWS(at<sym::Rot3d>(values, imsym::key::key_t{.letter = 'P', .sub = 0}));
+}
+
+TEST_CASE("at benchmark", "[.][benchmark]") {
+    constexpr int num_keys = 10000;
+    std::mt19937 gen(42);
+    auto builder = values_builder_t<double>{};
+    for (int i = 0; i < num_keys; i++) {
+        builder.set(imsym::key::key_t{.letter = 'P', .sub = i}, sym::Random<Pose3d>(gen));
+    }
+    const auto values = std::move(builder).finalize();
+    const auto index = create_index(values, keys(values));
+
+    BENCHMARK("at<Pose3d> over an index") {
+        double sum = 0;
+        for (const auto& entry : index.entries) {
+            sum += at<Pose3d>(values, entry).Position().x();
+        }
+        return sum;
+    };
+}
+
+TEST_CASE("bulk clone between sym::Values and values_t") {
+    std::mt19937 gen(42);
+    auto sym_values = sym::Valuesd{};
+    for (int i = 0; i < 100; i++) {
+        sym_values.Set<Pose3d>({'P', i}, sym::Random<Pose3d>(gen));
+        sym_values.Set<double>({'s', i}, i);
+    }
+    // leave a hole in the data
+    sym_values.Remove({'P', 50});
+
+    const auto values = imsym::values::clone(sym_values);
+    CHECK_EQUAL(values, sym_values);
+    CHECK_DATA_EQUAL(values, sym_values);
+    for (const auto& [k, entry] : sym_values.Items()) {
+        CHECK(values.map.at(imsym::key::to(k)) == imsym::values::to(entry));
+    }
+
+    const auto round_tripped = imsym::values::clone(values);
+    CHECK(round_tripped.Data() == sym_values.Data());
+    CHECK(round_tripped.NumEntries() == sym_values.NumEntries());
+    for (const auto& k : sym_values.Keys()) {
+        CHECK(round_tripped.Items().at(k).offset == sym_values.Items().at(k).offset);
+    }
+    CHECK(round_tripped.At<Pose3d>({'P', 3}) == sym_values.At<Pose3d>({'P', 3}));
+}
+
+TEST_CASE("clone benchmark", "[.][benchmark]") {
+    const int num_keys = GENERATE(1000, 100000, 1000000);
+    std::mt19937 gen(42);
+    auto sym_values = sym::Valuesd{};
+    for (int i = 0; i < num_keys; i++) {
+        sym_values.Set<Pose3d>({'P', i}, sym::Random<Pose3d>(gen));
+    }
+    const auto values = imsym::values::clone(sym_values);
+
+    BENCHMARK(fmt::format("clone sym::Values -> values_t {} keys", num_keys)) {
+        return imsym::values::clone(sym_values);
+    };
+    BENCHMARK(fmt::format("clone values_t -> sym::Values {} keys", num_keys)) {
+        return imsym::values::clone(values);
+    };
+}
+
+TEST_CASE("compaction") {
+    std::mt19937 gen(42);
+    auto builder = values_builder_t<double>{};
+    std::vector<Pose3d> poses;
+    for (int i = 0; i < 100; i++) {
+        poses.push_back(sym::Random<Pose3d>(gen));
+        builder.set(imsym::key::key_t{.letter = 'P', .sub = i}, poses.back());
+        builder.set(imsym::key::key_t{.letter = 's', .sub = i}, static_cast<double>(i));
+    }
+    auto values = std::move(builder).finalize();
+    const auto pose_dim = sym::StorageOps<Pose3d>::StorageDim();
+    CHECK(values.garbage == 0);
+
+    // drop every third pose and all the odd scalars
+    for (int i = 0; i < 100; i++) {
+        if (i % 3 == 0) {
+            values = remove(values, imsym::key::key_t{.letter = 'P', .sub = i});
+        }
+        if (i % 2 == 1) {
+            values = remove(values, imsym::key::key_t{.letter = 's', .sub = i});
+        }
+    }
+    // removing a missing key makes no garbage
+    values = remove(values, imsym::key::key_t{.letter = 'x'});
+    CHECK(values.garbage == 34 * pose_dim + 50);
+
+    const auto [compacted, removed] = cleanup(values);
+    CHECK(removed == 34 * pose_dim + 50);
+    CHECK(compacted.garbage == 0);
+    CHECK(compacted.data.size() == 66 * pose_dim + 50);
+    CHECK(compacted.map.size() == values.map.size());
+    for (int i = 0; i < 100; i++) {
+        const auto pose_key = imsym::key::key_t{.letter = 'P', .sub = i};
+        const auto scalar_key = imsym::key::key_t{.letter = 's', .sub = i};
+        CHECK(has(compacted, pose_key) == (i % 3 != 0));
+        if (has(compacted, pose_key)) {
+            CHECK(at<Pose3d>(compacted, pose_key) == poses[i]);
+        }
+        if (has(compacted, scalar_key)) {
+            CHECK(at<double>(compacted, scalar_key) == i);
+        }
+    }
+
+    SECTION("sliding window stays bounded with a policy") {
+        const auto policy = compaction_policy_t{.max_garbage_ratio = 0.5, .min_garbage = 64};
+        auto window = valuesd_t{};
+        for (int i = 0; i < 1000; i++) {
+            window = set(window, imsym::key::key_t{.letter = 'P', .sub = i}, poses[i % 100]);
+            if (i >= 10) {
+                window = remove(window, imsym::key::key_t{.letter = 'P', .sub = i - 10}, policy);
+            }
+            CHECK(window.data.size() <= 2 * (10 * pose_dim + policy.min_garbage));
+        }
+        CHECK(at<Pose3d>(window, imsym::key::key_t{.letter = 'P', .sub = 999}) == poses[99]);
+    }
+}
+
+TEST_CASE("update many keys through an index") {
+    constexpr int num_keys = 2000;
+    std::mt19937 gen(42);
+    auto builder_a = values_builder_t<double>{};
+    auto builder_b = values_builder_t<double>{};
+    std::vector<Pose3d> poses_a;
+    std::vector<Pose3d> poses_b;
+    for (int i = 0; i < num_keys; i++) {
+        poses_a.push_back(sym::Random<Pose3d>(gen));
+        poses_b.push_back(sym::Random<Pose3d>(gen));
+        builder_a.set(imsym::key::key_t{.letter = 'P', .sub = i}, poses_a.back());
+        builder_a.set(imsym::key::key_t{.letter = 's', .sub = i}, static_cast<double>(i));
+    }
+    // b is laid out in reverse so nothing lines up by offset
+    for (int i = num_keys - 1; i >= 0; i--) {
+        builder_b.set(imsym::key::key_t{.letter = 'P', .sub = i}, poses_b[i]);
+    }
+    const auto values_a = std::move(builder_a).finalize();
+    const auto values_b = std::move(builder_b).finalize();
+
+    // update every pose except each fifth one, in a shuffled order
+    auto update_keys = std::vector<imsym::key::key_t>{};
+    for (int i = 0; i < num_keys; i++) {
+        if (i % 5 != 0) {
+            update_keys.push_back(imsym::key::key_t{.letter = 'P', .sub = i});
+        }
+    }
+    std::shuffle(update_keys.begin(), update_keys.end(), gen);
+    const auto keys_to_update =
+        immer::vector<imsym::key::key_t>(update_keys.begin(), update_keys.end());
+
+    const auto updated = update(create_index(values_a, keys_to_update),
+                                create_index(values_b, keys_to_update),
+                                values_a,
+                                values_b);
+
+    CHECK(updated.data.size() == values_a.data.size());
+    CHECK(updated.map == values_a.map);
+    for (int i = 0; i < num_keys; i++) {
+        const auto pose_key = imsym::key::key_t{.letter = 'P', .sub = i};
+        CHECK(at<Pose3d>(updated, pose_key) == (i % 5 != 0 ? poses_b[i] : poses_a[i]));
+        CHECK(at<double>(updated, imsym::key::key_t{.letter = 's', .sub = i}) == i);
+    }
+    // the original is untouched
+    CHECK(at<Pose3d>(values_a, imsym::key::key_t{.letter = 'P', .sub = 1}) == poses_a[1]);
+}
+
+TEST_CASE("letter index") {
+    auto values = valuesd_t{};
+    for (int i = 0; i < 50; i++) {
+        values = set(values, imsym::key::key_t{.letter = 'P', .sub = i}, static_cast<double>(i));
+        values = set(values, imsym::key::key_t{.letter = 'L', .sub = i, .super = 2 * i}, 1.0);
+    }
+    const auto indexed = with_letter_index(values);
+    REQUIRE(indexed.letter_index.has_value());
+
+    auto CHECK_MATCHES_SCAN = [](const valuesd_t& with, const valuesd_t& without) {
+        for (const char letter : {'P', 'L', 'x'}) {
+            CHECK(get_largest_sub(with, letter) == get_largest_sub(without, letter));
+            CHECK(get_largest_super(with, letter) == get_largest_super(without, letter));
+            CHECK(keys_with_letter(with, letter).size() ==
+                  keys_with_letter(without, letter).size());
+            CHECK(keys_with_letter(with, letter, 10, 20) ==
+                  keys_with_letter(without, letter, 10, 20));
+        }
+        CHECK(find_letter_sub(with, imsym::key::key_t{.letter = 'L', .sub = 7}) ==
+              find_letter_sub(without, imsym::key::key_t{.letter = 'L', .sub = 7}));
+        CHECK(not find_letter_sub(with, imsym::key::key_t{.letter = 'L', .sub = 70}).has_value());
+    };
+
+    CHECK_MATCHES_SCAN(indexed, values);
+    CHECK(get_largest_sub(indexed, 'P') == 49);
+    CHECK(keys_with_letter(indexed, 'P', 10, 20).size() == 10);
+
+    SECTION("stays in sync through set, remove and drop_keys") {
+        auto with = set(indexed, imsym::key::key_t{.letter = 'P', .sub = 100}, 1.0);
+        auto without = set(values, imsym::key::key_t{.letter = 'P', .sub = 100}, 1.0);
+        with = remove(with, imsym::key::key_t{.letter = 'P', .sub = 100});
+        without = remove(without, imsym::key::key_t{.letter = 'P', .sub = 100});
+        const auto dropped = std::vector<imsym::key::key_t>{{'L', 15, 30}, {'P', 12}};
+        with = drop_keys(with, dropped);
+        without = drop_keys(without, dropped);
+        CHECK_MATCHES_SCAN(with, without);
+        CHECK(get_largest_sub(with, 'P') == 49);
+    }
+
+    SECTION("merge and extract") {
+        const auto other = valuesd_t{{imsym::key::key_t{.letter = 'P', .sub = 200}, 2.0}};
+        CHECK(get_largest_sub(merge(indexed, other), 'P') == 200);
+        const auto extracted =
+            extract(indexed,
+                    create_index(indexed,
+                                 {imsym::key::key_t{.letter = 'P', .sub = 3},
+                                  imsym::key::key_t{.letter = 'L', .sub = 4, .super = 8}}));
+        REQUIRE(extracted.letter_index.has_value());
+        CHECK(get_largest_sub(extracted, 'P') == 3);
+        CHECK(get_largest_super(extracted, 'L') == 8);
+    }
+
+    SECTION("versions share the index") {
+        const auto next = set(indexed, imsym::key::key_t{.letter = 'Q', .sub = 0}, 1.0);
+        CHECK(next.letter_index->letters.find('P')->identity() ==
+              indexed.letter_index->letters.find('P')->identity());
+    }
+}
+
+TEST_CASE("offset index") {
+    auto values = valuesd_t{};
+    for (int i = 0; i < 2000; i++) {
+        values = set(values, imsym::key::key_t{.letter = 'x', .sub = i}, static_cast<double>(i));
+        if (i % 10 == 0) {
+            values = set(values, imsym::key::key_t{.letter = 'P', .sub = i}, Pose3d{});
+        }
+    }
+    const auto indexed = with_offset_index(values);
+    REQUIRE(indexed.offset_index.has_value());
+    CHECK(indexed.offset_index->entries.size() == values.map.size());
+
+    // the index matches one rebuilt from scratch
+    auto CHECK_IN_SYNC = [](const valuesd_t& v) {
+        REQUIRE(v.offset_index.has_value());
+        CHECK(v.offset_index->entries == with_offset_index(v).offset_index->entries);
+    };
+
+    SECTION("stays in sync") {
+        auto next = set(indexed, imsym::key::key_t{.letter = 'y'}, 1.0);
+        CHECK_IN_SYNC(next);
+        next = remove(next, imsym::key::key_t{.letter = 'x', .sub = 5});
+        CHECK_IN_SYNC(next);
+        next = drop_keys(next, std::vector<imsym::key::key_t>{{'x', 6}, {'P', 10}});
+        CHECK_IN_SYNC(next);
+        next = merge(next, valuesd_t{{imsym::key::key_t{.letter = 'x', .sub = 7}, 3.0}});
+        CHECK_IN_SYNC(next);
+        next = compact(next);
+        CHECK_IN_SYNC(next);
+        CHECK(extract(next, create_index(next, keys(next))).offset_index.has_value());
+    }
+
+    SECTION("diff only looks under the changed data") {
+        auto builder = values_builder_t<double>{indexed};
+        builder.set(imsym::key::key_t{.letter = 'x', .sub = 3}, -1.0);
+        builder.set(imsym::key::key_t{.letter = 'x', .sub = 1500}, -1.0);
+        builder.set(imsym::key::key_t{.letter = 'P', .sub = 1000},
+                    Pose3d(Rot3d::FromQuaternion({0, 1, 0, 0}), Vector3d{1, 2, 3}));
+        const auto changed = std::move(builder).finalize();
+        CHECK_IN_SYNC(changed);
+
+        const auto with = diff(indexed, changed);
+        const auto without = diff(values, changed);
+        CHECK(with.added.size() == 0);
+        CHECK(with.removed.size() == 0);
+        CHECK(with.changed.size() == 3);
+        CHECK(with.changed.size() == without.changed.size());
+
+        // only the rewritten leaves come up
+        size_t chunks = 0;
+        for_each_unshared_chunk(indexed.data, changed.data, [&](auto...) {
+            chunks++;
+        });
+        CHECK(chunks <= 3);
+    }
+}
+
+TEST_CASE("unshared chunk walk") {
+    using data_t = valuesd_t::data_t;
+    CHECK(imsym::values::detail::kTreeWalk<data_t>);
+    CHECK(imsym::values::detail::kTreeWalk<immer::vector<double>>);
+
+    auto range = std::vector<double>(100000);
+    std::iota(range.begin(), range.end(), 0.0);
+    const auto a = data_t(range.begin(), range.end());
+
+    // against the leaf by leaf walk over the whole prefix
+    auto CHECK_MATCHES_LEAF_WALK = [](const data_t& x, const data_t& y) {
+        auto walked = std::vector<std::pair<size_t, const double*>>{};
+        for_each_unshared_chunk(x, y, [&](size_t offset, const double* first, const double*) {
+            walked.push_back({offset, first});
+        });
+        auto expected = std::vector<std::pair<size_t, const double*>>{};
+        imsym::values::detail::for_each_unshared_chunk_in(
+            x, y, 0, std::min(x.size(), y.size()), [&](size_t offset, const double* first, auto) {
+                expected.push_back({offset, first});
+            });
+        CHECK(walked == expected);
+    };
+
+    CHECK_MATCHES_LEAF_WALK(a, a.set(12345, -1.0));
+    CHECK_MATCHES_LEAF_WALK(a, a.set(0, -1.0).set(99999, -1.0));
+    CHECK_MATCHES_LEAF_WALK(a, a.push_back(-1.0).push_back(-2.0));
+    CHECK_MATCHES_LEAF_WALK(a.push_back(-1.0), a);
+    CHECK_MATCHES_LEAF_WALK(a, a.take(777) + a.drop(777));
+    CHECK_MATCHES_LEAF_WALK(a, a.insert(50000, -1.0));
+    const auto joined = a.take(40000) + a.drop(40000);
+    CHECK_MATCHES_LEAF_WALK(joined, joined.set(3, 0));
+    CHECK_MATCHES_LEAF_WALK(joined, joined.set(45000, 0).push_back(1));
+    CHECK_MATCHES_LEAF_WALK(a.take(10), a.set(3, 0));
+}
+
+TEST_CASE("key hash") {
+    using imsym::key::key_t;
+    const auto hash = imsym::key::hash_t{};
+
+    SECTION("keys that fit in a word hash to their packed fields") {
+        const auto keys = std::vector<key_t>{
+            key_t{.letter = 'P'},
+            key_t{.letter = 'P', .sub = 0},
+            key_t{.letter = 'P', .sub = -1},
+            key_t{.letter = 'x', .sub = 12345, .super = 99},
+            key_t{.letter = 'x', .sub = -12345, .super = -99},
+            key_t{.letter = 'L', .sub = (int64_t{1} << 39) - 1, .super = (1 << 14) - 1},
+            key_t{.letter = static_cast<char>(-3), .sub = 7},
+        };
+        auto hashes = std::unordered_set<size_t>{};
+        for (const auto& key : keys) {
+            CHECK(imsym::key::detail::packed_word(key).has_value());
+            const auto packed = imsym::key::pack(key);
+            CHECK(not(packed.word & imsym::key::detail::kWideTag));
+            CHECK(imsym::key::unpack(packed) == key);
+            CHECK(hash(packed) == hash(key));
+            hashes.insert(hash(key));
+        }
+        CHECK(hashes.size() == keys.size());
+        // sequential subscripts differ only in the low bits
+        CHECK((hash(key_t{.letter = 'P', .sub = 4}) ^ hash(key_t{.letter = 'P', .sub = 5})) < 16);
+    }
+
+    SECTION("keys that don't fit fall back") {
+        const auto too_big = key_t{.letter = 'P', .sub = int64_t{1} << 39};
+        const auto too_small = key_t{.letter = 'P', .sub = 1, .super = -(1 << 14)};
+        CHECK(not imsym::key::detail::packed_word(too_big).has_value());
+        CHECK(not imsym::key::detail::packed_word(too_small).has_value());
+
+        // wide keys are interned, packing twice gives the same word
+        const auto wide = imsym::key::pack(too_big);
+        CHECK((wide.word & imsym::key::detail::kWideTag) != 0);
+        CHECK(imsym::key::pack(too_big) == wide);
+        CHECK(imsym::key::pack(too_small) != wide);
+        CHECK(imsym::key::unpack(wide) == too_big);
+        CHECK(imsym::key::unpack(imsym::key::pack(too_small)) == too_small);
+
+        const auto small = key_t{.letter = 'P', .sub = 0};
+        auto map = valuesd_t::map_t{};
+        map = std::move(map).set(too_big, index_entry_t{.key = too_big});
+        map = std::move(map).set(too_small, index_entry_t{.key = too_small});
+        map = std::move(map).set(small, index_entry_t{.key = small});
+        CHECK(map.at(too_big).key == too_big);
+        CHECK(map.at(too_small).key == too_small);
+        CHECK(map.at(small).key == small);
+        CHECK(map.find(key_t{.letter = 'P', .sub = 1}) == nullptr);
+    }
+
+    SECTION("the values map is keyed on one word") {
+        static_assert(std::is_same_v<valuesd_t::map_t::key_type, imsym::key::packed_key_t>);
+        static_assert(sizeof(imsym::key::packed_key_t) == sizeof(uint64_t));
+        const auto key = key_t{.letter = 'x', .sub = 3, .super = 2};
+        CHECK(imsym::key::to(imsym::key::pack(key)) == imsym::key::to(key));
+    }
+
+    SECTION("distinct keys hash apart") {
+        auto hashes = std::unordered_set<size_t>{};
+        for (const char letter : {'P', 'L', 'v'}) {
+            for (int64_t sub = -100; sub < 1000; sub++) {
+                hashes.insert(hash(key_t{.letter = letter, .sub = sub}));
+            }
+        }
+        CHECK(hashes.size() == 3 * 1100);
+    }
+}
+
+TEST_CASE("key map benchmark", "[.][benchmark]") {
+    constexpr int num_keys = 200000;
+    auto keys = std::vector<imsym::key::key_t>{};
+    for (int i = 0; i < num_keys; i++) {
+        keys.push_back(imsym::key::key_t{.letter = "PLV"[i % 3], .sub = i / 3});
+    }
+
+    auto run = [&]<typename Map>(const std::string& name) {
+        BENCHMARK(name + " insert") {
+            auto map = typename Map::transient_type{};
+            for (const auto& k : keys) {
+                map.set(k, 1);
+            }
+            return map.size();
+        };
+        auto map = Map{};
+        for (const auto& k : keys) {
+            map = std::move(map).set(k, 1);
+        }
+        BENCHMARK(name + " lookup") {
+            size_t found = 0;
+            for (const auto& k : keys) {
+                found += map.count(k);
+            }
+            return found;
+        };
+    };
+
+    using imsym::key::key_t;
+    using imsym::key::packed_key_t;
+    run.template operator()<immer::map<key_t, int>>("key_t, generic struct hash");
+    run.template operator()<immer::map<key_t, int, imsym::key::hash_t>>("key_t, hash_t");
+    run.template operator()<immer::map<packed_key_t, int>>("packed_key_t");
+}
+
+TEST_CASE("structure sharing archive of snapshots") {
+    constexpr int num_keys = 1000;
+    constexpr int num_snapshots = 20;
+    std::mt19937 gen(42);
+    auto builder = values_builder_t<double>{};
+    for (int i = 0; i < num_keys; i++) {
+        builder.set(imsym::key::key_t{.letter = 'P', .sub = i}, sym::Random<Pose3d>(gen));
+    }
+
+    // each snapshot moves one pose, every few a key comes or goes
+    auto snapshots = std::vector<valuesd_t>{std::move(builder).finalize()};
+    for (int i = 1; i < num_snapshots; i++) {
+        auto values = set(snapshots.back(),
+                          imsym::key::key_t{.letter = 'P', .sub = (i * 37) % num_keys},
+                          sym::Random<Pose3d>(gen));
+        if (i % 4 == 0) {
+            const auto landmark = sym::Vector3d::Constant(i);
+            values = set(values, imsym::key::key_t{.letter = 'L', .sub = i}, landmark);
+        }
+        if (i % 5 == 0) {
+            values = remove(values, imsym::key::key_t{.letter = 'P', .sub = i});
+        }
+        snapshots.push_back(values);
+    }
+    snapshots.push_back(with_letter_index(snapshots.back()));
+
+    const auto archive = persist(snapshots);
+    REQUIRE(archive.snapshots.size() == snapshots.size());
+
+    // the first snapshot is written in full, the rest only by what changed
+    size_t scalars_written = 0;
+    for (const auto& leaf : archive.leaves) {
+        scalars_written += leaf.size();
+    }
+    const auto full_size = snapshots.front().data.size();
+    CHECK(scalars_written >= full_size);
+    CHECK(scalars_written < 2 * full_size);
+    for (size_t i = 1; i < archive.snapshots.size(); i++) {
+        CHECK(archive.snapshots[i].set.size() <= 2);
+        CHECK(archive.snapshots[i].data.size() < 10);
+    }
+
+    const auto restored = restore(archive);
+    REQUIRE(restored.size() == snapshots.size());
+    for (size_t i = 0; i < snapshots.size(); i++) {
+        const auto changes = diff(snapshots[i], restored[i]);
+        CHECK(changes.added.size() + changes.removed.size() + changes.changed.size() == 0);
+        CHECK(restored[i].garbage == snapshots[i].garbage);
+        CHECK(restored[i].letter_index.has_value() == snapshots[i].letter_index.has_value());
+    }
+
+    // restored snapshots share the nodes they didn't change
+    for (size_t i = 1; i < restored.size(); i++) {
+        size_t unshared = 0;
+        for_each_unshared_chunk(restored[i - 1].data,
+                                restored[i].data,
+                                [&](const size_t, const double* first, const double* last) {
+                                    unshared += last - first;
+                                });
+        CHECK(unshared < full_size / 10);
+    }
+
+    SECTION("cereal round trip") {
+        auto out = std::ostringstream{};
+        {
+            auto archive_out = cereal::BinaryOutputArchive(out);
+            archive_out(archive);
+        }
+        auto in = std::istringstream{out.str()};
+        auto archive_in = cereal::BinaryInputArchive(in);
+        auto loaded = values_archived_t{};
+        archive_in(loaded);
+        REQUIRE(loaded.snapshots.size() == archive.snapshots.size());
+        CHECK(loaded.leaves.size() == archive.leaves.size());
+        const auto reloaded = restore(loaded);
+        for (size_t i = 0; i < snapshots.size(); i++) {
+            CHECK(contents_equal(reloaded[i], snapshots[i]));
+        }
+    }
+
+    SECTION("stream round trip") {
+        auto out = std::ostringstream{};
+        {
+            auto archive_out = cereal::BinaryOutputArchive(out);
+            auto writer = values_stream_writer_t<double, cereal::BinaryOutputArchive>{archive_out};
+            for (const auto& values : snapshots) {
+                writer.push(values);
+            }
+            writer.finish();
+        }
+        // about the size of the in memory archive, not snapshots x problem size
+        CHECK(out.str().size() < 3 * full_size * sizeof(double));
+
+        auto in = std::istringstream{out.str()};
+        auto archive_in = cereal::BinaryInputArchive(in);
+        auto reader = values_stream_reader_t<double, cereal::BinaryInputArchive>{archive_in};
+        size_t count = 0;
+        auto previous = valuesd_t{};
+        while (const auto values = reader.next()) {
+            REQUIRE(count < snapshots.size());
+            CHECK(contents_equal(*values, snapshots[count]));
+            CHECK(values->letter_index.has_value() == snapshots[count].letter_index.has_value());
+            if (count > 0) {
+                size_t unshared = 0;
+                for_each_unshared_chunk(
+                    previous.data, values->data, [&](size_t, const double* first, auto last) {
+                        unshared += last - first;
+                    });
+                CHECK(unshared < full_size / 10);
+            }
+            previous = *values;
+            count++;
+        }
+        CHECK(count == snapshots.size());
+        CHECK(not reader.next().has_value());
+    }
+}
+
+TEST_CASE("memory mapped values view") {
+    std::mt19937 gen(7);
+    auto poses = std::vector<Pose3d>{};
+    auto builder = values_builder_t<double>{};
+    for (int i = 0; i < 500; i++) {
+        poses.push_back(sym::Random<Pose3d>(gen));
+        builder.set(imsym::key::key_t{.letter = 'P', .sub = i}, poses.back());
+        builder.set(imsym::key::key_t{.letter = 'v', .sub = i, .super = 2}, Vector3d::Constant(i));
+    }
+    builder.set(imsym::key::key_t{.letter = 'R'}, Rot3d::FromQuaternion({0, 1, 0, 0}));
+    auto values = remove(std::move(builder).finalize(), imsym::key::key_t{.letter = 'P', .sub = 3});
+
+    const auto path =
+        (std::filesystem::temp_directory_path() / "imsym_values_view_test.bin").string();
+    save_view(values, path);
+
+    const auto view = open_view<double>(path);
+    CHECK(view.num_entries() == values.map.size());
+    CHECK(view.num_scalars() == values.data.size());
+
+    CHECK(has(view, imsym::key::key_t{.letter = 'P', .sub = 0}));
+    CHECK(not has(view, imsym::key::key_t{.letter = 'P', .sub = 3}));
+    CHECK(not has(view, imsym::key::key_t{.letter = 'v', .sub = 0}));
+    CHECK(at<Pose3d>(view, imsym::key::key_t{.letter = 'P', .sub = 42}) == poses[42]);
+    CHECK(at<Vector3d>(view, imsym::key::key_t{.letter = 'v', .sub = 7, .super = 2}) ==
+          Vector3d::Constant(7));
+    CHECK_THROWS(at<Pose3d>(view, imsym::key::key_t{.letter = 'v', .sub = 7, .super = 2}));
+    CHECK_THROWS(at<Pose3d>(view, imsym::key::key_t{.letter = 'x'}));
+    // same storage size, different type
+    CHECK_THROWS(at<sym::Vector4d>(view, imsym::key::key_t{.letter = 'R'}));
+    CHECK(at<Rot3d>(view, imsym::key::key_t{.letter = 'R'}) == Rot3d::FromQuaternion({0, 1, 0, 0}));
+
+    const auto view_keys = keys(view);
+    CHECK(view_keys.size() == values.map.size());
+    CHECK(std::is_sorted(view_keys.begin(), view_keys.end(), [](const auto& a, const auto& b) {
+        return std::tie(a.letter, a.sub, a.super) < std::tie(b.letter, b.sub, b.super);
+    }));
+
+    SECTION("round trip to values_t") {
+        const auto cloned = clone(view);
+        const auto changes = diff(values, cloned);
+        CHECK(changes.added.size() + changes.removed.size() + changes.changed.size() == 0);
+        CHECK(cloned.garbage == values.garbage);
+    }
+
+    SECTION("the view outlives copies of itself") {
+        auto copy = view;
+        CHECK(at<Pose3d>(copy, imsym::key::key_t{.letter = 'P', .sub = 1}) == poses[1]);
+    }
+
+    SECTION("a different scalar type is rejected") {
+        CHECK_THROWS(open_view<float>(path));
+    }
+
+    SECTION("a header pointing past the end of the file is rejected") {
+        const auto corrupt =
+            (std::filesystem::temp_directory_path() / "imsym_values_view_corrupt.bin").string();
+        std::filesystem::copy_file(
+            path, corrupt, std::filesystem::copy_options::overwrite_existing);
+        auto header = *view.header;
+        // wraps around to a small byte count if multiplied out
+        header.num_entries = (uint64_t{1} << 63) / sizeof(view_entry_t) * 2;
+        {
+            auto file = std::fstream(corrupt, std::ios::binary | std::ios::in | std::ios::out);
+            file.write(reinterpret_cast<const char*>(&header), sizeof(header));
+        }
+        CHECK_THROWS(open_view<double>(corrupt));
+        std::filesystem::remove(corrupt);
+    }
+
+    std::filesystem::remove(path);
+}
+
+TEST_CASE("memoized hashing") {
+    std::mt19937 gen(3);
+    auto builder = values_builder_t<double>{};
+    for (int i = 0; i < 2000; i++) {
+        builder.set(imsym::key::key_t{.letter = 'P', .sub = i}, sym::Random<Pose3d>(gen));
+    }
+    const auto values = std::move(builder).finalize();
+    const auto edited = set(values, imsym::key::key_t{.letter = 'P', .sub = 10}, Pose3d{});
+    const auto grown = set(edited, imsym::key::key_t{.letter = 'L', .sub = 0}, Vector3d::Ones());
+
+    auto hasher = imsym::hasher_t{};
+    const auto h_values = imsym::hash(hasher, values);
+    CHECK(imsym::hash(hasher, values) == h_values);
+
+    SECTION("edits change the hash, incremental and fresh hashers agree") {
+        const auto h_edited = imsym::hash(hasher, edited);
+        const auto h_grown = imsym::hash(hasher, grown);
+        CHECK(h_edited != h_values);
+        CHECK(h_grown != h_edited);
+
+        auto fresh = imsym::hasher_t{};
+        CHECK(imsym::hash(fresh, grown) == h_grown);
+        CHECK(imsym::hash(fresh, edited) == h_edited);
+        CHECK(imsym::hash(fresh, values) == h_values);
+    }
+
+    SECTION("equal contents built differently hash the same") {
+        // a different leaf layout over the same scalars
+        auto copy = values;
+        copy.data = valuesd_t::data_t{} + values.data.take(1000) + values.data.drop(1000);
+        auto fresh = imsym::hasher_t{};
+        CHECK(imsym::hash(fresh, copy) == h_values);
+    }
+
+    SECTION("retention is bounded, evicted entries are recomputed") {
+        auto bounded = imsym::hasher_t{8};
+        auto fresh = imsym::hasher_t{};
+        auto current = values;
+        for (int i = 0; i < 100; i++) {
+            current = set(current, imsym::key::key_t{.letter = 'P', .sub = i}, Pose3d{});
+            CHECK(imsym::hash(bounded, current) == imsym::hash(fresh, current));
+            CHECK(bounded.retained() <= 8);
+        }
+        CHECK(imsym::hash(bounded, values) == h_values);
+        CHECK(imsym::hash(bounded, edited) == imsym::hash(hasher, edited));
+    }
+
+    SECTION("matrices and stats") {
+        const auto sparse = imsym::sparse_matrix_t{.size = {3, 3},
+                                                   .column_pointers = {0, 1, 2, 2},
+                                                   .row_indices = {0, 2},
+                                                   .values = {1.0, 2.0}};
+        auto dense = imsym::dense_matrix_t{.size = {2, 2}, .data = {1.0, 2.0, 3.0, 4.0}};
+
+        auto stats = imsym::optimization_stats_t{};
+        for (int16_t i = 0; i < 3; i++) {
+            auto iteration = imsym::optimization_iteration_t{};
+            iteration.iteration = i;
+            iteration.values = i == 0 ? values : edited;
+            iteration.jacobian_values = i == 0 ? dense.data : sparse.values;
+            stats.iterations = stats.iterations.push_back(iteration);
+        }
+        stats.jacobian_sparsity = imsym::structure(sparse);
+        stats.cholesky_factor_sparsity = sparse;
+
+        const auto h_stats = imsym::hash(hasher, stats);
+        CHECK(imsym::hash(hasher, stats) == h_stats);
+
+        auto changed = stats;
+        auto sparse_2 = sparse;
+        sparse_2.column_pointers = {0, 1, 3, 3};
+        sparse_2.row_indices = {0, 1, 2};
+        sparse_2.values = {1.0, 3.0, 2.0};
+        changed.cholesky_factor_sparsity = sparse_2;
+        CHECK(imsym::hash(hasher, changed) != h_stats);
+        CHECK(imsym::hash(hasher, sparse_2) != imsym::hash(hasher, sparse));
+
+        auto fresh = imsym::hasher_t{};
+        CHECK(imsym::hash(fresh, changed) == imsym::hash(hasher, changed));
+        CHECK(imsym::hash(fresh, dense) == imsym::hash(hasher, dense));
+    }
+}
+
+TEST_CASE("memoized hashing benchmark", "[.][benchmark]") {
+    std::mt19937 gen(3);
+    auto builder = values_builder_t<double>{};
+    for (int i = 0; i < 100000; i++) {
+        builder.set(imsym::key::key_t{.letter = 'P', .sub = i}, sym::Random<Pose3d>(gen));
+    }
+    const auto values = std::move(builder).finalize();
+    auto hasher = imsym::hasher_t{};
+    imsym::hash(hasher, values);
+
+    int sub = 0;
+    BENCHMARK("std::hash after one edit") {
+        const auto edited = set(values, imsym::key::key_t{.letter = 'P', .sub = sub++}, Pose3d{});
+        return std::hash<valuesd_t>{}(edited);
+    };
+    BENCHMARK("hasher_t after one edit") {
+        const auto edited = set(values, imsym::key::key_t{.letter = 'P', .sub = sub++}, Pose3d{});
+        return imsym::hash(hasher, edited);
+    };
+}
+
+TEST_CASE("contents_equal skips shared structure") {
+    std::mt19937 gen(11);
+    auto builder = values_builder_t<double>{};
+    for (int i = 0; i < 5000; i++) {
+        builder.set(imsym::key::key_t{.letter = 'P', .sub = i}, sym::Random<Pose3d>(gen));
+    }
+    const auto values = std::move(builder).finalize();
+    const auto key = imsym::key::key_t{.letter = 'P', .sub = 1234};
+    const auto pose = at<Pose3d>(values, key);
+
+    CHECK(contents_equal(values, values));
+    CHECK(contents_equal(values, imsym::values::clone(imsym::values::clone(values))));
+
+    const auto nudged_pose = Pose3d(pose.Rotation(), pose.Position() + Vector3d::Constant(1e-12));
+    const auto nudged = set(values, key, nudged_pose);
+    CHECK(not contents_equal(values, nudged));
+    CHECK(contents_equal(values, nudged, 1e-9));
+
+    const auto moved = set(values, key, Pose3d{});
+    CHECK(not contents_equal(values, moved, 1e-9));
+
+    const auto removed = remove(values, key);
+    CHECK(not contents_equal(values, removed));
+    CHECK(not contents_equal(values.map, removed.map));
+}
+
+TEST_CASE("contents_equal benchmark", "[.][benchmark]") {
+    std::mt19937 gen(11);
+    auto builder = values_builder_t<double>{};
+    auto other = values_builder_t<double>{};
+    for (int i = 0; i < 100000; i++) {
+        const auto k = imsym::key::key_t{.letter = 'P', .sub = i};
+        builder.set(k, sym::Random<Pose3d>(gen));
+        other.set(k, sym::Random<Pose3d>(gen));
+    }
+    const auto values = std::move(builder).finalize();
+    const auto slightly_changed = set(values, imsym::key::key_t{.letter = 'P', .sub = 5}, Pose3d{});
+    const auto fully_different = std::move(other).finalize();
+    // same contents, no shared nodes
+    const auto copy = imsym::values::clone(imsym::values::clone(values));
+
+    // entry by entry and element by element, what contents_equal used to do
+    const auto naive = [](const valuesd_t& a, const valuesd_t& b) {
+        for (const auto& [k, entry] : a.map) {
+            const auto* found = b.map.find(k);
+            if (found == nullptr or *found != entry) {
+                return false;
+            }
+        }
+        return a.map.size() == b.map.size() and
+               std::equal(a.data.begin(), a.data.end(), b.data.begin(), b.data.end());
+    };
+
+    BENCHMARK("naive identical") {
+        return naive(values, values);
+    };
+    BENCHMARK("contents_equal identical") {
+        return contents_equal(values, values);
+    };
+    BENCHMARK("naive slightly changed") {
+        return naive(values, slightly_changed);
+    };
+    BENCHMARK("contents_equal slightly changed") {
+        return contents_equal(values, slightly_changed);
+    };
+    BENCHMARK("naive unshared copy") {
+        return naive(values, copy);
+    };
+    BENCHMARK("contents_equal unshared copy") {
+        return contents_equal(values, copy);
+    };
+    BENCHMARK("naive fully different") {
+        return naive(values, fully_different);
+    };
+    BENCHMARK("contents_equal fully different") {
+        return contents_equal(values, fully_different);
+    };
+}
+
+TEST_CASE("batched retract and local coordinates") {
+    constexpr double epsilon = 1e-10;
+    std::mt19937 gen(5);
+    auto builder = values_builder_t<double>{};
+    for (int i = 0; i < 50; i++) {
+        builder.set(imsym::key::key_t{.letter = 'P', .sub = i}, sym::Random<Pose3d>(gen));
+        builder.set(imsym::key::key_t{.letter = 'v', .sub = i}, Vector3d::Constant(i));
+        builder.set(imsym::key::key_t{.letter = 'R', .sub = i}, sym::Random<Rot3d>(gen));
+        builder.set(imsym::key::key_t{.letter = 's', .sub = i}, 0.5 * i);
+    }
+    const auto values = std::move(builder).finalize();
+    auto sym_values = imsym::values::clone(values);
+
+    // a subset of the keys, in an order unrelated to the storage
+    auto some_keys = immer::vector<imsym::key::key_t>{};
+    for (int i = 49; i >= 0; i -= 3) {
+        for (const char letter : {'s', 'R', 'v', 'P'}) {
+            const auto k = imsym::key::key_t{.letter = letter, .sub = i};
+            some_keys = std::move(some_keys).push_back(k);
+        }
+    }
+    const auto index = create_index(values, some_keys);
+    const auto sym_index = sym_values.CreateIndex(imsym::key::to(some_keys));
+    REQUIRE(index.tangent_dim == sym_index.tangent_dim);
+
+    std::uniform_real_distribution<double> dist(-0.1, 0.1);
+    auto delta = Eigen::VectorXd(index.tangent_dim);
+    for (int i = 0; i < delta.rows(); i++) {
+        delta[i] = dist(gen);
+    }
+
+    const auto retracted = retract(values, index, delta, epsilon);
+    auto sym_retracted = sym_values;
+    sym_retracted.Retract(sym_index, delta.data(), epsilon);
+
+    REQUIRE(retracted.data.size() == sym_retracted.Data().size());
+    for (size_t i = 0; i < retracted.data.size(); i++) {
+        CHECK_THAT(retracted.data[i], WithinAbs(sym_retracted.Data()[i], tol));
+    }
+    // keys outside the index are untouched
+    CHECK(at<Pose3d>(retracted, imsym::key::key_t{.letter = 'P', .sub = 0}) ==
+          at<Pose3d>(values, imsym::key::key_t{.letter = 'P', .sub = 0}));
+
+    const auto local = local_coordinates(retracted, values, index, epsilon);
+    const auto sym_local = sym_retracted.LocalCoordinates(sym_values, sym_index, epsilon);
+    REQUIRE(local.rows() == sym_local.rows());
+    CHECK(local.isApprox(sym_local, 1e-9));
+    CHECK(local.isApprox(delta, 1e-6));
+}
+
+TEST_CASE("batched retract benchmark", "[.][benchmark]") {
+    constexpr double epsilon = 1e-10;
+    std::mt19937 gen(5);
+    auto builder = values_builder_t<double>{};
+    for (int i = 0; i < 20000; i++) {
+        builder.set(imsym::key::key_t{.letter = 'P', .sub = i}, sym::Random<Pose3d>(gen));
+        builder.set(imsym::key::key_t{.letter = 'v', .sub = i}, Vector3d::Constant(i));
+    }
+    const auto values = std::move(builder).finalize();
+    const auto index = create_index(values, keys(values));
+    const Eigen::VectorXd delta = Eigen::VectorXd::Constant(index.tangent_dim, 1e-3);
+    auto sym_values = imsym::values::clone(values);
+    const auto sym_index = sym_values.CreateIndex(sym_values.Keys());
+
+    BENCHMARK("imsym retract") {
+        return retract(values, index, delta, epsilon);
+    };
+    BENCHMARK("sym::Values retract") {
+        sym_values.Retract(sym_index, delta.data(), epsilon);
+        return sym_values.Data().size();
+    };
+}
+
+TEST_CASE("type dispatch table") {
+    using imsym::values::visit_type;
+
+    bool pose = false;
+    const auto is_pose = [&]<typename T>(std::type_identity<T>) {
+        pose = std::is_same_v<T, Pose3d>;
+    };
+    CHECK(visit_type<double>(sym::StorageOps<Pose3d>::TypeEnum(), is_pose));
+    CHECK(pose);
+
+    int storage_dim = 0;
+    CHECK(visit_type<float>(sym::StorageOps<sym::Matrix34f>::TypeEnum(), [&](auto type) {
+        storage_dim = sym::StorageOps<typename decltype(type)::type>::StorageDim();
+    }));
+    CHECK(storage_dim == 12);
+
+    const auto values = valuesd_t{
+        {imsym::key::key_t{.letter = 'P'}, Pose3d{}},
+        {imsym::key::key_t{.letter = 'R'}, Rot3d{}},
+        {imsym::key::key_t{.letter = 'v'}, Vector3d{1, 2, 3}},
+        {imsym::key::key_t{.letter = 's'}, 4.0},
+    };
+    int visited = 0;
+    double sum = 0;
+    for_each_entry(values, [&](const index_entry_t& entry, const auto& value) {
+        using T = std::decay_t<decltype(value)>;
+        CHECK(entry.type == sym::StorageOps<T>::TypeEnum());
+        if constexpr (std::is_same_v<T, Vector3d>) {
+            sum += value.sum();
+        } else if constexpr (std::is_same_v<T, double>) {
+            sum += value;
+        }
+        visited++;
+    });
+    CHECK(visited == 4);
+    CHECK(sum == 10.0);
+
+    // a type outside AllowedTypes isn't visited, and still prints as its storage
+    const auto key = imsym::key::key_t{.letter = 'v'};
+    auto entry = *values.map.find(key);
+    entry.type = sym::type_t::DATABUFFER;
+    auto unknown = values;
+    unknown.map = unknown.map.set(key, entry);
+    CHECK_FALSE(try_visit_entry(unknown, entry, [](const auto&, const auto&) {}));
+    CHECK_THROWS(visit_entry(unknown, entry, [](const auto&, const auto&) {}));
+    CHECK_NOTHROW(fmt::format("{}", unknown));
+}
+
+TEST_CASE("cast between double and float values") {
+    std::mt19937 gen(9);
+    auto builder = values_builder_t<double>{};
+    auto poses = std::vector<Pose3d>{};
+    for (int i = 0; i < 1000; i++) {
+        poses.push_back(sym::Random<Pose3d>(gen));
+        builder.set(imsym::key::key_t{.letter = 'P', .sub = i}, poses.back());
+    }
+    const auto values = std::move(builder).finalize();
+
+    const auto as_float = cast<float>(values);
+    CHECK(as_float.map == values.map);
+    REQUIRE(as_float.data.size() == values.data.size());
+    for (const auto i : {0, 17, 999}) {
+        const auto key = imsym::key::key_t{.letter = 'P', .sub = i};
+        CHECK(at<sym::Pose3f>(as_float, key).IsApprox(poses[i].Cast<float>(), 1e-6f));
+    }
+
+    const auto back = cast<double>(as_float);
+    for (size_t i = 0; i < values.data.size(); i++) {
+        CHECK_THAT(back.data[i], WithinAbs(values.data[i], 1e-6));
+    }
+    CHECK(cast<double>(values).data.identity() == values.data.identity());
+}
+
+TEST_CASE("cast benchmark", "[.][benchmark]") {
+    std::mt19937 gen(9);
+    auto builder = values_builder_t<double>{};
+    for (int i = 0; i < 100000; i++) {
+        builder.set(imsym::key::key_t{.letter = 'P', .sub = i}, sym::Random<Pose3d>(gen));
+    }
+    const auto values = std::move(builder).finalize();
+
+    BENCHMARK("cast<float>") {
+        return cast<float>(values);
+    };
+    BENCHMARK("per key at and set") {
+        auto out = values_builder_t<float>{};
+        for (const auto& [k, entry] : values.map) {
+            out.set(k, at<Pose3d>(values, entry).Cast<float>());
+        }
+        return std::move(out).finalize();
+    };
+}
+
+TEST_CASE("extract coalesces contiguous keys into runs") {
+    std::mt19937 gen(13);
+    auto builder = values_builder_t<double>{};
+    auto poses = std::vector<Pose3d>{};
+    for (int i = 0; i < 1000; i++) {
+        poses.push_back(sym::Random<Pose3d>(gen));
+        builder.set(imsym::key::key_t{.letter = 'P', .sub = i}, poses.back());
+    }
+    const auto values = std::move(builder).finalize();
+
+    // a sliding window of consecutive poses plus a couple of stragglers
+    auto window = immer::vector<imsym::key::key_t>{};
+    for (int i = 400; i < 600; i++) {
+        window = std::move(window).push_back(imsym::key::key_t{.letter = 'P', .sub = i});
+    }
+    window = std::move(window).push_back(imsym::key::key_t{.letter = 'P', .sub = 7});
+    window = std::move(window).push_back(imsym::key::key_t{.letter = 'P', .sub = 3});
+    const auto index = create_index(values, window);
+
+    const auto [extracted, extracted_index] = extract_indexed(values, index);
+    CHECK(extracted.map.size() == window.size());
+    CHECK(extracted.data.size() == window.size() * 7);
+    CHECK(extracted_index.storage_dim == index.storage_dim);
+    CHECK(extracted_index.tangent_dim == index.tangent_dim);
+    REQUIRE(extracted_index.entries.size() == index.entries.size());
+    for (size_t i = 0; i < window.size(); i++) {
+        const auto& entry = extracted_index.entries[i];
+        CHECK(entry.key == window[i]);
+        CHECK(entry == extracted.map.at(window[i]));
+        CHECK(at<Pose3d>(extracted, entry) == poses[window[i].sub]);
+    }
+    CHECK(contents_equal(extract(values, index), extracted));
+
+    // the window comes out as one slice, only the leaves at its edges aren't shared
+    size_t unshared = 0;
+    const auto window_data = values.data.drop(400 * 7).take(200 * 7);
+    for_each_unshared_chunk(window_data,
+                            extracted.data.take(200 * 7),
+                            [&](const size_t, const double* first, const double* last) {
+                                unshared += last - first;
+                            });
+    CHECK(unshared < 200 * 7 / 4);
+}
+
+TEST_CASE("pooled memory policy") {
+    std::mt19937 gen(18);
+    auto builder = values_builder_t<double, imsym::pool_memory_policy>{};
+    auto poses = std::vector<Pose3d>{};
+    for (int i = 0; i < 1000; i++) {
+        poses.push_back(sym::Random<Pose3d>(gen));
+        builder.set(imsym::key::key_t{.letter = 'P', .sub = i}, poses.back());
+    }
+    const auto pooled = std::move(builder).finalize();
+    CHECK(imsym::pool_heap_t::stats().slabs > 0);
+    for (int i = 0; i < 1000; i++) {
+        CHECK(at<double, Pose3d>(pooled, imsym::key::key_t{.letter = 'P', .sub = i}) == poses[i]);
+    }
+
+    // the ops are the same on any policy
+    const auto trimmed = compact(remove(pooled, imsym::key::key_t{.letter = 'P', .sub = 0}));
+    CHECK(trimmed.num_entries() == 999);
+    CHECK(trimmed.data.size() == pooled.data.size() - 7);
+    CHECK(at<double, Pose3d>(trimmed, imsym::key::key_t{.letter = 'P', .sub = 999}) == poses[999]);
+
+    // and values move between policies by copy
+    const auto plain = rebind<immer::default_memory_policy>(pooled);
+    CHECK(contents_equal(plain, rebind<immer::default_memory_policy>(pooled)));
+    const auto round_trip = rebind<imsym::pool_memory_policy>(plain);
+    CHECK(contents_equal(round_trip, pooled));
+
+    // nodes can be freed on a different thread than the one which allocated them
+    auto copy = trimmed;
+    std::thread([moved = std::move(copy)]() mutable {
+        moved = {};
+        imsym::pool_heap_t::flush();
+    }).join();
+    CHECK(at<double, Pose3d>(trimmed, imsym::key::key_t{.letter = 'P', .sub = 1}) == poses[1]);
+
+    const auto m = imsym::pooled_dense_matrix<double>{.size = {2, 2}, .data = {1.0, 2.0, 3.0, 4.0}};
+    CHECK(imsym::to_eigen(m)(1, 0) == 2.0);
+
+    // freeing more than a thread caches hands the rest to the depot, and it is reused from there
+    auto nodes = std::vector<void*>(3 * imsym::pool_heap_t::kMaxCached);
+    for (auto& node : nodes) {
+        node = imsym::pool_heap_t::allocate(48);
+    }
+    const auto slabs = imsym::pool_heap_t::stats().slabs;
+    for (auto* node : nodes) {
+        imsym::pool_heap_t::deallocate(48, node);
+    }
+    for (auto& node : nodes) {
+        node = imsym::pool_heap_t::allocate(48);
+    }
+    CHECK(imsym::pool_heap_t::stats().slabs == slabs);
+    CHECK(std::unordered_set<void*>(nodes.begin(), nodes.end()).size() == nodes.size());
+    for (auto* node : nodes) {
+        imsym::pool_heap_t::deallocate(48, node);
+    }
+}
+
+TEST_CASE("thread local values") {
+    std::mt19937 gen(19);
+    auto builder = values_builder_t<double>{};
+    for (int i = 0; i < 100; i++) {
+        builder.set(imsym::key::key_t{.letter = 'P', .sub = i}, sym::Random<Pose3d>(gen));
+    }
+    const auto shared = std::move(builder).finalize();
+    const auto pose = sym::Random<Pose3d>(gen);
+    const auto p0 = imsym::key::key_t{.letter = 'P', .sub = 0};
+    const auto p1 = imsym::key::key_t{.letter = 'P', .sub = 1};
+
+    auto local = to_local(shared);
+    CHECK(contents_equal(to_shared(local), shared));
+    local = compact(remove(set(local, p0, pose), p1));
+    CHECK(at<double, Pose3d>(local, p0) == pose);
+    CHECK(not has(local, p1));
+
+    const auto published = to_shared(local);
+    CHECK(contents_equal(published, compact(remove(set(shared, p0, pose), p1))));
+
+    // once published it can be read and released on another thread
+    auto read = Pose3d{};
+    std::thread([copy = published, &read, p0]() mutable {
+        read = at<Pose3d>(copy, p0);
+        copy = {};
+    }).join();
+    CHECK(read == pose);
+}
+
+namespace {
+
+// by value edits, every intermediate kept like an optimizer keeping its best values
+template<typename Values>
+auto copy_heavy(Values values, const std::vector<Pose3d>& poses) -> size_t {
+    auto snapshots = std::vector<Values>{};
+    snapshots.reserve(poses.size());
+    for (size_t i = 0; i < poses.size(); i++) {
+        const auto key = imsym::key::key_t{.letter = 'P', .sub = static_cast<int>(i % 100)};
+        values = update(values, key, poses[i]);
+        snapshots.push_back(values);
+        snapshots.push_back(snapshots.back());
+    }
+    return snapshots.size();
+}
+
+}   // namespace
+
+TEST_CASE("thread local values benchmark", "[.][benchmark]") {
+    std::mt19937 gen(19);
+    auto builder = values_builder_t<double>{};
+    auto poses = std::vector<Pose3d>{};
+    for (int i = 0; i < 10000; i++) {
+        poses.push_back(sym::Random<Pose3d>(gen));
+        builder.set(imsym::key::key_t{.letter = 'P', .sub = i % 100}, poses.back());
+    }
+    const auto shared = std::move(builder).finalize();
+    const auto local = to_local(shared);
+
+    BENCHMARK("shared copies") {
+        auto copies = std::vector<valuesd_t>(10000, shared);
+        return copies.size();
+    };
+    BENCHMARK("local copies") {
+        auto copies = std::vector<imsym::local_valuesd_t>(10000, local);
+        return copies.size();
+    };
+    BENCHMARK("shared by value updates") {
+        return copy_heavy(shared, poses);
+    };
+    BENCHMARK("local by value updates") {
+        return copy_heavy(local, poses);
+    };
+    BENCHMARK("to_shared") {
+        return to_shared(local);
+    };
+}
+
+TEST_CASE("csc sparse matrix") {
+    std::mt19937 gen(21);
+    auto uniform = std::uniform_real_distribution<double>(-1.0, 1.0);
+    const auto random_sparse = [&](const int rows, const int cols, const double density) {
+        auto triplets = std::vector<Eigen::Triplet<double>>{};
+        for (int col = 0; col < cols; col++) {
+            for (int row = 0; row < rows; row++) {
+                if (std::abs(uniform(gen)) < density) {
+                    triplets.push_back({row, col, uniform(gen)});
+                }
+            }
+        }
+        auto out = Eigen::SparseMatrix<double>(rows, cols);
+        out.setFromTriplets(triplets.begin(), triplets.end());
+        return out;
+    };
+
+    SECTION("round trip through eigen") {
+        const auto eigen = random_sparse(200, 150, 0.1);
+        const auto m = imsym::to_imsym(eigen);
+        CHECK(m.size.row == 200);
+        CHECK(m.size.col == 150);
+        CHECK(imsym::nonzeros(m) == static_cast<size_t>(eigen.nonZeros()));
+        CHECK(m.column_pointers.size() == 151);
+        CHECK((imsym::to_eigen(m) - eigen).norm() == 0.0);
+        for (int col = 0; col < eigen.cols(); col++) {
+            for (int row = 0; row < eigen.rows(); row += 7) {
+                CHECK(imsym::coeff(m, row, col) == eigen.coeff(row, col));
+            }
+        }
+
+        // row major and uncompressed inputs come out the same
+        const auto row_major = Eigen::SparseMatrix<double, Eigen::RowMajor>(eigen);
+        CHECK(imsym::to_imsym(row_major).values == m.values);
+        auto uncompressed = eigen;
+        uncompressed.coeffRef(0, 0) += 1.0;
+        CHECK(imsym::coeff(imsym::to_imsym(uncompressed), 0, 0) == eigen.coeff(0, 0) + 1.0);
+    }
+
+    SECTION("eigen view maps small matrices in place and copies large ones") {
+        const auto small = imsym::to_imsym(random_sparse(4, 4, 0.5));
+        const auto small_view = imsym::eigen_view(small);
+        CHECK(small_view.zero_copy());
+        CHECK(small_view.map.valuePtr() == imsym::values::single_chunk(small.values));
+        CHECK((Eigen::SparseMatrix<double>(small_view.map) - imsym::to_eigen(small)).norm() == 0.0);
+
+        const auto eigen = random_sparse(300, 300, 0.2);
+        auto view = imsym::eigen_view(imsym::to_imsym(eigen));
+        CHECK(not view.zero_copy());
+        const auto moved = std::move(view);
+        CHECK((Eigen::SparseMatrix<double>(moved.map) - eigen).norm() == 0.0);
+    }
+
+    SECTION("empty") {
+        const auto empty = imsym::sparse_matrix_t{.size = {3, 2}};
+        CHECK(imsym::coeff(empty, 1, 1) == 0.0);
+        const auto eigen = imsym::to_eigen(empty);
+        CHECK(eigen.rows() == 3);
+        CHECK(eigen.nonZeros() == 0);
+        CHECK(imsym::eigen_view(empty).map.cols() == 2);
+    }
+
+    SECTION("matrices over a shared structure") {
+        const auto m = imsym::to_imsym(random_sparse(100, 80, 0.1));
+        const auto pattern = imsym::structure(m);
+        auto scaled = immer::vector<double>{};
+        for (const auto v : m.values) {
+            scaled = std::move(scaled).push_back(2.0 * v);
+        }
+        const auto m_2 = imsym::with_values(pattern, scaled);
+        CHECK(m_2.row_indices.identity() == m.row_indices.identity());
+        CHECK(m_2.column_pointers.identity() == m.column_pointers.identity());
+        CHECK((imsym::to_eigen(m_2) - 2.0 * imsym::to_eigen(m)).norm() == 0.0);
+        CHECK_THROWS(imsym::with_values(pattern, scaled.push_back(1.0)));
+    }
+}
+
+TEST_CASE("csc sparse matrix benchmark", "[.][benchmark]") {
+    std::mt19937 gen(21);
+    auto uniform = std::uniform_real_distribution<double>(-1.0, 1.0);
+    auto triplets = std::vector<Eigen::Triplet<double>>{};
+    for (int col = 0; col < 2000; col++) {
+        for (int i = 0; i < 500; i++) {
+            triplets.push_back({static_cast<int>((uniform(gen) + 1.0) * 5000), col, uniform(gen)});
+        }
+    }
+    auto eigen = Eigen::SparseMatrix<double>(10000, 2000);
+    eigen.setFromTriplets(triplets.begin(), triplets.end());
+    const auto m = imsym::to_imsym(eigen);
+
+    BENCHMARK("to_imsym 1M nonzeros") {
+        return imsym::to_imsym(eigen);
+    };
+    BENCHMARK("to_eigen 1M nonzeros") {
+        return imsym::to_eigen(m);
+    };
+    BENCHMARK("per nonzero map inserts 1M nonzeros") {
+        auto map = immer::map<imsym::coords_t, double>{}.transient();
+        for (int k = 0; k < eigen.outerSize(); ++k) {
+            for (Eigen::SparseMatrix<double>::InnerIterator it(eigen, k); it; ++it) {
+                map.set({it.row(), it.col()}, it.value());
+            }
+        }
+        return std::move(map).persistent();
+    };
+}
+
+namespace {
+
+template<typename Scalar>
+auto check_dense_conversions() -> void {
+    const auto eigen = Eigen::MatrixX<Scalar>::Random(70, 50).eval();
+
+    const auto m = imsym::to_imsym(eigen);
+    CHECK(m.size.row == 70);
+    CHECK(m.size.col == 50);
+    CHECK(m.data.size() == 70 * 50);
+    CHECK(m.data[69] == eigen(69, 0));
+    CHECK(m.data[70] == eigen(0, 1));
+    CHECK(imsym::to_eigen(m) == eigen);
+    CHECK(imsym::to_imsym_matrix(Eigen::Map<const Eigen::MatrixX<Scalar>>(
+                                     eigen.data(), eigen.rows(), eigen.cols()))
+              .data == m.data);
+    CHECK(imsym::to_eigen(m.data) == eigen.reshaped());
+
+    // more than a leaf, so the view is a copy
+    const auto view = imsym::eigen_view(m);
+    CHECK(not view.zero_copy());
+    CHECK(view.map == eigen);
+
+    // small enough for a single leaf, mapped in place
+    const auto small = imsym::to_imsym(Eigen::MatrixX<Scalar>::Random(3, 4).eval());
+    const auto small_view = imsym::eigen_view(small);
+    CHECK(small_view.zero_copy());
+    CHECK(small_view.map.data() == imsym::values::single_chunk(small.data));
+    CHECK(small_view.map == imsym::to_eigen(small));
+
+    // the lower triangle survives the trip, including columns split across leaves
+    for (const auto& [rows, cols] : {std::pair{40, 40}, std::pair{40, 25}, std::pair{25, 40}}) {
+        const auto full = Eigen::MatrixX<Scalar>::Random(rows, cols).eval();
+        const auto lt = imsym::to_imsym_lt(full);
+        const auto diagonal = std::min(rows, cols);
+        const auto packed = diagonal * rows - diagonal * (diagonal - 1) / 2;
+        CHECK(lt.data.size() == static_cast<size_t>(packed));
+        const auto back = imsym::to_eigen(lt);
+        for (int col = 0; col < diagonal; col++) {
+            CHECK(back.col(col).tail(rows - col) == full.col(col).tail(rows - col));
+        }
+    }
+
+    const auto empty = imsym::to_imsym(Eigen::MatrixX<Scalar>(0, 3));
+    CHECK(imsym::eigen_view(empty).map.cols() == 3);
+    CHECK_THROWS(imsym::eigen_view(imsym::dense_matrix<Scalar>{.size = {2, 2}, .data = {1, 2}}));
+
+    // a lower triangle with the wrong amount of data throws instead of walking off the end
+    using lt_t = imsym::dense_lt_matrix<Scalar>;
+    CHECK_THROWS(imsym::to_eigen(lt_t{.size = {2, 2}, .data = {1, 2}}));
+    CHECK_THROWS(imsym::to_eigen(lt_t{.size = {2, 2}, .data = {1, 2, 3, 4}}));
+    CHECK_THROWS(imsym::to_eigen(lt_t{.size = {1, 3}, .data = {1, 2}}));
+    CHECK(imsym::to_eigen(lt_t{.size = {0, 0}, .data = {}}).size() == 0);
+}
+
+}   // namespace
+
+TEST_CASE("dense matrix conversion") {
+    SECTION("double") {
+        check_dense_conversions<double>();
+    }
+    SECTION("float") {
+        check_dense_conversions<float>();
+    }
+}
+
+TEST_CASE("dense matrix conversion benchmark", "[.][benchmark]") {
+    const Eigen::MatrixXd covariance = Eigen::MatrixXd::Random(2000, 2000);
+    const auto m = imsym::to_imsym(covariance);
+
+    BENCHMARK("to_imsym 2000x2000") {
+        return imsym::to_imsym(covariance);
+    };
+    BENCHMARK("push_back per element 2000x2000") {
+        auto out = imsym::dense_matrix_t{};
+        for (int col = 0; col < covariance.cols(); col++) {
+            for (int row = 0; row < covariance.rows(); row++) {
+                out.data = std::move(out.data).push_back(covariance(row, col));
+            }
+        }
+        return out;
+    };
+    BENCHMARK("to_eigen 2000x2000") {
+        return imsym::to_eigen(m);
+    };
+    BENCHMARK("indexed reads 2000x2000") {
+        auto out = Eigen::MatrixXd(2000, 2000);
+        for (int i = 0; i < 2000 * 2000; i++) {
+            out.data()[i] = m.data[i];
+        }
+        return out;
+    };
+    BENCHMARK("to_imsym_lt 2000x2000") {
+        return imsym::to_imsym_lt(covariance);
+    };
+}
+
+TEST_CASE("packed covariance") {
+    const auto n = 40;
+    const Eigen::MatrixXd r = Eigen::MatrixXd::Random(n, n);
+    const Eigen::MatrixXd a = r * r.transpose() + n * Eigen::MatrixXd::Identity(n, n);
+    const Eigen::MatrixXd b = Eigen::MatrixXd::Random(n, 3);
+    const imsym::full_covariance_t cov = imsym::to_full_covariance(a);
+
+    SECTION("packed storage") {
+        CHECK(cov.data.size() == static_cast<size_t>(n * (n + 1) / 2));
+        CHECK(imsym::coeff(cov, 3, 7) == a(7, 3));
+        CHECK(imsym::coeff(cov, 7, 3) == a(7, 3));
+        const auto full = imsym::to_eigen(cov);
+        CHECK(full.triangularView<Eigen::StrictlyUpper>().toDenseMatrix().isZero());
+        CHECK((full.selfadjointView<Eigen::Lower>() * b).isApprox(a * b));
+        CHECK(imsym::selfadjoint_product(cov, b).isApprox(a * b));
+        CHECK(imsym::selfadjoint_product(cov, b.col(0)).isApprox(a * b.col(0)));
+    }
+
+    SECTION("factorizations and solves") {
+        const auto l = imsym::llt(cov);
+        REQUIRE(l.info == Eigen::Success);
+        const Eigen::MatrixXd eigen_l = a.llt().matrixL();
+        CHECK(imsym::to_eigen(imsym::matrix_l(l)).isApprox(eigen_l));
+        CHECK(imsym::solve(l, b).isApprox(a.llt().solve(b)));
+        CHECK(imsym::solve_lower(l, b).isApprox(eigen_l.triangularView<Eigen::Lower>().solve(b)));
+        CHECK(imsym::solve_lower_transpose(l, b).isApprox(
+            eigen_l.transpose().triangularView<Eigen::Upper>().solve(b)));
+        // the same on the stored factor
+        const auto stored = imsym::matrix_l(l);
+        CHECK(imsym::solve_lower(stored, b).isApprox(imsym::solve_lower(l, b)));
+        CHECK(imsym::solve_lower_transpose(stored, b).isApprox(imsym::solve_lower_transpose(l, b)));
+
+        const auto ld = imsym::ldlt(cov);
+        REQUIRE(ld.info == Eigen::Success);
+        CHECK(imsym::solve(ld, b).isApprox(a.ldlt().solve(b)));
+        CHECK(imsym::solve(ld, b.col(1)).isApprox(a.ldlt().solve(b.col(1))));
+
+        auto indefinite = a;
+        indefinite(0, 0) = -1.0;
+        CHECK(imsym::llt(imsym::to_full_covariance(indefinite)).info == Eigen::NumericalIssue);
+        CHECK_THROWS(imsym::solve(imsym::llt(imsym::to_full_covariance(indefinite)), b));
+    }
+
+    SECTION("indefinite ldlt") {
+        // the second pivot is zero without pivoting
+        Eigen::Matrix3d small;
+        small << 1, 1, 2, 1, 1, 3, 2, 3, 5;
+        const auto ld = imsym::ldlt(imsym::to_full_covariance(Eigen::MatrixXd(small)));
+        REQUIRE(ld.info == Eigen::Success);
+        CHECK(std::count_if(ld.diagonal.begin(), ld.diagonal.end(), [](const double d) {
+                  return d < 0;
+              }) == 1);
+        const Eigen::MatrixXd rhs = Eigen::MatrixXd::Random(3, 2);
+        CHECK((small * imsym::solve(ld, rhs)).isApprox(rhs));
+
+        auto indefinite = a;
+        indefinite.diagonal().head(n / 2) *= -1.0;
+        const auto ldi = imsym::ldlt(imsym::to_full_covariance(indefinite));
+        REQUIRE(ldi.info == Eigen::Success);
+        CHECK((indefinite * imsym::solve(ldi, b)).isApprox(b));
+        CHECK(imsym::solve(ldi, b).isApprox(indefinite.ldlt().solve(b)));
+
+        // no usable 1x1 pivot anywhere, only 2x2 blocks
+        Eigen::MatrixXd hollow = r + r.transpose();
+        hollow.diagonal().setZero();
+        const auto ldh = imsym::ldlt(imsym::to_full_covariance(hollow));
+        REQUIRE(ldh.info == Eigen::Success);
+        CHECK(std::any_of(ldh.subdiagonal.begin(), ldh.subdiagonal.end(), [](const double d) {
+            return d != 0;
+        }));
+        CHECK((hollow * imsym::solve(ldh, b)).isApprox(b, 1e-8));
+    }
+
+    SECTION("float") {
+        const Eigen::MatrixXf af = a.cast<float>();
+        const auto covf = imsym::to_full_covariance(af);
+        const Eigen::MatrixXf bf = b.cast<float>();
+        CHECK(imsym::solve(imsym::llt(covf), bf).isApprox(af.llt().solve(bf), 1e-4f));
+        CHECK(imsym::solve(imsym::ldlt(covf), bf).isApprox(af.ldlt().solve(bf), 1e-4f));
+    }
+
+    SECTION("marginals by key") {
+        auto builder = values_builder_t<double>{};
+        for (int i = 0; i < 6; i++) {
+            builder.set(imsym::key::key_t{.letter = 'P', .sub = i}, Pose3d::Identity());
+        }
+        builder.set(imsym::key::key_t{.letter = 'm'}, 1.0);
+        builder.set(imsym::key::key_t{.letter = 'v'}, Vector3d::Zero().eval());
+        const auto values = std::move(builder).finalize();
+        const auto index = imsym::values::create_index(values, imsym::values::keys(values));
+        REQUIRE(index.tangent_dim == n);
+
+        long offset = 0;
+        for (const auto& entry : index.entries) {
+            const auto block = imsym::marginal(cov, index, entry.key);
+            CHECK(block.size.row == entry.tangent_dim);
+            CHECK(imsym::to_eigen(block) ==
+                  a.block(offset, offset, entry.tangent_dim, entry.tangent_dim));
+            offset += entry.tangent_dim;
+        }
+        CHECK_THROWS(imsym::marginal(cov, index, imsym::key::key_t{.letter = 'x'}));
+        CHECK_THROWS(imsym::marginal(cov, n - 2, 3));
+    }
+}
+
+TEST_CASE("packed covariance benchmark", "[.][benchmark]") {
+    const auto n = 2000;
+    const Eigen::MatrixXd r = Eigen::MatrixXd::Random(n, n);
+    const Eigen::MatrixXd a = r * r.transpose() + n * Eigen::MatrixXd::Identity(n, n);
+    const auto cov = imsym::to_full_covariance(a);
+    const Eigen::VectorXd b = Eigen::VectorXd::Random(n);
+
+    BENCHMARK("expand and factor 2000x2000") {
+        return imsym::to_eigen(cov).llt().solve(b).eval();
+    };
+    BENCHMARK("packed llt 2000x2000") {
+        return imsym::solve(imsym::llt(cov), b);
+    };
+    BENCHMARK("marginal 6x6 of 2000x2000") {
+        return imsym::marginal(cov, 1000, 6);
+    };
+}